@@ -143,6 +143,8 @@ void
 glamor_bind_texture(glamor_screen_private *glamor_priv, GLenum texture,
                     glamor_pixmap_fbo *fbo, Bool destination_red)
 {
+    glamor_fbo_resolve(glamor_priv, fbo);
+
     glActiveTexture(texture);
     glBindTexture(GL_TEXTURE_2D, fbo->tex);
 
@@ -193,6 +195,20 @@ glamor_create_pixmap(ScreenPtr screen, int w, int h, int depth,
 	(w == h && w == 24 && depth == 32)) {
         return fbCreatePixmap(screen, w, h, depth, usage);
     }
+    /* Window pixmaps usually end up being exported to a compositor;
+     * allocating them exportable now saves a copy when that happens.
+     */
+    if ((usage == CREATE_PIXMAP_USAGE_BACKING_PIXMAP
+#ifdef CREATE_PIXMAP_USAGE_SHARED
+         || usage == CREATE_PIXMAP_USAGE_SHARED
+#endif
+        ) && depth >= 24 && w > 0 && h > 0 &&
+        glamor_check_fbo_size(glamor_priv, w, h)) {
+        pixmap = glamor_egl_create_exportable_pixmap(screen, w, h, depth);
+        if (pixmap)
+            return pixmap;
+    }
+
     if ((usage == GLAMOR_CREATE_PIXMAP_CPU
          || (usage == CREATE_PIXMAP_USAGE_GLYPH_PICTURE &&
              w <= glamor_priv->glyph_max_dim &&
@@ -245,6 +261,12 @@ Bool
 glamor_destroy_pixmap(PixmapPtr pixmap)
 {
     if (pixmap->refcnt == 1) {
+        glamor_screen_private *glamor_priv =
+            glamor_get_screen_private(pixmap->drawable.pScreen);
+
+        /* Batched composites may still use its textures */
+        glamor_composite_flush(glamor_priv);
+        glamor_shadow_destroy_pixmap(pixmap);
         glamor_pixmap_destroy_fbo(pixmap);
     }
 
@@ -257,7 +279,9 @@ glamor_block_handler(ScreenPtr screen)
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_make_current(glamor_priv);
+    glamor_resolve_dirty_fbos(glamor_priv);
     glFlush();
+    glamor_fbo_expire(glamor_priv);
 }
 
 static void
@@ -266,7 +290,9 @@ _glamor_block_handler(ScreenPtr screen, void *timeout)
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_make_current(glamor_priv);
+    glamor_resolve_dirty_fbos(glamor_priv);
     glFlush();
+    glamor_fbo_expire(glamor_priv);
 
     screen->BlockHandler = glamor_priv->saved_procs.block_handler;
     screen->BlockHandler(screen, timeout);
@@ -550,8 +576,24 @@ glamor_init(ScreenPtr screen, unsigned int flags)
          * ES 3.0, but our glamor_program.c constructions use a lot of
          * compatibility features (to reduce the diff between 1.20 and
          * 1.30 programs).
+         *
+         * On ES 3.0 contexts, glamor_build_program can translate
+         * those 1.30 programs into GLSL ES 3.00, so advertise 1.30 to
+         * pick up the instanced and integer texture paths.
+         * GLAMOR_NO_GLSL_ES3 keeps the 1.20 tier for drivers whose
+         * ES 3.00 compiler can't cope.
          */
-        glamor_priv->glsl_version = 120;
+        if (gl_version >= 30 && glamor_priv->glsl_version >= 300 &&
+            !getenv("GLAMOR_NO_GLSL_ES3")) {
+            glamor_priv->glsl_version = 130;
+            glamor_priv->has_glsl_es3 = TRUE;
+        } else
+            glamor_priv->glsl_version = 120;
+
+        LogMessageVerb(X_INFO, 3,
+                       "glamor%d: %s, building programs as GLSL %s\n",
+                       screen->myNum, shading_version_string,
+                       glamor_priv->has_glsl_es3 ? "ES 3.00" : "ES 1.00");
     }
 
     /* We'd like to require GL_ARB_map_buffer_range or
@@ -587,9 +629,16 @@ glamor_init(ScreenPtr screen, unsigned int flags)
         }
     }
 
+    /* ES 3.0 has pack and unpack buffers along with glMapBufferRange,
+     * which is all the fallback staging path needs.  GLAMOR_NO_RW_PBO
+     * forces the old system memory path, e.g. to compare the
+     * fallback transfer times logged at server exit.
+     */
     glamor_priv->has_rw_pbo = FALSE;
-    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP)
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP || gl_version >= 30)
         glamor_priv->has_rw_pbo = TRUE;
+    if (getenv("GLAMOR_NO_RW_PBO"))
+        glamor_priv->has_rw_pbo = FALSE;
 
     glamor_priv->has_khr_debug = 0;//epoxy_has_gl_extension("GL_KHR_debug");
     glamor_priv->has_pack_invert =
@@ -598,7 +647,8 @@ glamor_init(ScreenPtr screen, unsigned int flags)
         epoxy_has_gl_extension("GL_EXT_framebuffer_blit");
     glamor_priv->has_map_buffer_range =
         epoxy_has_gl_extension("GL_ARB_map_buffer_range") ||
-        epoxy_has_gl_extension("GL_EXT_map_buffer_range");
+        epoxy_has_gl_extension("GL_EXT_map_buffer_range") ||
+        (glamor_priv->gl_flavor != GLAMOR_GL_DESKTOP && gl_version >= 30);
     glamor_priv->has_buffer_storage =
         epoxy_has_gl_extension("GL_ARB_buffer_storage");
     glamor_priv->has_nv_texture_barrier =
@@ -611,6 +661,8 @@ glamor_init(ScreenPtr screen, unsigned int flags)
         glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP ||
         epoxy_gl_version() >= 30 ||
         epoxy_has_gl_extension("GL_NV_pack_subimage");
+    glamor_priv->has_pack_pbo =
+        glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP || gl_version >= 30;
     glamor_priv->has_vertex_array_object =
         epoxy_has_gl_extension("GL_ARB_vertex_array_object");
     glamor_priv->has_dual_blend =
@@ -663,6 +715,9 @@ glamor_init(ScreenPtr screen, unsigned int flags)
     if (!glamor_font_init(screen))
         goto fail;
 
+    glamor_dash_init(screen);
+    glamor_shadow_init(screen);
+
     glamor_priv->saved_procs.block_handler = screen->BlockHandler;
     screen->BlockHandler = _glamor_block_handler;
 
@@ -713,6 +768,8 @@ glamor_init(ScreenPtr screen, unsigned int flags)
 
     glamor_init_vbo(screen);
 
+    glamor_program_cache_init(screen);
+
 #ifdef GLAMOR_GRADIENT_SHADER
     glamor_init_gradient_shader(screen);
 #endif
@@ -721,6 +778,9 @@ glamor_init(ScreenPtr screen, unsigned int flags)
 
     glamor_priv->screen = screen;
 
+    if (getenv("GLAMOR_PROGRAM_WARMUP"))
+        glamor_program_cache_warmup(screen);
+
     return TRUE;
 
  fail:
@@ -742,6 +802,9 @@ glamor_release_screen_priv(ScreenPtr screen)
     glamor_priv = glamor_get_screen_private(screen);
     glamor_fini_vbo(screen);
     glamor_pixmap_fini(screen);
+    free(glamor_priv->upload_staging);
+    free(glamor_priv->render_batch_vertices);
+    free(glamor_priv->program_cache_dir);
     free(glamor_priv);
 
     glamor_set_screen_private(screen, NULL);
@@ -755,8 +818,25 @@ glamor_close_screen(ScreenPtr screen)
     PictureScreenPtr ps = GetPictureScreenIfSet(screen);
 
     glamor_priv = glamor_get_screen_private(screen);
+    glamor_composite_flush(glamor_priv);
     glamor_sync_close(screen);
     glamor_composite_glyphs_fini(screen);
+    glamor_glyph_blt_fini(screen);
+    glamor_dash_fini(screen);
+    glamor_shadow_fini(screen);
+#ifdef GLAMOR_GRADIENT_SHADER
+    glamor_fini_gradient_shader(screen);
+#endif
+    glamor_prepare_fini(screen);
+    glamor_program_cache_fini(screen);
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: software fallbacks: trapezoids %lu, "
+                   "triangles %lu, addtraps %lu\n",
+                   screen->myNum, glamor_priv->trapezoid_fallbacks,
+                   glamor_priv->triangle_fallbacks,
+                   glamor_priv->addtraps_fallbacks);
+
     screen->CloseScreen = glamor_priv->saved_procs.close_screen;
     screen->CreateScreenResources =
         glamor_priv->saved_procs.create_screen_resources;
@@ -774,6 +854,7 @@ glamor_close_screen(ScreenPtr screen)
     ps->Composite = glamor_priv->saved_procs.composite;
     ps->Trapezoids = glamor_priv->saved_procs.trapezoids;
     ps->Triangles = glamor_priv->saved_procs.triangles;
+    ps->AddTraps = glamor_priv->saved_procs.addtraps;
     ps->CompositeRects = glamor_priv->saved_procs.composite_rects;
     ps->Glyphs = glamor_priv->saved_procs.glyphs;
 
@@ -822,6 +903,7 @@ glamor_fd_from_pixmap(ScreenPtr screen,
     case GLAMOR_TEXTURE_ONLY:
         if (!glamor_pixmap_ensure_fbo(pixmap, GL_RGBA, 0))
             return -1;
+        glamor_pixmap_resolve(pixmap);
         return glamor_egl_dri3_fd_name_from_tex(screen,
                                                 pixmap,
                                                 pixmap_priv->fbo->tex,
@@ -862,6 +944,7 @@ glamor_name_from_pixmap(PixmapPtr pixmap, CARD16 *stride, CARD32 *size)
     case GLAMOR_TEXTURE_ONLY:
         if (!glamor_pixmap_ensure_fbo(pixmap, GL_RGBA, 0))
             return -1;
+        glamor_pixmap_resolve(pixmap);
         return glamor_egl_dri3_fd_name_from_tex(pixmap->drawable.pScreen,
                                                 pixmap,
                                                 pixmap_priv->fbo->tex,
@@ -150,6 +150,15 @@ extern _X_EXPORT int glamor_egl_dri3_fd_name_from_tex(ScreenPtr, PixmapPtr,
 
 extern _X_EXPORT struct gbm_device *glamor_egl_get_gbm_device(ScreenPtr screen);
 
+/* @glamor_egl_create_exportable_pixmap: Allocate a pixmap that can be
+ * handed to clients without copying, or return NULL if the EGL layer
+ * can't or won't.  Called by glamor_create_pixmap for pixmaps that are
+ * likely to be exported.
+ */
+extern _X_EXPORT PixmapPtr glamor_egl_create_exportable_pixmap(ScreenPtr screen,
+                                                               int w, int h,
+                                                               int depth);
+
 /* @glamor_supports_pixmap_import_export: Returns whether
  * glamor_fd_from_pixmap(), glamor_name_from_pixmap(), and
  * glamor_pixmap_from_fd() are supported.
@@ -28,11 +28,69 @@
 
 #include "glamor_priv.h"
 
+static Bool
+glamor_trap_to_shape(const xTrap *trap, glamor_shape *shape)
+{
+    double top = xFixedToDouble(trap->top.y);
+    double bottom = xFixedToDouble(trap->bot.y);
+
+    if (bottom <= top)
+        return FALSE;
+
+    shape->top = top;
+    shape->bottom = bottom;
+    shape->x0 = xFixedToDouble(trap->top.l);
+    shape->dx0 = (xFixedToDouble(trap->bot.l) - shape->x0) / (bottom - top);
+    shape->x1 = xFixedToDouble(trap->top.r);
+    shape->dx1 = (xFixedToDouble(trap->bot.r) - shape->x1) / (bottom - top);
+    shape->split = bottom;
+    shape->dx2 = shape->dx1;
+    return TRUE;
+}
+
+static Bool
+glamor_add_traps_gl(PicturePtr picture, INT16 x_off, INT16 y_off,
+                    int ntrap, xTrap *traps)
+{
+    glamor_shape *shapes;
+    int n, nshape = 0;
+    Bool ret;
+
+    /* AddTraps only means something for alpha-only pictures */
+    if (!picture->pDrawable || PICT_FORMAT_TYPE(picture->format) != PICT_TYPE_A ||
+        PICT_FORMAT_BPP(picture->format) != 8)
+        return FALSE;
+
+    if (!glamor_pixmap_has_fbo(glamor_get_drawable_pixmap(picture->pDrawable)))
+        return FALSE;
+
+    shapes = xallocarray(ntrap, sizeof (glamor_shape));
+    if (!shapes)
+        return FALSE;
+
+    for (n = 0; n < ntrap; n++)
+        if (glamor_trap_to_shape(&traps[n], &shapes[nshape]))
+            nshape++;
+
+    ret = glamor_add_shapes(picture, x_off, y_off, nshape, shapes);
+    free(shapes);
+    return ret;
+}
+
 void
 glamor_add_traps(PicturePtr pPicture,
                  INT16 x_off,
                  INT16 y_off, int ntrap, xTrap *traps)
 {
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pPicture->pDrawable->pScreen);
+
+    if (glamor_add_traps_gl(pPicture, x_off, y_off, ntrap, traps))
+        return;
+
+    glamor_priv->addtraps_fallbacks++;
+    glamor_fallback("addtraps to %p (%c)\n", pPicture->pDrawable,
+                    glamor_get_drawable_location(pPicture->pDrawable));
     if (glamor_prepare_access_picture(pPicture, GLAMOR_ACCESS_RW)) {
         fbAddTraps(pPicture, x_off, y_off, ntrap, traps);
     }
@@ -0,0 +1,475 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Arcs and filled arcs.
+ *
+ * Each arc is a single quad covering its bounding box; the fragment
+ * shader works in the unit circle space of the ellipse and discards
+ * whatever is outside the ellipse (filled arcs) or too far from it
+ * (outlines), outside of the angle range, or on the wrong side of the
+ * chord.  With GLSL 1.30 the quads are instanced, otherwise every
+ * vertex carries a copy of the arc.
+ *
+ * Every pixel is painted at most once per arc, so any raster op
+ * works as long as the arcs themselves don't overlap.
+ */
+
+#include <math.h>
+
+#include "glamor_priv.h"
+#include "glamor_program.h"
+#include "glamor_transform.h"
+
+/* Sample positions are pushed right and down a bit so that pixel
+ * centers exactly on the left or top of a shape are inside it, and
+ * those on the right or bottom are not.
+ */
+#define GLAMOR_ARC_BIAS "vec2(0.015625, 0.00390625)"
+
+/* Larger than any angle range, disables the angle test */
+#define GLAMOR_ARC_FULL 7.0f
+
+static const char arc_vs_vars[] =
+    "attribute vec4 primitive;\n"
+    "attribute vec4 arc;\n"
+    "attribute vec4 chord;\n"
+    "varying vec2 arc_pos;\n"
+    "varying vec2 arc_radii;\n"
+    "varying vec3 arc_angles;\n"
+    "varying vec3 arc_chord;\n";
+
+#define GLAMOR_ARC_VS_EXEC                                              \
+    "       vec2 corner = vec2(mod(corner_index, 2.0), floor(corner_index / 2.0)) * 2.0 - 1.0;\n" \
+    "       vec2 pos = corner * (primitive.zw + arc.w);\n"             \
+    "       arc_pos = pos + " GLAMOR_ARC_BIAS ";\n"                    \
+    "       arc_radii = primitive.zw;\n"                               \
+    "       arc_angles = arc.xyz;\n"                                   \
+    "       arc_chord = chord.xyz;\n"                                  \
+    GLAMOR_POS(gl_Position, (primitive.xy + pos))
+
+/*
+ * Distances to the ellipse are estimated from the gradient of
+ * |uv| - 1, which is exact for circles; wide arcs are only drawn here
+ * when they are circular.  Angles are measured in the
+ * unit circle space with y up, which is the skewed angle space the
+ * protocol specifies.
+ */
+static const char arc_fs_vars[] =
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#endif\n"
+    "varying vec2 arc_pos;\n"
+    "varying vec2 arc_radii;\n"
+    "varying vec3 arc_angles;\n"
+    "varying vec3 arc_chord;\n";
+
+static const char arc_fs_exec[] =
+    "       vec2 uv = arc_pos / arc_radii;\n"
+    "       float len = max(length(uv), 0.0001);\n"
+    "       if (arc_angles.z < 0.0) {\n"
+    "               if (len >= 1.0)\n"
+    "                       discard;\n"
+    "       } else {\n"
+    "               vec2 grad = uv / (len * arc_radii);\n"
+    "               if (abs(len - 1.0) >= arc_angles.z * length(grad))\n"
+    "                       discard;\n"
+    "       }\n"
+    "       vec2 q = vec2(uv.x, -uv.y);\n"
+    "       if (arc_angles.y < 6.5) {\n"
+    "               float a = atan(q.y, q.x);\n"
+    "               if (mod(a - arc_angles.x, 6.28318531) >= arc_angles.y)\n"
+    "                       discard;\n"
+    "       }\n"
+    "       if (dot(arc_chord.xy, q) < arc_chord.z)\n"
+    "               discard;\n";
+
+static const glamor_facet glamor_facet_arc_130 = {
+    .name = "arc",
+    .version = 130,
+    .vs_vars = arc_vs_vars,
+    .vs_exec = ("       float corner_index = float(gl_VertexID);\n"
+                GLAMOR_ARC_VS_EXEC),
+    .fs_vars = arc_fs_vars,
+    .fs_exec = arc_fs_exec,
+    .source_name = "arc",
+    .mask_name = "chord",
+};
+
+static const glamor_facet glamor_facet_arc_120 = {
+    .name = "arc",
+    .vs_vars = arc_vs_vars,
+    .vs_exec = ("       float corner_index = chord.w;\n"
+                GLAMOR_ARC_VS_EXEC),
+    .fs_vars = arc_fs_vars,
+    .fs_exec = arc_fs_exec,
+    .source_name = "arc",
+    .mask_name = "chord",
+};
+
+/* One instance, or one vertex without instancing */
+typedef struct {
+    GLfloat cx, cy, rx, ry;             /* center and radii */
+    GLfloat start, extent, half_width, grow;
+    GLfloat nx, ny, c, corner;          /* chord half plane */
+} glamor_arc_vert;
+
+typedef struct {
+    Bool                instanced;
+    glamor_arc_vert     *verts;
+    int                 narc;
+} glamor_arc_geom;
+
+/*
+ * Convert a protocol angle (1/64 degree) to the angle of the same
+ * point on the unit circle the ellipse is mapped to
+ */
+static double
+glamor_arc_skew(int angle, int w, int h)
+{
+    double a = angle * (M_PI / (180.0 * 64.0));
+
+    if (w == h)
+        return a;
+    return atan2(sin(a) * w, cos(a) * h);
+}
+
+/*
+ * Add an arc.  half_width < 0 fills the arc; arc_mode is only used
+ * for filled arcs.
+ */
+static void
+glamor_arc_add(glamor_arc_geom *g, xArc *arc, GLfloat half_width, int arc_mode)
+{
+    GLfloat rx = arc->width / 2.0f;
+    GLfloat ry = arc->height / 2.0f;
+    glamor_arc_vert v;
+    int angle1 = arc->angle1;
+    int angle2 = arc->angle2;
+    Bool full = FALSE;
+    double start, extent;
+
+    if (angle2 >= 360 * 64 || angle2 <= -360 * 64)
+        full = TRUE;
+    else if (angle2 < 0) {
+        angle1 += angle2;
+        angle2 = -angle2;
+    }
+
+    v.cx = arc->x + rx;
+    v.cy = arc->y + ry;
+    v.rx = rx;
+    v.ry = ry;
+    v.half_width = half_width;
+    v.grow = MAX(half_width, 0) + 1;
+    v.nx = 0;
+    v.ny = 0;
+    v.c = -1;
+
+    if (full) {
+        v.start = 0;
+        v.extent = GLAMOR_ARC_FULL;
+    } else {
+        start = glamor_arc_skew(angle1, arc->width, arc->height);
+        extent = glamor_arc_skew(angle1 + angle2, arc->width, arc->height) -
+            start;
+        extent = fmod(extent + 4 * M_PI, 2 * M_PI);
+        start = fmod(start + 4 * M_PI, 2 * M_PI);
+
+        if (half_width < 0 && arc_mode == ArcChord) {
+            double mid = start + extent / 2;
+
+            /* Keep the side of the chord the arc is on */
+            v.start = 0;
+            v.extent = GLAMOR_ARC_FULL;
+            v.nx = cos(mid);
+            v.ny = sin(mid);
+            v.c = cos(extent / 2);
+        } else {
+            v.start = start;
+            v.extent = extent;
+        }
+    }
+
+    if (g->instanced) {
+        v.corner = 0;
+        g->verts[g->narc] = v;
+    } else {
+        static const GLfloat corner[6] = { 0, 1, 2, 1, 2, 3 };
+        glamor_arc_vert *out = g->verts + g->narc * 6;
+        int i;
+
+        for (i = 0; i < 6; i++) {
+            out[i] = v;
+            out[i].corner = corner[i];
+        }
+    }
+    g->narc++;
+}
+
+static char *
+glamor_arc_geom_init(ScreenPtr screen, glamor_arc_geom *g, int narcs)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    char *vbo_offset;
+
+    g->instanced = glamor_priv->glsl_version >= 130;
+    g->narc = 0;
+    if (!g->instanced)
+        narcs *= 6;
+    g->verts = glamor_get_vbo_space(screen, narcs * sizeof (glamor_arc_vert),
+                                    &vbo_offset);
+    return vbo_offset;
+}
+
+static Bool
+glamor_arc_draw(DrawablePtr drawable, GCPtr gc, glamor_arc_geom *g,
+                char *vbo_offset)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_program *prog;
+    int off_x, off_y;
+    int box_index;
+
+    glamor_put_vbo_space(screen);
+
+    if (!g->narc)
+        return TRUE;
+
+    prog = glamor_use_program_fill(pixmap, gc, &glamor_priv->arc_program,
+                                   g->instanced ? &glamor_facet_arc_130 :
+                                   &glamor_facet_arc_120);
+    if (!prog)
+        return FALSE;
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_MASK);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 4, GL_FLOAT, GL_FALSE,
+                          sizeof (glamor_arc_vert), vbo_offset);
+    glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 4, GL_FLOAT, GL_FALSE,
+                          sizeof (glamor_arc_vert),
+                          vbo_offset + 4 * sizeof (GLfloat));
+    glVertexAttribPointer(GLAMOR_VERTEX_MASK, 4, GL_FLOAT, GL_FALSE,
+                          sizeof (glamor_arc_vert),
+                          vbo_offset + 8 * sizeof (GLfloat));
+    if (g->instanced) {
+        glVertexAttribDivisor(GLAMOR_VERTEX_POS, 1);
+        glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 1);
+        glVertexAttribDivisor(GLAMOR_VERTEX_MASK, 1);
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+
+    glamor_pixmap_loop(pixmap_priv, box_index) {
+        int nbox = RegionNumRects(gc->pCompositeClip);
+        BoxPtr box = RegionRects(gc->pCompositeClip);
+
+        glamor_set_destination_drawable(drawable, box_index, TRUE, TRUE,
+                                        prog->matrix_uniform,
+                                        &off_x, &off_y);
+
+        while (nbox--) {
+            glScissor(box->x1 + off_x,
+                      box->y1 + off_y,
+                      box->x2 - box->x1,
+                      box->y2 - box->y1);
+            box++;
+            if (g->instanced)
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, g->narc);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, g->narc * 6);
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    if (g->instanced) {
+        glVertexAttribDivisor(GLAMOR_VERTEX_POS, 0);
+        glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 0);
+        glVertexAttribDivisor(GLAMOR_VERTEX_MASK, 0);
+    }
+    glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    return TRUE;
+}
+
+/* Where an arc reaches the protocol angle 'angle' */
+static void
+glamor_arc_point(const xArc *arc, int angle, double *x, double *y)
+{
+    double a = glamor_arc_skew(angle, arc->width, arc->height);
+
+    *x = arc->x + arc->width / 2.0 * (1 + cos(a));
+    *y = arc->y + arc->height / 2.0 * (1 - sin(a));
+}
+
+/*
+ * Wide arcs that follow each other end to start are joined by mi with
+ * the GC's join style, which the shader doesn't draw.  Points this
+ * close are treated as meeting so that anything mi might join falls
+ * back.
+ */
+static Bool
+glamor_arcs_joined(int narcs, const xArc *arcs)
+{
+    double end_x, end_y, start_x, start_y;
+    int i;
+
+    if (narcs < 2)
+        return FALSE;
+
+    for (i = 0; i < narcs; i++) {
+        const xArc *arc = &arcs[i];
+        const xArc *next = &arcs[(i + 1) % narcs];
+
+        glamor_arc_point(arc, arc->angle1 + arc->angle2, &end_x, &end_y);
+        glamor_arc_point(next, next->angle1, &start_x, &start_y);
+        if (fabs(end_x - start_x) < 1.0 && fabs(end_y - start_y) < 1.0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static Bool
+glamor_poly_arc_gl(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_arc_geom g;
+    GLfloat half_width;
+    char *vbo_offset;
+    int i;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (narcs < 1)
+        return TRUE;
+
+    if (gc->lineStyle != LineSolid &&
+        !(gc->lineStyle == LineDoubleDash && gc->fillStyle == FillTiled))
+        return FALSE;
+
+    /* Caps are only drawn as butt caps; degenerate arcs are lines.
+     * The outline distance and the radial end cuts are only exact for
+     * circles, so wide elliptical arcs, whose edges mi draws as offset
+     * curves, fall back too.
+     */
+    for (i = 0; i < narcs; i++) {
+        if (arcs[i].width == 0 || arcs[i].height == 0)
+            return FALSE;
+        if (gc->lineWidth == 0)
+            continue;
+        if (arcs[i].width != arcs[i].height)
+            return FALSE;
+        if ((gc->capStyle == CapRound || gc->capStyle == CapProjecting) &&
+            arcs[i].angle2 < 360 * 64 && arcs[i].angle2 > -360 * 64)
+            return FALSE;
+    }
+
+    if (gc->lineWidth != 0 && glamor_arcs_joined(narcs, arcs))
+        return FALSE;
+
+    /* Zero width arcs are as wide as a thin line */
+    half_width = gc->lineWidth ? gc->lineWidth / 2.0f : 0.5f;
+
+    glamor_make_current(glamor_priv);
+
+    vbo_offset = glamor_arc_geom_init(screen, &g, narcs);
+    for (i = 0; i < narcs; i++)
+        if (arcs[i].angle2 != 0)
+            glamor_arc_add(&g, &arcs[i], half_width, gc->arcMode);
+
+    return glamor_arc_draw(drawable, gc, &g, vbo_offset);
+}
+
+static void
+glamor_poly_arc_bail(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs)
+{
+    glamor_fallback("to %p (%c)\n", drawable,
+                    glamor_get_drawable_location(drawable));
+
+    miPolyArc(drawable, gc, narcs, arcs);
+}
+
+void
+glamor_poly_arc(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs)
+{
+    if (glamor_poly_arc_gl(drawable, gc, narcs, arcs))
+        return;
+    glamor_poly_arc_bail(drawable, gc, narcs, arcs);
+}
+
+static Bool
+glamor_poly_fill_arc_gl(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_arc_geom g;
+    char *vbo_offset;
+    int i;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (narcs < 1)
+        return TRUE;
+
+    glamor_make_current(glamor_priv);
+
+    vbo_offset = glamor_arc_geom_init(screen, &g, narcs);
+    for (i = 0; i < narcs; i++) {
+        /* Empty arcs cover nothing */
+        if (arcs[i].width == 0 || arcs[i].height == 0 || arcs[i].angle2 == 0)
+            continue;
+        glamor_arc_add(&g, &arcs[i], -1, gc->arcMode);
+    }
+
+    return glamor_arc_draw(drawable, gc, &g, vbo_offset);
+}
+
+static void
+glamor_poly_fill_arc_bail(DrawablePtr drawable, GCPtr gc,
+                          int narcs, xArc *arcs)
+{
+    glamor_fallback("to %p (%c)\n", drawable,
+                    glamor_get_drawable_location(drawable));
+
+    miPolyFillArc(drawable, gc, narcs, arcs);
+}
+
+void
+glamor_poly_fill_arc(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs)
+{
+    if (glamor_poly_fill_arc_gl(drawable, gc, narcs, arcs))
+        return;
+    glamor_poly_fill_arc_bail(drawable, gc, narcs, arcs);
+}
@@ -30,21 +30,57 @@
 
 #define DEFAULT_ATLAS_DIM       1024
 
+/* Atlas pages per glyph format */
+#define GLAMOR_GLYPH_ATLAS_PAGES        4
+
+/* Shelf heights are rounded up to this */
+#define GLAMOR_GLYPH_SHELF_ALIGN        4
+
 static DevPrivateKeyRec        glamor_glyph_private_key;
 
-struct glamor_glyph_private {
-    int16_t     x;
+/*
+ * Each atlas page is cut into horizontal shelves as glyphs arrive, and
+ * glyphs are packed left to right along the shelf of their height.
+ * When all pages are full, the least recently used shelf is emptied
+ * and reused, so only the glyphs on it need uploading again.
+ */
+struct glamor_glyph_shelf {
+    int16_t     page;
     int16_t     y;
+    int16_t     height;
+    int16_t     x;
+    /** glyphs cached with a different serial are gone */
     uint32_t    serial;
+    uint32_t    last_used;
+    int         nglyph;
+    int         area;
+};
+
+struct glamor_glyph_page {
+    PixmapPtr                   pixmap;
+    /** first row not yet given to a shelf */
+    int                         top;
+    int                         nshelf;
+    struct glamor_glyph_shelf   *shelves;
+};
+
+struct glamor_glyph_private {
+    int16_t                     x;
+    int16_t                     y;
+    struct glamor_glyph_shelf   *shelf;
+    uint32_t                    serial;
 };
 
 struct glamor_glyph_atlas {
-    PixmapPtr           atlas;
-    PictFormatPtr       format;
-    int                 x, y;
-    int                 row_height;
-    int                 nglyph;
-    uint32_t            serial;
+    PictFormatPtr               format;
+    struct glamor_glyph_page    pages[GLAMOR_GLYPH_ATLAS_PAGES];
+    int                         npage;
+    uint32_t                    serial;
+    uint32_t                    clock;
+
+    unsigned long               uploads;
+    unsigned long               evictions;
+    unsigned long               evicted_glyphs;
 };
 
 static inline struct glamor_glyph_private *glamor_get_glyph_private(PixmapPtr pixmap) {
@@ -118,63 +154,194 @@ glamor_copy_glyph(PixmapPtr     glyph_pixmap,
         glamor_destroy_pixmap(upload_pixmap);
 }
 
-static Bool
-glamor_glyph_atlas_init(ScreenPtr screen, struct glamor_glyph_atlas *atlas)
+static inline Bool
+glamor_glyph_cached(struct glamor_glyph_private *glyph_priv)
+{
+    return glyph_priv->shelf && glyph_priv->serial == glyph_priv->shelf->serial;
+}
+
+static struct glamor_glyph_page *
+glamor_glyph_page_alloc(ScreenPtr screen, struct glamor_glyph_atlas *atlas)
 {
     glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
-    PictFormatPtr               format = atlas->format;
+    int                         dim = glamor_priv->glyph_atlas_dim;
+    struct glamor_glyph_page    *page;
+
+    if (atlas->npage == GLAMOR_GLYPH_ATLAS_PAGES)
+        return NULL;
 
-    atlas->atlas = glamor_create_pixmap(screen, glamor_priv->glyph_atlas_dim,
-                                        glamor_priv->glyph_atlas_dim, format->depth,
+    page = &atlas->pages[atlas->npage];
+    page->shelves = calloc(dim / GLAMOR_GLYPH_SHELF_ALIGN, sizeof (*page->shelves));
+    if (!page->shelves)
+        return NULL;
+
+    page->pixmap = glamor_create_pixmap(screen, dim, dim, atlas->format->depth,
                                         GLAMOR_CREATE_FBO_NO_FBO);
-    if (!glamor_pixmap_has_fbo(atlas->atlas)) {
-        glamor_destroy_pixmap(atlas->atlas);
-        atlas->atlas = NULL;
+    if (!glamor_pixmap_has_fbo(page->pixmap)) {
+        glamor_destroy_pixmap(page->pixmap);
+        page->pixmap = NULL;
+        free(page->shelves);
+        page->shelves = NULL;
+        return NULL;
     }
-    atlas->x = 0;
-    atlas->y = 0;
-    atlas->row_height = 0;
-    atlas->serial++;
-    atlas->nglyph = 0;
-    return TRUE;
+    page->top = 0;
+    page->nshelf = 0;
+    atlas->npage++;
+    return page;
 }
 
-static Bool
-glamor_glyph_can_add(struct glamor_glyph_atlas *atlas, int dim, DrawablePtr glyph_draw)
+static void
+glamor_glyph_shelf_reset(struct glamor_glyph_atlas *atlas,
+                         struct glamor_glyph_shelf *shelf)
 {
-    /* Step down */
-    if (atlas->x + glyph_draw->width > dim) {
-        atlas->x = 0;
-        atlas->y += atlas->row_height;
-        atlas->row_height = 0;
+    if (shelf->nglyph) {
+        atlas->evictions++;
+        atlas->evicted_glyphs += shelf->nglyph;
     }
+    shelf->serial = ++atlas->serial;
+    shelf->x = 0;
+    shelf->nglyph = 0;
+    shelf->area = 0;
+}
 
-    /* Check for overfull */
-    if (atlas->y + glyph_draw->height > dim)
-        return FALSE;
+static struct glamor_glyph_shelf *
+glamor_glyph_shelf_new(struct glamor_glyph_atlas *atlas, int page_index,
+                       int dim, int height)
+{
+    struct glamor_glyph_page    *page = &atlas->pages[page_index];
+    struct glamor_glyph_shelf   *shelf;
 
-    return TRUE;
+    height = (height + GLAMOR_GLYPH_SHELF_ALIGN - 1) & ~(GLAMOR_GLYPH_SHELF_ALIGN - 1);
+    if (page->top + height > dim)
+        return NULL;
+
+    shelf = &page->shelves[page->nshelf++];
+    shelf->page = page_index;
+    shelf->y = page->top;
+    shelf->height = height;
+    shelf->last_used = atlas->clock;
+    glamor_glyph_shelf_reset(atlas, shelf);
+    page->top += height;
+    return shelf;
 }
 
-static Bool
-glamor_glyph_add(struct glamor_glyph_atlas *atlas, DrawablePtr glyph_draw)
+/*
+ * Find room for a glyph without disturbing anything already cached:
+ * a shelf of about the right height with space left, else a new shelf
+ * on an existing or new page.
+ */
+static struct glamor_glyph_shelf *
+glamor_glyph_find_space(ScreenPtr screen, struct glamor_glyph_atlas *atlas,
+                        DrawablePtr glyph_draw)
+{
+    glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
+    int                         dim = glamor_priv->glyph_atlas_dim;
+    int                         w = glyph_draw->width;
+    int                         h = glyph_draw->height;
+    int                         max_h = h + h / 4 + GLAMOR_GLYPH_SHELF_ALIGN;
+    struct glamor_glyph_shelf   *shelf;
+    int                         p, n;
+
+    for (p = 0; p < atlas->npage; p++) {
+        struct glamor_glyph_page *page = &atlas->pages[p];
+
+        for (n = 0; n < page->nshelf; n++) {
+            shelf = &page->shelves[n];
+            if (shelf->height >= h && shelf->height <= max_h &&
+                shelf->x + w <= dim)
+                return shelf;
+        }
+    }
+
+    for (p = 0; p < atlas->npage; p++) {
+        shelf = glamor_glyph_shelf_new(atlas, p, dim, h);
+        if (shelf)
+            return shelf;
+    }
+
+    if (glamor_glyph_page_alloc(screen, atlas))
+        return glamor_glyph_shelf_new(atlas, atlas->npage - 1, dim, h);
+
+    return NULL;
+}
+
+/*
+ * Everything is full: empty the least recently used shelf that is tall
+ * enough, or if there is none, the least recently used page.  Any
+ * queued glyphs must have been drawn before calling this.
+ */
+static struct glamor_glyph_shelf *
+glamor_glyph_evict(ScreenPtr screen, struct glamor_glyph_atlas *atlas,
+                   DrawablePtr glyph_draw)
+{
+    glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_glyph_shelf   *victim = NULL;
+    struct glamor_glyph_page    *page, *victim_page = NULL;
+    uint32_t                    page_used = 0;
+    int                         p, n;
+
+    for (p = 0; p < atlas->npage; p++) {
+        uint32_t used = 0;
+
+        page = &atlas->pages[p];
+        for (n = 0; n < page->nshelf; n++) {
+            struct glamor_glyph_shelf *shelf = &page->shelves[n];
+
+            /* Compare ages relative to now so that the clock can wrap */
+            if (atlas->clock - shelf->last_used < atlas->clock - used || n == 0)
+                used = shelf->last_used;
+            if (shelf->height < glyph_draw->height)
+                continue;
+            if (!victim ||
+                atlas->clock - shelf->last_used > atlas->clock - victim->last_used)
+                victim = shelf;
+        }
+        if (!victim_page ||
+            atlas->clock - used > atlas->clock - page_used) {
+            victim_page = page;
+            page_used = used;
+        }
+    }
+
+    if (victim) {
+        glamor_glyph_shelf_reset(atlas, victim);
+        victim->last_used = atlas->clock;
+        return victim;
+    }
+
+    if (!victim_page)
+        return NULL;
+
+    for (n = 0; n < victim_page->nshelf; n++)
+        glamor_glyph_shelf_reset(atlas, &victim_page->shelves[n]);
+    victim_page->nshelf = 0;
+    victim_page->top = 0;
+
+    return glamor_glyph_shelf_new(atlas, victim_page - atlas->pages,
+                                  glamor_priv->glyph_atlas_dim,
+                                  glyph_draw->height);
+}
+
+static void
+glamor_glyph_add(struct glamor_glyph_atlas *atlas,
+                 struct glamor_glyph_shelf *shelf, DrawablePtr glyph_draw)
 {
     PixmapPtr                   glyph_pixmap = (PixmapPtr) glyph_draw;
     struct glamor_glyph_private *glyph_priv = glamor_get_glyph_private(glyph_pixmap);
+    PixmapPtr                   page_pixmap = atlas->pages[shelf->page].pixmap;
 
-    glamor_copy_glyph(glyph_pixmap, &atlas->atlas->drawable, atlas->x, atlas->y);
-
-    glyph_priv->x = atlas->x;
-    glyph_priv->y = atlas->y;
-    glyph_priv->serial = atlas->serial;
+    glamor_copy_glyph(glyph_pixmap, &page_pixmap->drawable, shelf->x, shelf->y);
 
-    atlas->x += glyph_draw->width;
-    if (atlas->row_height < glyph_draw->height)
-        atlas->row_height = glyph_draw->height;
+    glyph_priv->x = shelf->x;
+    glyph_priv->y = shelf->y;
+    glyph_priv->shelf = shelf;
+    glyph_priv->serial = shelf->serial;
 
-    atlas->nglyph++;
+    shelf->x += glyph_draw->width;
+    shelf->nglyph++;
+    shelf->area += glyph_draw->width * glyph_draw->height;
 
-    return TRUE;
+    atlas->uploads++;
 }
 
 static const glamor_facet glamor_facet_composite_glyphs_130 = {
@@ -186,9 +353,7 @@ static const glamor_facet glamor_facet_composite_glyphs_130 = {
     .vs_exec = ("       vec2 pos = primitive.zw * vec2(gl_VertexID&1, (gl_VertexID&2)>>1);\n"
                 GLAMOR_POS(gl_Position, (primitive.xy + pos))
                 "       glyph_pos = (source + pos) * ATLAS_DIM_INV;\n"),
-    .fs_vars = ("varying vec2 glyph_pos;\n"
-                "out vec4 color0;\n"
-                "out vec4 color1;\n"),
+    .fs_vars = ("varying vec2 glyph_pos;\n"),
     .fs_exec = ("       vec4 mask = texture2D(atlas, glyph_pos);\n"),
     .source_name = "source",
     .locations = glamor_program_location_atlas,
@@ -232,11 +397,10 @@ glamor_glyphs_fini_facet(ScreenPtr screen)
 static void
 glamor_glyphs_flush(CARD8 op, PicturePtr src, PicturePtr dst,
                    glamor_program *prog,
-                   struct glamor_glyph_atlas *atlas, int nglyph)
+                   PixmapPtr atlas_pixmap, int nglyph)
 {
     DrawablePtr drawable = dst->pDrawable;
     glamor_screen_private *glamor_priv = glamor_get_screen_private(drawable->pScreen);
-    PixmapPtr atlas_pixmap = atlas->atlas;
     glamor_pixmap_private *atlas_priv = glamor_get_pixmap_private(atlas_pixmap);
     glamor_pixmap_fbo *atlas_fbo = glamor_pixmap_fbo_at(atlas_priv, 0);
     PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
@@ -262,6 +426,8 @@ glamor_glyphs_flush(CARD8 op, PicturePtr src, PicturePtr dst,
             glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
                                             prog->matrix_uniform,
                                             &off_x, &off_y);
+            glamor_fbo_mark_dirty(glamor_priv,
+                                  glamor_pixmap_fbo_at(pixmap_priv, box_index));
 
             /* Run over the clip list, drawing the glyphs
              * in each box
@@ -285,9 +451,6 @@ glamor_glyphs_flush(CARD8 op, PicturePtr src, PicturePtr dst,
         prog++;
     }
 
-    // workround the lack of glyphs for firefox.
-    glamor_flush();
-
     glDisable(GL_SCISSOR_TEST);
 
     if (glamor_glyph_use_130(glamor_priv)) {
@@ -360,9 +523,9 @@ glamor_composite_glyphs(CARD8 op,
     glamor_program *prog = NULL;
     glamor_program_render       *glyphs_program = &glamor_priv->glyphs_program;
     struct glamor_glyph_atlas    *glyph_atlas = NULL;
+    PixmapPtr glyph_page = NULL;
     int x = 0, y = 0;
     int n;
-    int glyph_atlas_dim = glamor_priv->glyph_atlas_dim;
     int glyph_max_dim = glamor_priv->glyph_max_dim;
     int nglyph = 0;
     int screen_num = screen->myNum;
@@ -395,7 +558,7 @@ glamor_composite_glyphs(CARD8 op,
                                 !glamor_pixmap_is_memory((PixmapPtr)glyph_draw)))
                 {
                     if (glyphs_queued) {
-                        glamor_glyphs_flush(op, src, dst, prog, glyph_atlas, glyphs_queued);
+                        glamor_glyphs_flush(op, src, dst, prog, glyph_page, glyphs_queued);
                         glyphs_queued = 0;
                     }
                 bail_one:
@@ -412,31 +575,41 @@ glamor_composite_glyphs(CARD8 op,
                      */
                     if (_X_UNLIKELY(next_atlas != glyph_atlas)) {
                         if (glyphs_queued) {
-                            glamor_glyphs_flush(op, src, dst, prog, glyph_atlas, glyphs_queued);
+                            glamor_glyphs_flush(op, src, dst, prog, glyph_page, glyphs_queued);
                             glyphs_queued = 0;
                         }
                         glyph_atlas = next_atlas;
+                        glyph_atlas->clock++;
                     }
 
-                    /* Glyph not cached in current atlas?
+                    /* Glyph not cached in the atlas?
                      */
-                    if (_X_UNLIKELY(glyph_priv->serial != glyph_atlas->serial)) {
-                        if (!glamor_glyph_can_add(glyph_atlas, glyph_atlas_dim, glyph_draw)) {
+                    if (_X_UNLIKELY(!glamor_glyph_cached(glyph_priv))) {
+                        struct glamor_glyph_shelf *shelf;
+
+                        shelf = glamor_glyph_find_space(screen, glyph_atlas, glyph_draw);
+                        if (!shelf) {
+                            /* Queued glyphs may live on the shelf we evict */
                             if (glyphs_queued) {
-                                glamor_glyphs_flush(op, src, dst, prog, glyph_atlas, glyphs_queued);
+                                glamor_glyphs_flush(op, src, dst, prog, glyph_page, glyphs_queued);
                                 glyphs_queued = 0;
                             }
-                            if (glyph_atlas->atlas) {
-                                (*screen->DestroyPixmap)(glyph_atlas->atlas);
-                                glyph_atlas->atlas = NULL;
-                            }
-                        }
-                        if (!glyph_atlas->atlas) {
-                            glamor_glyph_atlas_init(screen, glyph_atlas);
-                            if (!glyph_atlas->atlas)
+                            shelf = glamor_glyph_evict(screen, glyph_atlas, glyph_draw);
+                            if (!shelf)
                                 goto bail_one;
                         }
-                        glamor_glyph_add(glyph_atlas, glyph_draw);
+                        glamor_glyph_add(glyph_atlas, shelf, glyph_draw);
+                    }
+                    glyph_priv->shelf->last_used = glyph_atlas->clock;
+
+                    /* Switching atlas page?
+                     */
+                    if (_X_UNLIKELY(glyph_atlas->pages[glyph_priv->shelf->page].pixmap != glyph_page)) {
+                        if (glyphs_queued) {
+                            glamor_glyphs_flush(op, src, dst, prog, glyph_page, glyphs_queued);
+                            glyphs_queued = 0;
+                        }
+                        glyph_page = glyph_atlas->pages[glyph_priv->shelf->page].pixmap;
                     }
 
                     /* First glyph in the current atlas?
@@ -503,7 +676,7 @@ glamor_composite_glyphs(CARD8 op,
     }
 
     if (glyphs_queued)
-        glamor_glyphs_flush(op, src, dst, prog, glyph_atlas, glyphs_queued);
+        glamor_glyphs_flush(op, src, dst, prog, glyph_page, glyphs_queued);
 
     return;
 }
@@ -521,7 +694,6 @@ glamor_alloc_glyph_atlas(ScreenPtr screen, int depth, CARD32 f)
     if (!glyph_atlas)
         return NULL;
     glyph_atlas->format = format;
-    glyph_atlas->serial = 1;
 
     return glyph_atlas;
 }
@@ -556,12 +728,33 @@ glamor_composite_glyphs_init(ScreenPtr screen)
 }
 
 static void
-glamor_free_glyph_atlas(struct glamor_glyph_atlas *atlas)
+glamor_free_glyph_atlas(ScreenPtr screen, struct glamor_glyph_atlas *atlas,
+                        const char *name)
 {
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    unsigned long area = 0;
+    int p, n;
+
     if (!atlas)
         return;
-    if (atlas->atlas)
-        (*atlas->atlas->drawable.pScreen->DestroyPixmap)(atlas->atlas);
+
+    for (p = 0; p < atlas->npage; p++) {
+        struct glamor_glyph_page *page = &atlas->pages[p];
+
+        for (n = 0; n < page->nshelf; n++)
+            area += page->shelves[n].area;
+        (*screen->DestroyPixmap)(page->pixmap);
+        free(page->shelves);
+    }
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: %s glyph atlas: %d pages, %lu%% occupied, "
+                   "%lu uploads, %lu shelves evicted (%lu glyphs)\n",
+                   screen->myNum, name, atlas->npage,
+                   atlas->npage ? area * 100 /
+                   ((unsigned long) atlas->npage * glamor_priv->glyph_atlas_dim *
+                    glamor_priv->glyph_atlas_dim) : 0,
+                   atlas->uploads, atlas->evictions, atlas->evicted_glyphs);
     free (atlas);
 }
 
@@ -571,6 +764,6 @@ glamor_composite_glyphs_fini(ScreenPtr screen)
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_glyphs_fini_facet(screen);
-    glamor_free_glyph_atlas(glamor_priv->glyph_atlas_a);
-    glamor_free_glyph_atlas(glamor_priv->glyph_atlas_argb);
+    glamor_free_glyph_atlas(screen, glamor_priv->glyph_atlas_a, "a8");
+    glamor_free_glyph_atlas(screen, glamor_priv->glyph_atlas_argb, "argb");
 }
@@ -311,6 +311,20 @@ bail:
     return FALSE;
 }
 
+/*
+ * Build the copy area program ahead of the first CopyArea
+ */
+
+void
+glamor_copy_warmup(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (!glamor_priv->copy_area_prog.prog && !glamor_priv->copy_area_prog.failed)
+        glamor_build_program(screen, &glamor_priv->copy_area_prog,
+                             &glamor_facet_copyarea, NULL, NULL, NULL);
+}
+
 /*
  * Copy from GPU to GPU by using the source
  * as a texture and painting that into the destination
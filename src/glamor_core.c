@@ -98,6 +98,10 @@ glamor_link_glsl_prog(ScreenPtr screen, GLint prog, const char *format, ...)
         va_end(va);
     }
 
+    /* Ask the driver to keep the binary around for the program cache */
+    if (glamor_priv->program_cache_dir && !glamor_priv->program_binary_oes)
+        glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
     glLinkProgram(prog);
     glGetProgramiv(prog, GL_LINK_STATUS, &ok);
     if (!ok) {
@@ -123,16 +127,16 @@ static GCOps glamor_gc_ops = {
     .PolyPoint = glamor_poly_point,
     .Polylines = glamor_poly_lines,
     .PolySegment = glamor_poly_segment,
-    .PolyRectangle = miPolyRectangle,
-    .PolyArc = miPolyArc,
-    .FillPolygon = miFillPolygon,
+    .PolyRectangle = glamor_poly_rectangle,
+    .PolyArc = glamor_poly_arc,
+    .FillPolygon = glamor_fill_polygon,
     .PolyFillRect = glamor_poly_fill_rect,
-    .PolyFillArc = miPolyFillArc,
+    .PolyFillArc = glamor_poly_fill_arc,
     .PolyText8 = glamor_poly_text8,
     .PolyText16 = glamor_poly_text16,
     .ImageText8 = glamor_image_text8,
     .ImageText16 = glamor_image_text16,
-    .ImageGlyphBlt = miImageGlyphBlt,
+    .ImageGlyphBlt = glamor_image_glyph_blt,
     .PolyGlyphBlt = glamor_poly_glyph_blt,
     .PushPixels = glamor_push_pixels,
 };
@@ -279,7 +283,7 @@ glamor_validate_gc(GCPtr gc, unsigned long changes, DrawablePtr drawable)
         glamor_gc_private *gc_priv = glamor_get_gc_private(gc);
 
         if (gc_priv->dash) {
-            glamor_destroy_pixmap(gc_priv->dash);
+            glamor_dash_release(gc->pScreen, gc_priv->dash);
             gc_priv->dash = NULL;
         }
     }
@@ -293,7 +297,7 @@ glamor_destroy_gc(GCPtr gc)
     glamor_gc_private *gc_priv = glamor_get_gc_private(gc);
 
     if (gc_priv->dash) {
-        glamor_destroy_pixmap(gc_priv->dash);
+        glamor_dash_release(gc->pScreen, gc_priv->dash);
         gc_priv->dash = NULL;
     }
     glamor_invalidate_stipple(gc);
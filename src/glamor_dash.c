@@ -74,61 +74,177 @@ static const glamor_facet glamor_facet_double_dash_lines = {
                   glamor_program_location_bg),
 };
 
+/* Unused patterns kept around for GCs created later */
+#define GLAMOR_DASH_CACHE_SIZE  64
+
+void
+glamor_dash_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    xorg_list_init(&glamor_priv->dash_cache);
+    glamor_priv->dash_cache_count = 0;
+}
+
+static void
+glamor_dash_destroy(glamor_screen_private *glamor_priv, glamor_dash *dash)
+{
+    xorg_list_del(&dash->link);
+    glamor_priv->dash_cache_count--;
+    if (dash->pixmap)
+        glamor_destroy_pixmap(dash->pixmap);
+    free(dash->dash);
+    free(dash);
+}
+
+/*
+ * Drop least recently used patterns that no GC refers to until the
+ * cache is back under its limit.
+ */
+static void
+glamor_dash_trim(glamor_screen_private *glamor_priv)
+{
+    struct xorg_list *link = glamor_priv->dash_cache.prev;
+
+    while (glamor_priv->dash_cache_count > GLAMOR_DASH_CACHE_SIZE &&
+           link != &glamor_priv->dash_cache) {
+        glamor_dash *dash = xorg_list_entry(link, glamor_dash, link);
+
+        link = link->prev;
+        if (dash->refcnt == 0)
+            glamor_dash_destroy(glamor_priv, dash);
+    }
+}
+
+void
+glamor_dash_release(ScreenPtr screen, glamor_dash *dash)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (--dash->refcnt == 0)
+        glamor_dash_trim(glamor_priv);
+}
+
+void
+glamor_dash_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_dash *dash, *tmp;
+
+    xorg_list_for_each_entry_safe(dash, tmp, &glamor_priv->dash_cache, link)
+        glamor_dash_destroy(glamor_priv, dash);
+}
+
+/*
+ * Build the pattern texture for a dash list: one texel per pixel of
+ * the pattern, alternating between on (0xff) and off (0) for each
+ * dash element, uploaded in one go.
+ */
 static PixmapPtr
-glamor_get_dash_pixmap(GCPtr gc)
+glamor_dash_create_pixmap(ScreenPtr screen, int ndash, unsigned char *dashes)
 {
-    glamor_gc_private *gc_priv = glamor_get_gc_private(gc);
-    ScreenPtr   screen = gc->pScreen;
     PixmapPtr   pixmap;
-    int         offset;
+    glamor_pixmap_private *pixmap_priv;
+    uint8_t     *bits;
+    uint8_t     value;
+    BoxRec      box;
+    int         length;
+    int         stride;
     int         d;
-    uint32_t    pixel;
-    GCPtr       scratch_gc;
-
-    if (gc_priv->dash)
-        return gc_priv->dash;
 
-    offset = 0;
-    for (d = 0; d < gc->numInDashList; d++)
-        offset += gc->dash[d];
+    length = 0;
+    for (d = 0; d < ndash; d++)
+        length += dashes[d];
+    if (length == 0)
+        return NULL;
 
-    pixmap = glamor_create_pixmap(screen, offset, 1, 8, 0);
+    pixmap = glamor_create_pixmap(screen, length, 1, 8, 0);
     if (!pixmap)
-        goto bail;
+        return NULL;
+
+    pixmap_priv = glamor_get_pixmap_private(pixmap);
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        goto bail_pixmap;
 
-    scratch_gc = GetScratchGC(8, screen);
-    if (!scratch_gc)
+    stride = (length + 3) & ~3;
+    bits = malloc(stride);
+    if (!bits)
         goto bail_pixmap;
 
-    pixel = 0xffffffff;
-    offset = 0;
-    for (d = 0; d < gc->numInDashList; d++) {
-        xRectangle      rect;
-        ChangeGCVal     changes;
-
-        changes.val = pixel;
-        (void) ChangeGC(NullClient, scratch_gc,
-                        GCForeground, &changes);
-        ValidateGC(&pixmap->drawable, scratch_gc);
-        rect.x = offset;
-        rect.y = 0;
-        rect.width = gc->dash[d];
-        rect.height = 1;
-        scratch_gc->ops->PolyFillRect (&pixmap->drawable, scratch_gc, 1, &rect);
-        offset += gc->dash[d];
-        pixel = ~pixel;
+    value = 0xff;
+    length = 0;
+    for (d = 0; d < ndash; d++) {
+        memset(bits + length, value, dashes[d]);
+        length += dashes[d];
+        value = ~value;
     }
-    FreeScratchGC(scratch_gc);
 
-    gc_priv->dash = pixmap;
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = length;
+    box.y2 = 1;
+    glamor_upload_boxes(pixmap, &box, 1, 0, 0, 0, 0, bits, stride);
+    free(bits);
+
     return pixmap;
 
 bail_pixmap:
     glamor_destroy_pixmap(pixmap);
-bail:
     return NULL;
 }
 
+/*
+ * Find the pattern texture for the GC's dash list, sharing it with
+ * any other GC using the same list.  The dash offset is applied when
+ * drawing, so it isn't part of the pattern.
+ */
+static PixmapPtr
+glamor_get_dash_pixmap(GCPtr gc)
+{
+    glamor_gc_private *gc_priv = glamor_get_gc_private(gc);
+    ScreenPtr   screen = gc->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_dash *dash;
+
+    if (gc_priv->dash)
+        return gc_priv->dash->pixmap;
+
+    xorg_list_for_each_entry(dash, &glamor_priv->dash_cache, link) {
+        if (dash->ndash == gc->numInDashList &&
+            memcmp(dash->dash, gc->dash, gc->numInDashList) == 0) {
+            xorg_list_del(&dash->link);
+            xorg_list_add(&dash->link, &glamor_priv->dash_cache);
+            goto found;
+        }
+    }
+
+    dash = calloc(1, sizeof (glamor_dash));
+    if (!dash)
+        return NULL;
+    dash->dash = malloc(gc->numInDashList);
+    if (!dash->dash) {
+        free(dash);
+        return NULL;
+    }
+    memcpy(dash->dash, gc->dash, gc->numInDashList);
+    dash->ndash = gc->numInDashList;
+    dash->pixmap = glamor_dash_create_pixmap(screen, dash->ndash, dash->dash);
+    if (!dash->pixmap) {
+        free(dash->dash);
+        free(dash);
+        return NULL;
+    }
+
+    xorg_list_add(&dash->link, &glamor_priv->dash_cache);
+    glamor_priv->dash_cache_count++;
+
+found:
+    dash->refcnt++;
+    gc_priv->dash = dash;
+    glamor_dash_trim(glamor_priv);
+    return dash->pixmap;
+}
+
 static glamor_program *
 glamor_dash_setup(DrawablePtr drawable, GCPtr gc)
 {
@@ -147,7 +263,9 @@ glamor_dash_setup(DrawablePtr drawable, GCPtr gc)
         goto bail;
 
     dash_pixmap = glamor_get_dash_pixmap(gc);
-    dash_priv = glamor_get_pixmap_private(pixmap);
+    if (!dash_pixmap)
+        goto bail;
+    dash_priv = glamor_get_pixmap_private(dash_pixmap);
 
     if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(dash_priv))
         goto bail;
@@ -33,7 +33,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <xf86.h>
 #include <xf86drm.h>
 #define EGL_DISPLAY_NO_X_MESA
@@ -52,11 +56,48 @@
 #define DRIHYBRIS
 #ifdef DRIHYBRIS
 #include "drihybris.h"
+#include "dixstruct.h"
 #include <hybris/eglplatformcommon/hybris_nativebufferext.h>
 #endif
 
 static const char glamor_name[] = "glamor";
 
+#ifdef DRIHYBRIS
+/* Released imports kept around in case the client sends them again */
+#define GLAMOR_HYBRIS_IMPORT_IDLE_MAX 8
+
+struct glamor_hybris_fd_id {
+    dev_t dev;
+    ino_t ino;
+};
+
+/*
+ * A remote buffer imported from a client, with its EGLImage.  Clients
+ * cycle through the same few swapchain buffers, so imports are looked
+ * up by the identity of the native handle: its ints and the files its
+ * fds refer to, since the fd numbers themselves change every time.
+ * That only works when each buffer has its own inode, which dma-buf
+ * fds get from Linux 5.3 on; before that they all share the anonymous
+ * inode and nothing is cached.  The import holds on to the fds, so a
+ * cached buffer can't be freed and its inode reused, and hits are
+ * further limited to the client that sent the buffer.
+ */
+struct glamor_hybris_import {
+    struct xorg_list link;
+    int refcnt;
+    Bool keyed;
+    ClientPtr owner;
+    int width, height, stride;
+    int num_ints;
+    int *ints;
+    int num_fds;
+    struct glamor_hybris_fd_id *fd_ids;
+    EGLClientBuffer buf;
+    EGLImageKHR image;
+    unsigned long size;
+};
+#endif
+
 static void
 glamor_identify(int flags)
 {
@@ -91,6 +132,26 @@ struct glamor_egl_screen_private {
     PFNEGLHYBRISCREATEREMOTEBUFFERPROC eglHybrisCreateRemoteBuffer;
     PFNEGLHYBRISGETNATIVEBUFFERINFOPROC eglHybrisGetNativeBufferInfo;
     PFNEGLHYBRISSERIALIZENATIVEBUFFERPROC eglHybrisSerializeNativeBuffer;
+
+    /** imports, most recently used first */
+    struct xorg_list hybris_imports;
+    /** the inode shared by all anonymous-inode files, if known */
+    Bool hybris_anon_known;
+    dev_t hybris_anon_dev;
+    ino_t hybris_anon_ino;
+    /** departing clients are reported, so imports can be keyed on them */
+    Bool hybris_client_callback;
+    int hybris_imports_idle;
+    unsigned long hybris_import_hits;
+    unsigned long hybris_import_misses;
+    unsigned long hybris_import_resident;
+
+    /** allocate likely-exported pixmaps as native buffers up front */
+    Bool hybris_export_prealloc;
+    unsigned long hybris_prealloc_pixmaps;
+    /** exports that still had to copy into a new native buffer */
+    unsigned long hybris_late_exports;
+    unsigned long hybris_late_export_bytes;
 #endif
 
     CloseScreenProcPtr saved_close_screen;
@@ -108,6 +169,16 @@ glamor_egl_get_screen_private(ScrnInfoPtr scrn)
         scrn->privates[xf86GlamorEGLPrivateIndex].ptr;
 }
 
+#ifdef DRIHYBRIS
+static void
+glamor_hybris_pixmap_release(struct glamor_egl_screen_private *glamor_egl,
+                             struct glamor_pixmap_private *pixmap_priv);
+static void
+glamor_hybris_import_fini(struct glamor_egl_screen_private *glamor_egl);
+static void
+glamor_hybris_client_state(CallbackListPtr *pcbl, void *closure, void *data);
+#endif
+
 static void
 glamor_egl_make_current(struct glamor_context *glamor_ctx)
 {
@@ -385,6 +456,9 @@ glamor_make_pixmap_exportable(PixmapPtr pixmap)
         return FALSE;
     }
 
+    glamor_egl->hybris_late_exports++;
+    glamor_egl->hybris_late_export_bytes += (unsigned long) width * height * 4;
+
     bo = gbm_bo_create(glamor_egl->gbm, width, height,
                        GBM_FORMAT_ARGB8888,
 #ifdef GLAMOR_HAS_GBM_LINEAR
@@ -569,6 +643,10 @@ glamor_egl_destroy_pixmap(PixmapPtr pixmap)
         struct glamor_pixmap_private *pixmap_priv =
             glamor_get_pixmap_private(pixmap);
 
+#ifdef DRIHYBRIS
+        if (pixmap_priv->hybris_import)
+            glamor_hybris_pixmap_release(glamor_egl, pixmap_priv);
+#endif
         if (pixmap_priv->image)
             eglDestroyImageKHR(glamor_egl->display, pixmap_priv->image);
 
@@ -596,6 +674,7 @@ glamor_egl_exchange_buffers(PixmapPtr front, PixmapPtr back)
         glamor_get_pixmap_private(back);
     struct gbm_bo *temp_bo;
     EGLClientBuffer temp_buf;
+    struct glamor_hybris_import *temp_import;
 
     glamor_pixmap_exchange_fbos(front, back);
 
@@ -610,6 +689,10 @@ glamor_egl_exchange_buffers(PixmapPtr front, PixmapPtr back)
     back_priv->buf = front_priv->buf;
     front_priv->buf = temp_buf;
 
+    temp_import = back_priv->hybris_import;
+    back_priv->hybris_import = front_priv->hybris_import;
+    front_priv->hybris_import = temp_import;
+
     glamor_set_pixmap_type(front, GLAMOR_TEXTURE_DRM);
     glamor_set_pixmap_type(back, GLAMOR_TEXTURE_DRM);
 }
@@ -630,6 +713,14 @@ glamor_egl_close_screen(ScreenPtr screen)
     eglDestroyImageKHR(glamor_egl->display, pixmap_priv->image);
     pixmap_priv->image = NULL;
 
+#ifdef DRIHYBRIS
+    DeleteCallback(&ClientStateCallback, glamor_hybris_client_state,
+                   glamor_egl);
+    glamor_egl->hybris_client_callback = FALSE;
+    if (glamor_egl->drihybris_capable)
+        glamor_hybris_import_fini(glamor_egl);
+#endif
+
     screen->CloseScreen = glamor_egl->saved_close_screen;
 
     return screen->CloseScreen(screen);
@@ -695,6 +786,267 @@ static dri3_screen_info_rec glamor_dri3_info = {
 #endif /* DRI3 */
 
 #ifdef DRIHYBRIS
+static void
+glamor_hybris_import_destroy(struct glamor_egl_screen_private *glamor_egl,
+                             struct glamor_hybris_import *import)
+{
+    xorg_list_del(&import->link);
+    glamor_egl->hybris_import_resident -= import->size;
+    eglDestroyImageKHR(glamor_egl->display, import->image);
+    glamor_egl->eglHybrisReleaseNativeBuffer(import->buf);
+    free(import->ints);
+    free(import->fd_ids);
+    free(import);
+}
+
+/*
+ * Drop a pixmap's reference to its import.  Unused imports stay cached
+ * until enough others have been released after them.
+ */
+static void
+glamor_hybris_pixmap_release(struct glamor_egl_screen_private *glamor_egl,
+                             struct glamor_pixmap_private *pixmap_priv)
+{
+    struct glamor_hybris_import *import = pixmap_priv->hybris_import;
+
+    pixmap_priv->hybris_import = NULL;
+    pixmap_priv->image = NULL;
+    pixmap_priv->buf = NULL;
+
+    if (--import->refcnt)
+        return;
+
+    if (!import->keyed) {
+        glamor_hybris_import_destroy(glamor_egl, import);
+        return;
+    }
+
+    xorg_list_del(&import->link);
+    xorg_list_add(&import->link, &glamor_egl->hybris_imports);
+    if (++glamor_egl->hybris_imports_idle > GLAMOR_HYBRIS_IMPORT_IDLE_MAX) {
+        struct glamor_hybris_import *oldest;
+
+        oldest = xorg_list_last_entry(&glamor_egl->hybris_imports,
+                                      struct glamor_hybris_import, link);
+        while (oldest->refcnt)
+            oldest = xorg_list_entry(oldest->link.prev,
+                                     struct glamor_hybris_import, link);
+        glamor_hybris_import_destroy(glamor_egl, oldest);
+        glamor_egl->hybris_imports_idle--;
+    }
+}
+
+/*
+ * Find out which inode files without one of their own report, so that
+ * buffers on kernels without per-buffer inodes are never matched up.
+ */
+static void
+glamor_hybris_find_anon_inode(struct glamor_egl_screen_private *glamor_egl)
+{
+#ifdef __linux__
+    struct stat st;
+    int fd;
+
+    fd = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) == 0) {
+        glamor_egl->hybris_anon_dev = st.st_dev;
+        glamor_egl->hybris_anon_ino = st.st_ino;
+        glamor_egl->hybris_anon_known = TRUE;
+    }
+    close(fd);
+#endif
+}
+
+static Bool
+glamor_hybris_fd_ids(struct glamor_egl_screen_private *glamor_egl,
+                     int num_fds, int *fds, struct glamor_hybris_fd_id *ids)
+{
+    struct stat st;
+    int i;
+
+    if (!glamor_egl->hybris_anon_known)
+        return FALSE;
+
+    for (i = 0; i < num_fds; i++) {
+        if (fstat(fds[i], &st) < 0)
+            return FALSE;
+        if (st.st_dev == glamor_egl->hybris_anon_dev &&
+            st.st_ino == glamor_egl->hybris_anon_ino)
+            return FALSE;
+        ids[i].dev = st.st_dev;
+        ids[i].ino = st.st_ino;
+    }
+    return TRUE;
+}
+
+/* The client whose request is being handled, if the server can tell us */
+static ClientPtr
+glamor_hybris_current_client(void)
+{
+#if XORG_VERSION_CURRENT >= XORG_VERSION_NUMERIC(21, 1, 0, 0, 0)
+    return GetCurrentClient();
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * A departing client's idle imports are dropped, and the ones still
+ * in use are no longer offered to anybody.
+ */
+static void
+glamor_hybris_client_state(CallbackListPtr *pcbl, void *closure, void *data)
+{
+    struct glamor_egl_screen_private *glamor_egl = closure;
+    NewClientInfoRec *clientinfo = data;
+    ClientPtr client = clientinfo->client;
+    struct glamor_hybris_import *import, *tmp;
+
+    if (client->clientState != ClientStateGone)
+        return;
+
+    xorg_list_for_each_entry_safe(import, tmp, &glamor_egl->hybris_imports,
+                                  link) {
+        if (import->owner != client)
+            continue;
+        import->owner = NULL;
+        import->keyed = FALSE;
+        if (import->refcnt == 0) {
+            glamor_hybris_import_destroy(glamor_egl, import);
+            glamor_egl->hybris_imports_idle--;
+        }
+    }
+}
+
+/*
+ * Find or create the import for a client buffer, taking a reference.
+ * Either way the import ends up owning 'fds': a new remote buffer
+ * takes them over, and on a hit they duplicate files already held.
+ */
+static struct glamor_hybris_import *
+glamor_hybris_import_get(struct glamor_egl_screen_private *glamor_egl,
+                         int width, int height, int stride,
+                         int num_ints, int *ints, int num_fds, int *fds)
+{
+    struct glamor_hybris_import *import;
+    struct glamor_hybris_fd_id *fd_ids;
+    ClientPtr owner = glamor_hybris_current_client();
+    Bool keyed;
+    int i;
+
+    fd_ids = xallocarray(num_fds, sizeof (*fd_ids));
+    keyed = owner && fd_ids && glamor_egl->hybris_client_callback &&
+        glamor_hybris_fd_ids(glamor_egl, num_fds, fds, fd_ids);
+
+    if (keyed) {
+        xorg_list_for_each_entry(import, &glamor_egl->hybris_imports, link) {
+            if (!import->keyed || import->owner != owner ||
+                import->width != width || import->height != height ||
+                import->stride != stride ||
+                import->num_ints != num_ints || import->num_fds != num_fds ||
+                memcmp(import->ints, ints, num_ints * sizeof (int)) ||
+                memcmp(import->fd_ids, fd_ids, num_fds * sizeof (*fd_ids)))
+                continue;
+
+            for (i = 0; i < num_fds; i++)
+                close(fds[i]);
+            free(fd_ids);
+
+            if (import->refcnt++ == 0)
+                glamor_egl->hybris_imports_idle--;
+            xorg_list_del(&import->link);
+            xorg_list_add(&import->link, &glamor_egl->hybris_imports);
+            glamor_egl->hybris_import_hits++;
+            return import;
+        }
+    }
+
+    glamor_egl->hybris_import_misses++;
+
+    import = calloc(1, sizeof (*import));
+    if (import && num_ints)
+        import->ints = xallocarray(num_ints, sizeof (int));
+    if (!import || (num_ints && !import->ints)) {
+        free(import);
+        free(fd_ids);
+        return NULL;
+    }
+
+    glamor_egl->eglHybrisCreateRemoteBuffer(width, height,
+                                            HYBRIS_USAGE_HW_TEXTURE,
+                                            HYBRIS_PIXEL_FORMAT_RGBA_8888,
+                                            stride, num_ints, ints,
+                                            num_fds, fds, &import->buf);
+
+    import->image = eglCreateImageKHR(glamor_egl->display, EGL_NO_CONTEXT,
+                                      EGL_NATIVE_BUFFER_HYBRIS, import->buf,
+                                      NULL);
+    if (import->image == EGL_NO_IMAGE_KHR) {
+        glamor_egl->eglHybrisReleaseNativeBuffer(import->buf);
+        free(import->ints);
+        free(import);
+        free(fd_ids);
+        return NULL;
+    }
+
+    import->refcnt = 1;
+    import->keyed = keyed;
+    import->owner = keyed ? owner : NULL;
+    import->width = width;
+    import->height = height;
+    import->stride = stride;
+    import->num_ints = num_ints;
+    if (num_ints)
+        memcpy(import->ints, ints, num_ints * sizeof (int));
+    import->num_fds = num_fds;
+    import->fd_ids = fd_ids;
+    import->size = (unsigned long) stride * height;
+
+    xorg_list_add(&import->link, &glamor_egl->hybris_imports);
+    glamor_egl->hybris_import_resident += import->size;
+    return import;
+}
+
+static void
+glamor_hybris_import_fini(struct glamor_egl_screen_private *glamor_egl)
+{
+    struct glamor_hybris_import *import, *tmp;
+    unsigned long lookups =
+        glamor_egl->hybris_import_hits + glamor_egl->hybris_import_misses;
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor: %lu pixmaps allocated exportable, %lu late "
+                   "exports copied %lu bytes\n",
+                   glamor_egl->hybris_prealloc_pixmaps,
+                   glamor_egl->hybris_late_exports,
+                   glamor_egl->hybris_late_export_bytes);
+    LogMessageVerb(X_INFO, 3,
+                   "glamor: hybris buffer imports: %lu hits, %lu misses "
+                   "(%lu%% hit rate), %lu bytes resident\n",
+                   glamor_egl->hybris_import_hits,
+                   glamor_egl->hybris_import_misses,
+                   lookups ? glamor_egl->hybris_import_hits * 100 / lookups : 0,
+                   glamor_egl->hybris_import_resident);
+
+    /* Imports still in use are detached from the cache, and go away
+     * with the last pixmap referencing them.
+     */
+    xorg_list_for_each_entry_safe(import, tmp, &glamor_egl->hybris_imports,
+                                  link) {
+        if (import->refcnt == 0) {
+            glamor_hybris_import_destroy(glamor_egl, import);
+        } else {
+            xorg_list_del(&import->link);
+            xorg_list_init(&import->link);
+            import->keyed = FALSE;
+            import->owner = NULL;
+        }
+    }
+    glamor_egl->hybris_imports_idle = 0;
+}
+
 Bool
 glamor_egl_create_textured_pixmap_from_egl_buffer(PixmapPtr pixmap,
                                               EGLClientBuffer buf)
@@ -712,7 +1064,9 @@ glamor_egl_create_textured_pixmap_from_egl_buffer(PixmapPtr pixmap,
 
     glamor_egl = glamor_egl_get_screen_private(scrn);
 
-    if (pixmap_priv->buf)
+    if (pixmap_priv->hybris_import)
+        glamor_hybris_pixmap_release(glamor_egl, pixmap_priv);
+    else if (pixmap_priv->buf)
         glamor_egl->eglHybrisReleaseNativeBuffer(pixmap_priv->buf);
 
     glamor_make_current(glamor_priv);
@@ -747,23 +1101,40 @@ glamor_back_pixmap_from_hybris_buffer(PixmapPtr pixmap,
 {
     ScreenPtr screen = pixmap->drawable.pScreen;
     ScrnInfoPtr scrn = xf86ScreenToScrn(screen);
+    struct glamor_pixmap_private *pixmap_priv =
+        glamor_get_pixmap_private(pixmap);
     struct glamor_egl_screen_private *glamor_egl;
-    Bool ret;
+    struct glamor_hybris_import *import;
+    GLuint texture;
 
     glamor_egl = glamor_egl_get_screen_private(scrn);
 
     if (bpp != 32 || !(depth == 24 || depth == 32) || width == 0 || height == 0)
         return FALSE;
 
-    EGLClientBuffer buf;
-    glamor_egl->eglHybrisCreateRemoteBuffer(width, height, HYBRIS_USAGE_HW_TEXTURE,
-                                            HYBRIS_PIXEL_FORMAT_RGBA_8888, stride,
-                                            numInts, ints, numFds, fds, &buf);
+    import = glamor_hybris_import_get(glamor_egl, width, height, stride,
+                                      numInts, ints, numFds, fds);
+    if (!import) {
+        glamor_set_pixmap_type(pixmap, GLAMOR_DRM_ONLY);
+        return FALSE;
+    }
 
     screen->ModifyPixmapHeader(pixmap, width, height, 0, 0, stride, NULL);
 
-    ret = glamor_egl_create_textured_pixmap_from_egl_buffer(pixmap, buf);
-    return ret;
+    if (pixmap_priv->hybris_import)
+        glamor_hybris_pixmap_release(glamor_egl, pixmap_priv);
+    else if (pixmap_priv->buf)
+        glamor_egl->eglHybrisReleaseNativeBuffer(pixmap_priv->buf);
+    glamor_egl_set_pixmap_image(pixmap, NULL);
+
+    glamor_create_texture_from_image(screen, import->image, &texture);
+    pixmap_priv->hybris_import = import;
+    pixmap_priv->image = import->image;
+    pixmap_priv->buf = import->buf;
+
+    glamor_set_pixmap_type(pixmap, GLAMOR_TEXTURE_DRM);
+    glamor_set_pixmap_texture(pixmap, texture);
+    return TRUE;
 }
 
 _X_EXPORT PixmapPtr
@@ -815,6 +1186,9 @@ glamor_hybris_make_pixmap_exportable(PixmapPtr pixmap)
         return FALSE;
     }
 
+    glamor_egl->hybris_late_exports++;
+    glamor_egl->hybris_late_export_bytes += (unsigned long) width * height * 4;
+
     EGLClientBuffer buf;
     err = glamor_egl->eglHybrisCreateNativeBuffer(width, height,
                                       HYBRIS_USAGE_HW_TEXTURE |
@@ -874,6 +1248,8 @@ glamor_hybris_buffer_from_pixmap(ScreenPtr screen,
         if (!glamor_hybris_make_pixmap_exportable(pixmap))
             return -1;
 
+        glamor_pixmap_resolve(pixmap);
+
         glamor_egl->eglHybrisGetNativeBufferInfo(pixmap_priv->buf, numInts, numFds);
 
         *ints = malloc(*numInts * sizeof(int));
@@ -889,6 +1265,51 @@ glamor_hybris_buffer_from_pixmap(ScreenPtr screen,
     return -1;
 }
 
+_X_EXPORT PixmapPtr
+glamor_egl_create_exportable_pixmap(ScreenPtr screen, int w, int h, int depth)
+{
+    ScrnInfoPtr scrn = xf86ScreenToScrn(screen);
+    struct glamor_egl_screen_private *glamor_egl =
+        glamor_egl_get_screen_private(scrn);
+    EGLClientBuffer buf = NULL;
+    PixmapPtr pixmap;
+    int stride;
+
+    if (!glamor_egl->drihybris_capable || !glamor_egl->hybris_export_prealloc)
+        return NULL;
+
+    pixmap = screen->CreatePixmap(screen, 0, 0, depth, 0);
+    if (!pixmap)
+        return NULL;
+
+    if (pixmap->drawable.bitsPerPixel != 32)
+        goto fail;
+
+    glamor_egl->eglHybrisCreateNativeBuffer(w, h,
+                                            HYBRIS_USAGE_HW_TEXTURE |
+                                            HYBRIS_USAGE_SW_READ_NEVER |
+                                            HYBRIS_USAGE_SW_WRITE_NEVER,
+                                            HYBRIS_PIXEL_FORMAT_RGBA_8888,
+                                            &stride, &buf);
+    if (!buf)
+        goto fail;
+
+    /* devKind only describes the CPU copy used for fallbacks */
+    screen->ModifyPixmapHeader(pixmap, w, h, 0, 0,
+                               ((w * 32 / 8) + 3) & ~3, NULL);
+    if (!glamor_egl_create_textured_pixmap_from_egl_buffer(pixmap, buf)) {
+        glamor_egl->eglHybrisReleaseNativeBuffer(buf);
+        goto fail;
+    }
+
+    glamor_egl->hybris_prealloc_pixmaps++;
+    return pixmap;
+
+fail:
+    screen->DestroyPixmap(pixmap);
+    return NULL;
+}
+
 static drihybris_screen_info_rec glamor_drihybris_info = {
     .version = 1,
     .pixmap_from_buffer = glamor_pixmap_from_hybris_buffer,
@@ -900,6 +1321,10 @@ Bool hwc_init_hybris_native_buffer(ScrnInfoPtr scrn)
     struct glamor_egl_screen_private *glamor_egl;
 
     glamor_egl = glamor_egl_get_screen_private(scrn);
+    xorg_list_init(&glamor_egl->hybris_imports);
+    glamor_hybris_find_anon_inode(glamor_egl);
+    glamor_egl->hybris_export_prealloc =
+        !getenv("GLAMOR_HYBRIS_NO_EXPORT_PREALLOC");
 
     if (strstr(eglQueryString(glamor_egl->display, EGL_EXTENSIONS), "EGL_HYBRIS_native_buffer") == NULL)
     {
@@ -983,6 +1408,11 @@ glamor_egl_screen_init(ScreenPtr screen, struct glamor_context *glamor_ctx)
 
 #ifdef DRIHYBRIS
     if (glamor_egl->drihybris_capable) {
+        /* Without hearing about departing clients, don't cache at all */
+        glamor_egl->hybris_client_callback =
+            AddCallback(&ClientStateCallback, glamor_hybris_client_state,
+                        glamor_egl);
+
         if (!drihybris_screen_init(screen, &glamor_drihybris_info)) {
             xf86DrvMsg(scrn->scrnIndex, X_ERROR,
                         "Failed to initialize DRIHYBRIS.\n");
@@ -43,3 +43,9 @@ glamor_egl_dri3_fd_name_from_tex(ScreenPtr screen,
 {
     return 0;
 }
+
+PixmapPtr
+glamor_egl_create_exportable_pixmap(ScreenPtr screen, int w, int h, int depth)
+{
+    return NULL;
+}
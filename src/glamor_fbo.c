@@ -30,20 +30,6 @@
 
 #include "glamor_priv.h"
 
-void
-glamor_destroy_fbo(glamor_screen_private *glamor_priv,
-                   glamor_pixmap_fbo *fbo)
-{
-    glamor_make_current(glamor_priv);
-
-    if (fbo->fb)
-        glDeleteFramebuffers(1, &fbo->fb);
-    if (fbo->tex)
-        glDeleteTextures(1, &fbo->tex);
-
-    free(fbo);
-}
-
 static int
 glamor_pixmap_ensure_fb(glamor_screen_private *glamor_priv,
                         glamor_pixmap_fbo *fbo)
@@ -93,6 +79,329 @@ glamor_pixmap_ensure_fb(glamor_screen_private *glamor_priv,
     return err;
 }
 
+static void
+glamor_purge_fbo(glamor_screen_private *glamor_priv,
+                 glamor_pixmap_fbo *fbo)
+{
+    glamor_make_current(glamor_priv);
+
+    if (fbo->fb)
+        glDeleteFramebuffers(1, &fbo->fb);
+    if (fbo->tex)
+        glDeleteTextures(1, &fbo->tex);
+
+    free(fbo);
+}
+
+static inline int
+cache_format(GLenum format)
+{
+    switch (format) {
+    case GL_RGBA:
+        return 0;
+    case GL_RGB:
+        return 1;
+    case GL_ALPHA:
+    case GL_LUMINANCE:
+    case GL_RED:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+static inline int
+cache_bucket(int size, int count)
+{
+    int order = 0;
+
+    size >>= 6;
+    while (size > 1 && order < count - 1) {
+        size >>= 1;
+        order++;
+    }
+    return order;
+}
+
+static inline struct xorg_list *
+cache_bucket_list(glamor_screen_private *glamor_priv,
+                  int w, int h, GLenum format)
+{
+    int n_format = cache_format(format);
+
+    if (n_format < 0)
+        return NULL;
+
+    return &glamor_priv->fbo_cache[n_format]
+        [cache_bucket(w, GLAMOR_FBO_CACHE_BUCKET_WCOUNT)]
+        [cache_bucket(h, GLAMOR_FBO_CACHE_BUCKET_HCOUNT)];
+}
+
+static inline unsigned long
+cache_fbo_size(glamor_pixmap_fbo *fbo)
+{
+    int cpp = cache_format(fbo->format) == 0 ? 4 :
+        cache_format(fbo->format) == 1 ? 3 : 1;
+
+    return (unsigned long) fbo->width * fbo->height * cpp;
+}
+
+static void
+glamor_fbo_cache_remove(glamor_screen_private *glamor_priv,
+                        glamor_pixmap_fbo *fbo)
+{
+    xorg_list_del(&fbo->list);
+    xorg_list_del(&fbo->lru);
+    glamor_priv->fbo_cache_size -= cache_fbo_size(fbo);
+}
+
+/*
+ * Look for a pooled fbo of exactly the requested size and format.
+ * Pixmap code computes texture coordinates from the fbo dimensions,
+ * so a larger texture can not stand in for a smaller one.
+ */
+static glamor_pixmap_fbo *
+glamor_fbo_cache_get(glamor_screen_private *glamor_priv,
+                     int w, int h, GLenum format, int flag)
+{
+    struct xorg_list *bucket;
+    glamor_pixmap_fbo *fbo;
+
+    bucket = cache_bucket_list(glamor_priv, w, h, format);
+    if (bucket == NULL)
+        return NULL;
+
+    xorg_list_for_each_entry(fbo, bucket, list) {
+        if (fbo->width != w || fbo->height != h || fbo->format != format)
+            continue;
+
+        glamor_fbo_cache_remove(glamor_priv, fbo);
+        if (flag != GLAMOR_CREATE_FBO_NO_FBO && fbo->fb == 0 &&
+            glamor_pixmap_ensure_fb(glamor_priv, fbo) != 0) {
+            glamor_purge_fbo(glamor_priv, fbo);
+            break;
+        }
+
+        glamor_priv->fbo_cache_hits++;
+        return fbo;
+    }
+
+    glamor_priv->fbo_cache_misses++;
+    return NULL;
+}
+
+static void
+glamor_fbo_cache_put(glamor_screen_private *glamor_priv,
+                     glamor_pixmap_fbo *fbo)
+{
+    struct xorg_list *bucket;
+    unsigned long size;
+
+    bucket = cache_bucket_list(glamor_priv, fbo->width, fbo->height,
+                               fbo->format);
+    size = cache_fbo_size(fbo);
+    if (bucket == NULL || fbo->tex == 0 || size > GLAMOR_FBO_CACHE_MAX_SIZE) {
+        glamor_purge_fbo(glamor_priv, fbo);
+        return;
+    }
+
+    fbo->expire = glamor_priv->tick + GLAMOR_FBO_CACHE_EXPIRE;
+    xorg_list_add(&fbo->list, bucket);
+    xorg_list_add(&fbo->lru, &glamor_priv->fbo_cache_lru);
+    glamor_priv->fbo_cache_size += size;
+
+    /* Over budget: drop the least recently released fbos first. */
+    while (glamor_priv->fbo_cache_size > GLAMOR_FBO_CACHE_MAX_SIZE) {
+        glamor_pixmap_fbo *old;
+
+        old = xorg_list_last_entry(&glamor_priv->fbo_cache_lru,
+                                   glamor_pixmap_fbo, lru);
+        glamor_fbo_cache_remove(glamor_priv, old);
+        glamor_purge_fbo(glamor_priv, old);
+    }
+}
+
+/* Drop every pooled fbo, returning whether anything was freed. */
+static Bool
+glamor_fbo_cache_purge(glamor_screen_private *glamor_priv)
+{
+    Bool freed = FALSE;
+
+    while (!xorg_list_is_empty(&glamor_priv->fbo_cache_lru)) {
+        glamor_pixmap_fbo *fbo;
+
+        fbo = xorg_list_first_entry(&glamor_priv->fbo_cache_lru,
+                                    glamor_pixmap_fbo, lru);
+        glamor_fbo_cache_remove(glamor_priv, fbo);
+        glamor_purge_fbo(glamor_priv, fbo);
+        freed = TRUE;
+    }
+
+    return freed;
+}
+
+/**
+ * Called from the block handler: advance the pool clock and free
+ * fbos that have sat unused for GLAMOR_FBO_CACHE_EXPIRE ticks.
+ */
+void
+glamor_fbo_expire(glamor_screen_private *glamor_priv)
+{
+    glamor_priv->tick++;
+
+    while (!xorg_list_is_empty(&glamor_priv->fbo_cache_lru)) {
+        glamor_pixmap_fbo *fbo;
+
+        fbo = xorg_list_last_entry(&glamor_priv->fbo_cache_lru,
+                                   glamor_pixmap_fbo, lru);
+        if ((int) (fbo->expire - glamor_priv->tick) > 0)
+            break;
+
+        glamor_fbo_cache_remove(glamor_priv, fbo);
+        glamor_purge_fbo(glamor_priv, fbo);
+    }
+}
+
+void
+glamor_init_pixmap_fbo(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    int i, j, k;
+
+    for (i = 0; i < GLAMOR_FBO_CACHE_FORMAT_COUNT; i++)
+        for (j = 0; j < GLAMOR_FBO_CACHE_BUCKET_WCOUNT; j++)
+            for (k = 0; k < GLAMOR_FBO_CACHE_BUCKET_HCOUNT; k++)
+                xorg_list_init(&glamor_priv->fbo_cache[i][j][k]);
+    xorg_list_init(&glamor_priv->fbo_cache_lru);
+    xorg_list_init(&glamor_priv->dirty_fbos);
+    glamor_priv->fbo_cache_size = 0;
+    glamor_priv->fbo_cache_hits = 0;
+    glamor_priv->fbo_cache_misses = 0;
+}
+
+void
+glamor_fini_pixmap_fbo(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: fbo pool: %lu hits, %lu misses\n",
+                   screen->myNum, glamor_priv->fbo_cache_hits,
+                   glamor_priv->fbo_cache_misses);
+
+    glamor_fbo_cache_purge(glamor_priv);
+}
+
+/**
+ * Some tiled GPUs only resolve rendering out of tile memory when the
+ * framebuffer is unbound, and clients (notably Firefox) may sample an
+ * fbo before that has happened.  Rather than rebinding after every
+ * draw, remember which fbos were rendered to and resolve them when
+ * they are sampled, exported or the block handler runs.
+ */
+void
+glamor_fbo_mark_dirty(glamor_screen_private *glamor_priv,
+                      glamor_pixmap_fbo *fbo)
+{
+    if (fbo->dirty || fbo->fb == 0)
+        return;
+
+    fbo->dirty = TRUE;
+    xorg_list_add(&fbo->dirty_link, &glamor_priv->dirty_fbos);
+}
+
+static void
+glamor_fbo_clean(glamor_pixmap_fbo *fbo)
+{
+    if (fbo->dirty) {
+        xorg_list_del(&fbo->dirty_link);
+        fbo->dirty = FALSE;
+    }
+}
+
+/*
+ * Only the currently bound framebuffer can hold unresolved rendering;
+ * switching to another one already forced the driver to resolve it.
+ */
+static void
+glamor_rebind_framebuffer(GLint fb)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+}
+
+void
+glamor_fbo_resolve(glamor_screen_private *glamor_priv,
+                   glamor_pixmap_fbo *fbo)
+{
+    GLint bound = 0;
+
+    if (!fbo->dirty)
+        return;
+
+    glamor_fbo_clean(fbo);
+
+    glamor_make_current(glamor_priv);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+    if (bound != 0 && bound == fbo->fb)
+        glamor_rebind_framebuffer(bound);
+}
+
+void
+glamor_pixmap_resolve(PixmapPtr pixmap)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pixmap->drawable.pScreen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    int box_index;
+
+    if (!priv->fbo)
+        return;
+
+    glamor_pixmap_loop(priv, box_index) {
+        glamor_pixmap_fbo *fbo = glamor_pixmap_fbo_at(priv, box_index);
+
+        if (fbo)
+            glamor_fbo_resolve(glamor_priv, fbo);
+    }
+}
+
+void
+glamor_resolve_dirty_fbos(glamor_screen_private *glamor_priv)
+{
+    glamor_pixmap_fbo *fbo, *tmp;
+    GLint bound = 0;
+    Bool rebind = FALSE;
+
+    if (xorg_list_is_empty(&glamor_priv->dirty_fbos))
+        return;
+
+    glamor_make_current(glamor_priv);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &bound);
+
+    xorg_list_for_each_entry_safe(fbo, tmp, &glamor_priv->dirty_fbos,
+                                  dirty_link) {
+        if (bound != 0 && bound == fbo->fb)
+            rebind = TRUE;
+        glamor_fbo_clean(fbo);
+    }
+
+    if (rebind)
+        glamor_rebind_framebuffer(bound);
+}
+
+void
+glamor_destroy_fbo(glamor_screen_private *glamor_priv,
+                   glamor_pixmap_fbo *fbo)
+{
+    glamor_fbo_clean(fbo);
+
+    if (fbo->recyclable)
+        glamor_fbo_cache_put(glamor_priv, fbo);
+    else
+        glamor_purge_fbo(glamor_priv, fbo);
+}
+
 glamor_pixmap_fbo *
 glamor_create_fbo_from_tex(glamor_screen_private *glamor_priv,
                            int w, int h, GLenum format, GLint tex, int flag)
@@ -110,7 +419,7 @@ glamor_create_fbo_from_tex(glamor_screen_private *glamor_priv,
 
     if (flag != GLAMOR_CREATE_FBO_NO_FBO) {
         if (glamor_pixmap_ensure_fb(glamor_priv, fbo) != 0) {
-            glamor_destroy_fbo(glamor_priv, fbo);
+            glamor_purge_fbo(glamor_priv, fbo);
             fbo = NULL;
         }
     }
@@ -157,8 +466,23 @@ glamor_pixmap_fbo *
 glamor_create_fbo(glamor_screen_private *glamor_priv,
                   int w, int h, GLenum format, int flag)
 {
-    GLint tex = _glamor_create_tex(glamor_priv, w, h, format);
-    return glamor_create_fbo_from_tex(glamor_priv, w, h, format, tex, flag);
+    glamor_pixmap_fbo *fbo;
+    GLint tex;
+
+    fbo = glamor_fbo_cache_get(glamor_priv, w, h, format, flag);
+    if (fbo)
+        return fbo;
+
+    tex = _glamor_create_tex(glamor_priv, w, h, format);
+    /* Out of texture memory: release the pool and try once more. */
+    if (!tex && glamor_fbo_cache_purge(glamor_priv))
+        tex = _glamor_create_tex(glamor_priv, w, h, format);
+
+    fbo = glamor_create_fbo_from_tex(glamor_priv, w, h, format, tex, flag);
+    if (fbo)
+        fbo->recyclable = TRUE;
+
+    return fbo;
 }
 
 /**
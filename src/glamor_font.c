@@ -35,17 +35,15 @@ glamor_font_get(ScreenPtr screen, FontPtr font)
 
     glamor_font_t       *privates;
     glamor_font_t       *glamor_font;
-    int                 overall_width, overall_height;
     int                 num_rows;
     int                 num_cols;
+    int                 page_rows;
     int                 glyph_width_pixels;
     int                 glyph_width_bytes;
     int                 glyph_height;
-    int                 row, col;
     unsigned char       c[2];
     CharInfoPtr         glyph;
     unsigned long       count;
-    char                *bits;
 
     if (glamor_priv->glsl_version < 130)
         return NULL;
@@ -73,32 +71,39 @@ glamor_font_get(ScreenPtr screen, FontPtr font)
 
     glyph_width_bytes = (glyph_width_pixels + 7) >> 3;
 
-    glamor_font->glyph_width_pixels = glyph_width_pixels;
-    glamor_font->glyph_width_bytes = glyph_width_bytes;
-    glamor_font->glyph_height = glyph_height;
-
     /*
-     * Layout the font two blocks of columns wide.
-     * This avoids a problem with some fonts that are too high to fit.
+     * Each row of the font gets its own texture page, with the glyphs
+     * laid out GLAMOR_FONT_PAGE_COLS across.  Pages are only created,
+     * and glyphs only uploaded, once they are drawn, so a large CJK
+     * font costs what is actually displayed.
      */
-    glamor_font->row_width = glyph_width_bytes * num_cols;
-
-    if (num_rows > 1) {
-       overall_width = glamor_font->row_width * 2;
-       overall_height = glyph_height * ((num_rows + 1) / 2);
-    } else {
-       overall_width = glamor_font->row_width;
-       overall_height = glyph_height;
+    page_rows = (num_cols + GLAMOR_FONT_PAGE_COLS - 1) / GLAMOR_FONT_PAGE_COLS;
+    glamor_font->page_glyphs = num_cols;
+    if (num_cols > GLAMOR_FONT_PAGE_COLS)
+        num_cols = GLAMOR_FONT_PAGE_COLS;
+
+    if (glyph_width_bytes * num_cols > glamor_priv->max_fbo_size ||
+        glyph_height * page_rows > glamor_priv->max_fbo_size) {
+        /* fallback if a page doesn't fit inside a texture */
+        return NULL;
     }
 
-    if (overall_width > glamor_priv->max_fbo_size ||
-        overall_height > glamor_priv->max_fbo_size) {
-        /* fallback if we don't fit inside a texture */
+    glamor_font->pages = calloc(num_rows, sizeof (glamor_font_page_t *));
+    glamor_font->scratch = malloc(glyph_width_bytes * glyph_height + 1);
+    if (!glamor_font->pages || !glamor_font->scratch) {
+        free(glamor_font->pages);
+        free(glamor_font->scratch);
+        glamor_font->pages = NULL;
+        glamor_font->scratch = NULL;
         return NULL;
     }
-    bits = malloc(overall_width * overall_height);
-    if (!bits)
-        return NULL;
+
+    glamor_font->num_pages = num_rows;
+    glamor_font->page_width = glyph_width_bytes * num_cols;
+    glamor_font->page_height = glyph_height * page_rows;
+    glamor_font->glyph_width_pixels = glyph_width_pixels;
+    glamor_font->glyph_width_bytes = glyph_width_bytes;
+    glamor_font->glyph_height = glyph_height;
 
     /* Check whether the font has a default character */
     c[0] = font->info.lastRow + 1;
@@ -109,59 +114,103 @@ glamor_font_get(ScreenPtr screen, FontPtr font)
     glamor_font->default_row = font->info.defaultCh >> 8;
     glamor_font->default_col = font->info.defaultCh;
 
-    glamor_priv = glamor_get_screen_private(screen);
-    glamor_make_current(glamor_priv);
+    glamor_font->realized = TRUE;
+
+    return glamor_font;
+}
+
+static glamor_font_page_t *
+glamor_font_page_create(glamor_screen_private *glamor_priv,
+                        glamor_font_t *glamor_font)
+{
+    glamor_font_page_t  *page;
+
+    page = calloc(1, sizeof (glamor_font_page_t));
+    if (!page)
+        return NULL;
 
-    glGenTextures(1, &glamor_font->texture_id);
+    glGenTextures(1, &page->texture_id);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, glamor_font->texture_id);
+    glBindTexture(GL_TEXTURE_2D, page->texture_id);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    /* Paint all of the glyphs */
-    for (row = 0; row < num_rows; row++) {
-        for (col = 0; col < num_cols; col++) {
-            c[0] = row + font->info.firstRow;
-            c[1] = col + font->info.firstCol;
-
-            (*font->get_glyphs)(font, 1, c, TwoD16Bit, &count, &glyph);
-
-            if (count) {
-                char *dst;
-                char *src = glyph->bits;
-                unsigned y;
-
-                dst = bits;
-                /* get offset of start of first row */
-                dst += (row / 2) * glyph_height * overall_width;
-                /* add offset into second row */
-                dst += (row & 1) ? glamor_font->row_width : 0;
-
-                dst += col * glyph_width_bytes;
-                for (y = 0; y < GLYPHHEIGHTPIXELS(glyph); y++) {
-                    memcpy(dst, src, GLYPHWIDTHBYTES(glyph));
-                    dst += overall_width;
-                    src += GLYPHWIDTHBYTESPADDED(glyph);
-                }
-            }
-        }
-    }
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
+    /* Only the texels under uploaded glyphs are ever fetched, so the
+     * page can start out undefined.
+     */
     glamor_priv->suppress_gl_out_of_memory_logging = true;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, overall_width, overall_height,
-                 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, bits);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI,
+                 glamor_font->page_width, glamor_font->page_height,
+                 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
     glamor_priv->suppress_gl_out_of_memory_logging = false;
-    if (glGetError() == GL_OUT_OF_MEMORY)
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        glDeleteTextures(1, &page->texture_id);
+        free(page);
         return NULL;
+    }
 
-    free(bits);
+    return page;
+}
 
-    glamor_font->realized = TRUE;
+/*
+ * Make sure the glyph at index 'col' of page 'row' is in its texture,
+ * creating the page on first use.  Must be called before the text
+ * program is bound, as the upload uses texture unit 0.
+ */
+Bool
+glamor_font_load_glyph(ScreenPtr screen, glamor_font_t *glamor_font,
+                       int row, int col, CharInfoPtr glyph)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_font_page_t  *page;
+    char                *dst, *src;
+    int                 width_bytes = GLYPHWIDTHBYTES(glyph);
+    int                 height = GLYPHHEIGHTPIXELS(glyph);
+    int                 y;
+
+    if (row < 0 || row >= glamor_font->num_pages ||
+        col < 0 || col >= glamor_font->page_glyphs)
+        return FALSE;
+
+    page = glamor_font->pages[row];
+    if (page && (page->loaded[col >> 5] & (1U << (col & 31))))
+        return TRUE;
 
-    return glamor_font;
+    if (width_bytes > glamor_font->glyph_width_bytes ||
+        height > glamor_font->glyph_height)
+        return FALSE;
+
+    if (!page) {
+        page = glamor_font_page_create(glamor_priv, glamor_font);
+        if (!page)
+            return FALSE;
+        glamor_font->pages[row] = page;
+    } else {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, page->texture_id);
+    }
+
+    if (width_bytes && height) {
+        dst = glamor_font->scratch;
+        src = (char *) glyph->bits;
+        for (y = 0; y < height; y++) {
+            memcpy(dst, src, width_bytes);
+            dst += width_bytes;
+            src += GLYPHWIDTHBYTESPADDED(glyph);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0,
+                        GLAMOR_FONT_GLYPH_X(glamor_font, col) >> 3,
+                        GLAMOR_FONT_GLYPH_Y(glamor_font, col),
+                        width_bytes, height,
+                        GL_RED_INTEGER, GL_UNSIGNED_BYTE,
+                        glamor_font->scratch);
+    }
+
+    page->loaded[col >> 5] |= 1U << (col & 31);
+    return TRUE;
 }
 
 static Bool
@@ -176,7 +225,9 @@ glamor_unrealize_font(ScreenPtr screen, FontPtr font)
     glamor_screen_private       *glamor_priv;
     glamor_font_t               *privates = FontGetPrivate(font, glamor_font_private_index);
     glamor_font_t               *glamor_font;
-    int                         s;
+    int                         s, p;
+
+    glamor_glyph_blt_font_gone(screen, font);
 
     if (!privates)
         return TRUE;
@@ -186,12 +237,22 @@ glamor_unrealize_font(ScreenPtr screen, FontPtr font)
     if (!glamor_font->realized)
         return TRUE;
 
-    /* Unrealize the font, freeing the allocated texture */
+    /* Unrealize the font, freeing the allocated textures */
     glamor_font->realized = FALSE;
 
     glamor_priv = glamor_get_screen_private(screen);
     glamor_make_current(glamor_priv);
-    glDeleteTextures(1, &glamor_font->texture_id);
+    for (p = 0; p < glamor_font->num_pages; p++) {
+        if (glamor_font->pages[p]) {
+            glDeleteTextures(1, &glamor_font->pages[p]->texture_id);
+            free(glamor_font->pages[p]);
+        }
+    }
+    free(glamor_font->pages);
+    free(glamor_font->scratch);
+    glamor_font->pages = NULL;
+    glamor_font->scratch = NULL;
+    glamor_font->num_pages = 0;
 
     /* Check to see if all of the screens are  done with this font
      * and free the private when that happens
@@ -208,11 +269,10 @@ glamor_unrealize_font(ScreenPtr screen, FontPtr font)
 Bool
 glamor_font_init(ScreenPtr screen)
 {
-    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
-
-    if (glamor_priv->glsl_version < 130)
-        return TRUE;
-
+    /* The hooks are installed even without font textures, as
+     * PolyGlyphBlt's glyph cache needs to hear about unrealized fonts;
+     * glamor_font_get() refuses to build textures before GLSL 1.30.
+     */
     if (glamor_font_generation != serverGeneration) {
         glamor_font_private_index = xfont2_allocate_font_private_index();
         if (glamor_font_private_index == -1)
@@ -23,23 +23,46 @@
 #ifndef _GLAMOR_FONT_H_
 #define _GLAMOR_FONT_H_
 
+/* Glyphs per texture page; one page holds one row of the font */
+#define GLAMOR_FONT_PAGE_GLYPHS 256
+#define GLAMOR_FONT_PAGE_COLS   16
+
+typedef struct {
+    GLuint      texture_id;
+    uint32_t    loaded[GLAMOR_FONT_PAGE_GLYPHS / 32];
+} glamor_font_page_t;
+
 typedef struct {
     Bool        realized;
     CharInfoPtr default_char;
     CARD8       default_row;
     CARD8       default_col;
 
-    GLuint      texture_id;
-    GLuint      row_width;
+    glamor_font_page_t **pages;         /* one per font row, or NULL */
+    int         num_pages;
+    int         page_glyphs;            /* glyphs in each font row */
+    int         page_width;             /* in bytes */
+    int         page_height;
     CARD16      glyph_width_bytes;
     CARD16      glyph_width_pixels;
     CARD16      glyph_height;
+    char        *scratch;               /* one glyph, packed for upload */
 
 } glamor_font_t;
 
+/* Position of a glyph within its page, in bits (pixels) */
+#define GLAMOR_FONT_GLYPH_X(glamor_font, col) \
+    (((col) % GLAMOR_FONT_PAGE_COLS) * (glamor_font)->glyph_width_bytes * 8)
+#define GLAMOR_FONT_GLYPH_Y(glamor_font, col) \
+    (((col) / GLAMOR_FONT_PAGE_COLS) * (glamor_font)->glyph_height)
+
 glamor_font_t *
 glamor_font_get(ScreenPtr screen, FontPtr font);
 
+Bool
+glamor_font_load_glyph(ScreenPtr screen, glamor_font_t *glamor_font,
+                       int row, int col, CharInfoPtr glyph);
+
 Bool
 glamor_font_init(ScreenPtr screen);
 
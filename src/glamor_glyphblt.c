@@ -145,11 +145,353 @@ bail:
     return FALSE;
 }
 
+/*
+ * Core glyph bitmaps drawn by PolyGlyphBlt are expanded to 8 bits per
+ * pixel and packed into shelves of a single alpha atlas, so that each
+ * glyph is one textured quad instead of one point per set bit.  Glyphs
+ * are found by their CharInfoPtr; when either the atlas or the table
+ * fills up everything is thrown away and packing starts over.  The
+ * cache is also dropped when a font holding cached glyphs is
+ * unrealized, as its CharInfo may then be reused.
+ */
+
+#define GLYPH_BLT_ATLAS_DIM     512     /* matches the shader's scale */
+#define GLYPH_BLT_CACHE_SIZE    2048    /* must be a power of two */
+
+struct glamor_glyph_blt_entry {
+    CharInfoPtr charinfo;
+    FontPtr     font;
+    INT16       x, y;
+};
+
+struct glamor_glyph_blt_cache {
+    PixmapPtr   atlas;
+    int         shelf_x, shelf_y, shelf_h;
+    int         nentry;
+    uint8_t     *scratch;
+    size_t      scratch_size;
+    struct glamor_glyph_blt_entry entries[GLYPH_BLT_CACHE_SIZE];
+};
+
+static const glamor_facet glamor_facet_poly_glyph_blt_atlas = {
+    .name = "poly_glyph_blt_atlas",
+    .vs_vars = ("attribute vec2 primitive;\n"
+                "attribute vec2 source;\n"
+                "varying vec2 glyph_pos;\n"),
+    .vs_exec = ("       vec2 pos = vec2(0,0);\n"
+                GLAMOR_POS(gl_Position, primitive)
+                "       glyph_pos = source * (1.0 / 512.0);\n"),
+    .fs_vars = ("varying vec2 glyph_pos;\n"),
+    .fs_exec = ("       if (texture2D(atlas, glyph_pos).w == 0.0)\n"
+                "               discard;\n"),
+    .source_name = "source",
+    .locations = glamor_program_location_atlas,
+};
+
+static void
+glamor_glyph_blt_cache_reset(struct glamor_glyph_blt_cache *cache)
+{
+    memset(cache->entries, 0, sizeof (cache->entries));
+    cache->nentry = 0;
+    cache->shelf_x = 0;
+    cache->shelf_y = 0;
+    cache->shelf_h = 0;
+}
+
+static struct glamor_glyph_blt_cache *
+glamor_glyph_blt_cache_get(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_glyph_blt_cache *cache = glamor_priv->glyph_blt_cache;
+
+    if (cache)
+        return cache->atlas ? cache : NULL;
+
+    cache = calloc(1, sizeof (*cache));
+    if (!cache)
+        return NULL;
+    glamor_priv->glyph_blt_cache = cache;
+
+    /* A failed atlas stays cached as NULL so we don't retry every call */
+    cache->atlas = glamor_create_pixmap(screen,
+                                        GLYPH_BLT_ATLAS_DIM,
+                                        GLYPH_BLT_ATLAS_DIM, 8,
+                                        GLAMOR_CREATE_FBO_NO_FBO);
+    if (cache->atlas &&
+        !glamor_pixmap_has_fbo(cache->atlas)) {
+        glamor_destroy_pixmap(cache->atlas);
+        cache->atlas = NULL;
+    }
+    return cache->atlas ? cache : NULL;
+}
+
+static struct glamor_glyph_blt_entry *
+glamor_glyph_blt_lookup(struct glamor_glyph_blt_cache *cache,
+                        CharInfoPtr charinfo)
+{
+    unsigned int i = ((uintptr_t) charinfo >> 4) & (GLYPH_BLT_CACHE_SIZE - 1);
+
+    while (cache->entries[i].charinfo && cache->entries[i].charinfo != charinfo)
+        i = (i + 1) & (GLYPH_BLT_CACHE_SIZE - 1);
+    return &cache->entries[i];
+}
+
+/*
+ * Find the atlas position of a glyph, uploading it if needed.  Returns
+ * NULL when there is no room left; the caller resets the cache and
+ * tries again.
+ */
+static struct glamor_glyph_blt_entry *
+glamor_glyph_blt_add(struct glamor_glyph_blt_cache *cache, FontPtr font,
+                     CharInfoPtr charinfo)
+{
+    struct glamor_glyph_blt_entry *entry;
+    int w = GLYPHWIDTHPIXELS(charinfo);
+    int h = GLYPHHEIGHTPIXELS(charinfo);
+    int glyph_stride = GLYPHWIDTHBYTESPADDED(charinfo);
+    uint8_t *glyphbits = FONTGLYPHBITS(NULL, charinfo);
+    int stride = (w + 3) & ~3;
+    uint8_t *dst;
+    BoxRec box;
+    int xx, yy;
+
+    entry = glamor_glyph_blt_lookup(cache, charinfo);
+    if (entry->charinfo)
+        return entry;
+
+    /* Keep the table at most half full so probes stay short */
+    if (cache->nentry >= GLYPH_BLT_CACHE_SIZE / 2)
+        return NULL;
+
+    if (cache->shelf_x + w > GLYPH_BLT_ATLAS_DIM) {
+        cache->shelf_x = 0;
+        cache->shelf_y += cache->shelf_h;
+        cache->shelf_h = 0;
+    }
+    if (cache->shelf_y + h > GLYPH_BLT_ATLAS_DIM)
+        return NULL;
+
+    if (cache->scratch_size < stride * h) {
+        free(cache->scratch);
+        cache->scratch_size = stride * h;
+        cache->scratch = malloc(cache->scratch_size);
+        if (!cache->scratch) {
+            cache->scratch_size = 0;
+            return NULL;
+        }
+    }
+
+    dst = cache->scratch;
+    for (yy = 0; yy < h; yy++) {
+        uint8_t *glyph = glyphbits;
+
+        for (xx = 0; xx < w; glyph += ((xx&7) == 7), xx++)
+            dst[xx] = (*glyph & (1 << (xx & 7))) ? 0xff : 0x00;
+        glyphbits += glyph_stride;
+        dst += stride;
+    }
+
+    box.x1 = cache->shelf_x;
+    box.y1 = cache->shelf_y;
+    box.x2 = box.x1 + w;
+    box.y2 = box.y1 + h;
+    glamor_upload_boxes(cache->atlas, &box, 1, 0, 0, box.x1, box.y1,
+                        cache->scratch, stride);
+
+    entry->charinfo = charinfo;
+    entry->font = font;
+    entry->x = box.x1;
+    entry->y = box.y1;
+    cache->nentry++;
+
+    cache->shelf_x += w;
+    if (h > cache->shelf_h)
+        cache->shelf_h = h;
+    return entry;
+}
+
+/* Make sure every glyph in the string is in the atlas */
+static Bool
+glamor_glyph_blt_fill_cache(struct glamor_glyph_blt_cache *cache,
+                            FontPtr font, unsigned int nglyph,
+                            CharInfoPtr *ppci, int *nquad)
+{
+    unsigned int n;
+    int retry;
+
+    for (retry = 0; retry < 2; retry++) {
+        *nquad = 0;
+        for (n = 0; n < nglyph; n++) {
+            CharInfoPtr charinfo = ppci[n];
+
+            if (!GLYPHWIDTHPIXELS(charinfo) || !GLYPHHEIGHTPIXELS(charinfo))
+                continue;
+            if (GLYPHWIDTHPIXELS(charinfo) > GLYPH_BLT_ATLAS_DIM ||
+                GLYPHHEIGHTPIXELS(charinfo) > GLYPH_BLT_ATLAS_DIM)
+                return FALSE;
+            if (!glamor_glyph_blt_add(cache, font, charinfo))
+                break;
+            (*nquad)++;
+        }
+        if (n == nglyph)
+            return TRUE;
+        glamor_glyph_blt_cache_reset(cache);
+    }
+    return FALSE;
+}
+
+static Bool
+glamor_poly_glyph_blt_atlas(DrawablePtr drawable, GCPtr gc,
+                            int start_x, int y, unsigned int nglyph,
+                            CharInfoPtr *ppci)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv;
+    struct glamor_glyph_blt_cache *cache;
+    glamor_pixmap_fbo *atlas_fbo;
+    glamor_program *prog;
+    GLshort *v;
+    char *vbo_offset;
+    int nquad;
+    int box_index;
+    int x;
+    unsigned int n;
+
+    pixmap_priv = glamor_get_pixmap_private(pixmap);
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    glamor_make_current(glamor_priv);
+
+    cache = glamor_glyph_blt_cache_get(screen);
+    if (!cache)
+        return FALSE;
+
+    if (!glamor_glyph_blt_fill_cache(cache, gc->font, nglyph, ppci, &nquad))
+        return FALSE;
+
+    if (!nquad)
+        return TRUE;
+
+    prog = glamor_use_program_fill(pixmap, gc,
+                                   &glamor_priv->poly_glyph_blt_atlas_progs,
+                                   &glamor_facet_poly_glyph_blt_atlas);
+    if (!prog)
+        return FALSE;
+
+    v = glamor_get_vbo_space(screen, nquad * 4 * 4 * sizeof (GLshort),
+                             &vbo_offset);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_SHORT, GL_FALSE,
+                          4 * sizeof (GLshort), vbo_offset);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 2, GL_SHORT, GL_FALSE,
+                          4 * sizeof (GLshort),
+                          vbo_offset + 2 * sizeof (GLshort));
+
+    x = start_x + drawable->x;
+    y += drawable->y;
+    for (n = 0; n < nglyph; n++) {
+        CharInfoPtr charinfo = ppci[n];
+        int w = GLYPHWIDTHPIXELS(charinfo);
+        int h = GLYPHHEIGHTPIXELS(charinfo);
+
+        if (w && h) {
+            struct glamor_glyph_blt_entry *entry =
+                glamor_glyph_blt_lookup(cache, charinfo);
+            int x1 = x + charinfo->metrics.leftSideBearing;
+            int y1 = y - charinfo->metrics.ascent;
+
+            v[0] = x1;      v[1] = y1;      v[2] = entry->x;     v[3] = entry->y;
+            v[4] = x1 + w;  v[5] = y1;      v[6] = entry->x + w; v[7] = entry->y;
+            v[8] = x1 + w;  v[9] = y1 + h;  v[10] = entry->x + w; v[11] = entry->y + h;
+            v[12] = x1;     v[13] = y1 + h; v[14] = entry->x;    v[15] = entry->y + h;
+            v += 16;
+        }
+        x += charinfo->metrics.characterWidth;
+    }
+
+    glamor_put_vbo_space(screen);
+
+    atlas_fbo = glamor_pixmap_fbo_at(glamor_get_pixmap_private(cache->atlas), 0);
+    glamor_bind_texture(glamor_priv, GL_TEXTURE1, atlas_fbo, FALSE);
+    glUniform1i(prog->atlas_uniform, 1);
+
+    glEnable(GL_SCISSOR_TEST);
+
+    glamor_pixmap_loop(pixmap_priv, box_index) {
+        BoxPtr box = RegionRects(gc->pCompositeClip);
+        int nbox = RegionNumRects(gc->pCompositeClip);
+        int off_x, off_y;
+
+        glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
+                                        prog->matrix_uniform, &off_x, &off_y);
+
+        while (nbox--) {
+            glScissor(box->x1 + off_x,
+                      box->y1 + off_y,
+                      box->x2 - box->x1,
+                      box->y2 - box->y1);
+            box++;
+            glamor_glDrawArrays_GL_QUADS(glamor_priv, nquad);
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    return TRUE;
+}
+
+/*
+ * Forget any glyphs of a font that is going away.  Fonts are rarely
+ * unrealized, so the whole cache is simply dropped.
+ */
+void
+glamor_glyph_blt_font_gone(ScreenPtr screen, FontPtr font)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_glyph_blt_cache *cache = glamor_priv->glyph_blt_cache;
+    int i;
+
+    if (!cache || !cache->nentry)
+        return;
+
+    for (i = 0; i < GLYPH_BLT_CACHE_SIZE; i++) {
+        if (cache->entries[i].font == font) {
+            glamor_glyph_blt_cache_reset(cache);
+            return;
+        }
+    }
+}
+
+void
+glamor_glyph_blt_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    struct glamor_glyph_blt_cache *cache = glamor_priv->glyph_blt_cache;
+
+    if (!cache)
+        return;
+
+    if (cache->atlas)
+        glamor_destroy_pixmap(cache->atlas);
+    free(cache->scratch);
+    free(cache);
+    glamor_priv->glyph_blt_cache = NULL;
+}
+
 void
 glamor_poly_glyph_blt(DrawablePtr drawable, GCPtr gc,
                       int start_x, int y, unsigned int nglyph,
                       CharInfoPtr *ppci, void *pglyph_base)
 {
+    if (glamor_poly_glyph_blt_atlas(drawable, gc, start_x, y, nglyph, ppci))
+        return;
     if (glamor_poly_glyph_blt_gl(drawable, gc, start_x, y, nglyph, ppci,
                                  pglyph_base))
         return;
@@ -157,6 +499,182 @@ glamor_poly_glyph_blt(DrawablePtr drawable, GCPtr gc,
                    ppci, pglyph_base);
 }
 
+/*
+ * Image glyphs are always drawn in solid fg/bg with GXcopy.  The
+ * background box and the glyph pixels share one upload; the box is
+ * two triangles at the start of the buffer, followed by one point per
+ * set glyph pixel.
+ */
+static const glamor_facet glamor_facet_image_glyph_blt = {
+    .name = "image_glyph_blt",
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = ("       vec2 pos = vec2(0,0);\n"
+                GLAMOR_POS(gl_Position, primitive)),
+};
+
+static Bool
+use_image_glyph_blt_solid(PixmapPtr pixmap, GCPtr gc,
+                          glamor_program *prog, void *arg)
+{
+    return glamor_set_solid(pixmap, gc, FALSE, prog->fg_uniform);
+}
+
+static const glamor_facet glamor_facet_image_glyph_blt_fill = {
+    .name = "solid",
+    .fs_exec = "       gl_FragColor = fg;\n",
+    .locations = glamor_program_location_fg,
+    .use = use_image_glyph_blt_solid,
+};
+
+static Bool
+glamor_image_glyph_blt_gl(DrawablePtr drawable, GCPtr gc,
+                          int start_x, int y, unsigned int nglyph,
+                          CharInfoPtr *ppci, void *pglyph_base)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv;
+    glamor_program *prog = &glamor_priv->image_glyph_blt_prog;
+    GLfloat *v;
+    char *vbo_offset;
+    int x1, x2, y1, y2;
+    int width = 0;
+    int max_points = 0;
+    int num_points = 0;
+    int box_index;
+    int x, n;
+
+    pixmap_priv = glamor_get_pixmap_private(pixmap);
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (prog->failed)
+        return FALSE;
+
+    for (n = 0; n < nglyph; n++) {
+        width += ppci[n]->metrics.characterWidth;
+        max_points += GLYPHWIDTHPIXELS(ppci[n]) * GLYPHHEIGHTPIXELS(ppci[n]);
+    }
+
+    if (width >= 0) {
+        x1 = start_x;
+        x2 = start_x + width;
+    } else {
+        x1 = start_x + width;
+        x2 = start_x;
+    }
+    y1 = y - gc->font->info.fontAscent;
+    y2 = y + gc->font->info.fontDescent;
+
+    glamor_make_current(glamor_priv);
+
+    if (!prog->prog) {
+        if (!glamor_build_program(screen, prog,
+                                  &glamor_facet_image_glyph_blt,
+                                  &glamor_facet_image_glyph_blt_fill,
+                                  NULL, NULL))
+            return FALSE;
+    }
+
+    if (!glamor_use_program(pixmap, gc, prog, NULL))
+        return FALSE;
+
+    v = glamor_get_vbo_space(screen, (6 + max_points) * 2 * sizeof (GLfloat),
+                             &vbo_offset);
+
+    v[0] = x1;  v[1] = y1;
+    v[2] = x2;  v[3] = y1;
+    v[4] = x1;  v[5] = y2;
+    v[6] = x2;  v[7] = y1;
+    v[8] = x1;  v[9] = y2;
+    v[10] = x2; v[11] = y2;
+    v += 12;
+
+    /* Points land on pixel centers */
+    x = start_x;
+    for (n = 0; n < nglyph; n++) {
+        CharInfoPtr charinfo = ppci[n];
+        int w = GLYPHWIDTHPIXELS(charinfo);
+        int h = GLYPHHEIGHTPIXELS(charinfo);
+        uint8_t *glyphbits = FONTGLYPHBITS(pglyph_base, charinfo);
+        int glyph_x = x + charinfo->metrics.leftSideBearing;
+        int glyph_y = y - charinfo->metrics.ascent;
+        int glyph_stride = GLYPHWIDTHBYTESPADDED(charinfo);
+        int xx, yy;
+
+        for (yy = 0; yy < h; yy++) {
+            uint8_t *glyph = glyphbits;
+
+            for (xx = 0; xx < w; glyph += ((xx&7) == 7), xx++) {
+                if (!(*glyph & (1 << (xx & 7))))
+                    continue;
+                *v++ = glyph_x + xx + 0.5f;
+                *v++ = glyph_y + yy + 0.5f;
+                num_points++;
+            }
+            glyphbits += glyph_stride;
+        }
+        x += charinfo->metrics.characterWidth;
+    }
+
+    glamor_put_vbo_space(screen);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_FLOAT, GL_FALSE,
+                          2 * sizeof (GLfloat), vbo_offset);
+
+    glEnable(GL_SCISSOR_TEST);
+
+    glamor_pixmap_loop(pixmap_priv, box_index) {
+        int off_x, off_y;
+        int pass;
+
+        glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
+                                        prog->matrix_uniform, &off_x, &off_y);
+
+        for (pass = 0; pass < 2; pass++) {
+            int nbox = RegionNumRects(gc->pCompositeClip);
+            BoxPtr box = RegionRects(gc->pCompositeClip);
+
+            if (pass == 1 && !num_points)
+                break;
+
+            glamor_set_color(pixmap, pass ? gc->fgPixel : gc->bgPixel,
+                             prog->fg_uniform);
+
+            while (nbox--) {
+                glScissor(box->x1 + off_x,
+                          box->y1 + off_y,
+                          box->x2 - box->x1,
+                          box->y2 - box->y1);
+                box++;
+                if (pass == 0)
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                else
+                    glDrawArrays(GL_POINTS, 6, num_points);
+            }
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    return TRUE;
+}
+
+void
+glamor_image_glyph_blt(DrawablePtr drawable, GCPtr gc,
+                       int start_x, int y, unsigned int nglyph,
+                       CharInfoPtr *ppci, void *pglyph_base)
+{
+    if (glamor_image_glyph_blt_gl(drawable, gc, start_x, y, nglyph, ppci,
+                                  pglyph_base))
+        return;
+    miImageGlyphBlt(drawable, gc, start_x, y, nglyph,
+                    ppci, pglyph_base);
+}
+
 static Bool
 glamor_push_pixels_gl(GCPtr gc, PixmapPtr bitmap,
                       DrawablePtr drawable, int w, int h, int x, int y)
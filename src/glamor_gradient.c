@@ -30,162 +30,50 @@
  * Gradient acceleration implementation
  */
 
-#include "glamor_priv.h"
+#include <math.h>
 
-#define LINEAR_SMALL_STOPS (6 + 2)
-#define LINEAR_LARGE_STOPS (16 + 2)
+#include "glamor_priv.h"
 
-#define RADIAL_SMALL_STOPS (6 + 2)
-#define RADIAL_LARGE_STOPS (16 + 2)
+/*
+ * Gradient stops are baked into a color ramp texture, which the
+ * gradient programs sample with the position along the gradient.
+ * That keeps a single program per gradient type whatever the number
+ * of stops, and the ramps are cached by gradient definition so the
+ * same gradient isn't rebuilt for every request.
+ */
+#define GLAMOR_GRADIENT_RAMP_WIDTH      1024
+#define GLAMOR_GRADIENT_RAMP_CACHE_SIZE 32
 
 #ifdef GLAMOR_GRADIENT_SHADER
 
-static const char *
-_glamor_create_getcolor_fs_source(ScreenPtr screen, int stops_count,
-                                  int use_array)
+static char *
+_glamor_create_getcolor_fs_source(ScreenPtr screen)
 {
     char *gradient_fs = NULL;
 
-#define gradient_fs_getcolor\
-	    GLAMOR_DEFAULT_PRECISION\
-	    "uniform int n_stop;\n"\
-	    "uniform float stops[%d];\n"\
-	    "uniform vec4 stop_colors[%d];\n"\
-	    "vec4 get_color(float stop_len)\n"\
-	    "{\n"\
-	    "    int i = 0;\n"\
-	    "    float new_alpha; \n"\
-	    "    vec4 gradient_color;\n"\
-	    "    float percentage; \n"\
-	    "    for(i = 0; i < n_stop - 1; i++) {\n"\
-	    "        if(stop_len < stops[i])\n"\
-	    "            break; \n"\
-	    "    }\n"\
-	    "    \n"\
-	    "    if(stops[i] - stops[i-1] > 2.0)\n"\
-	    "        percentage = 0.0;\n" /*For comply with pixman, walker->stepper overflow.*/\
-	    "    else if(stops[i] - stops[i-1] < 0.000001)\n"\
-	    "        percentage = 0.0;\n"\
-	    "    else \n"\
-	    "        percentage = (stop_len - stops[i-1])/(stops[i] - stops[i-1]);\n"\
-	    "    new_alpha = percentage * stop_colors[i].a + \n"\
-	    "                       (1.0-percentage) * stop_colors[i-1].a; \n"\
-	    "    gradient_color = vec4((percentage * stop_colors[i].rgb \n"\
-	    "                          + (1.0-percentage) * stop_colors[i-1].rgb)*new_alpha, \n"\
-	    "                          new_alpha);\n"\
-	    "    \n"\
-	    "    return gradient_color;\n"\
-	    "}\n"
-
-    /* Because the array access for shader is very slow, the performance is very low
-       if use array. So use global uniform to replace for it if the number of n_stops is small. */
-    const char *gradient_fs_getcolor_no_array =
+    /* Positions outside of [0, 1] are transparent for RepeatNone
+     * and clamped otherwise, the other repeat modes have already
+     * been applied.
+     */
+    const char *gradient_fs_getcolor =
         GLAMOR_DEFAULT_PRECISION
-        "uniform int n_stop;\n"
-        "uniform float stop0;\n"
-        "uniform float stop1;\n"
-        "uniform float stop2;\n"
-        "uniform float stop3;\n"
-        "uniform float stop4;\n"
-        "uniform float stop5;\n"
-        "uniform float stop6;\n"
-        "uniform float stop7;\n"
-        "uniform vec4 stop_color0;\n"
-        "uniform vec4 stop_color1;\n"
-        "uniform vec4 stop_color2;\n"
-        "uniform vec4 stop_color3;\n"
-        "uniform vec4 stop_color4;\n"
-        "uniform vec4 stop_color5;\n"
-        "uniform vec4 stop_color6;\n"
-        "uniform vec4 stop_color7;\n"
-        "\n"
+        GLAMOR_GRADIENT_FS_RAMP
         "vec4 get_color(float stop_len)\n"
         "{\n"
-        "    float stop_after;\n"
-        "    float stop_before;\n"
-        "    vec4 stop_color_before;\n"
-        "    vec4 stop_color_after;\n"
-        "    float new_alpha; \n"
-        "    vec4 gradient_color;\n"
-        "    float percentage; \n"
-        "    \n"
-        "    if((stop_len < stop0) && (n_stop >= 1)) {\n"
-        "        stop_color_before = stop_color0;\n"
-        "        stop_color_after = stop_color0;\n"
-        "        stop_after = stop0;\n"
-        "        stop_before = stop0;\n"
-        "    } else if((stop_len < stop1) && (n_stop >= 2)) {\n"
-        "        stop_color_before = stop_color0;\n"
-        "        stop_color_after = stop_color1;\n"
-        "        stop_after = stop1;\n"
-        "        stop_before = stop0;\n"
-        "    } else if((stop_len < stop2) && (n_stop >= 3)) {\n"
-        "        stop_color_before = stop_color1;\n"
-        "        stop_color_after = stop_color2;\n"
-        "        stop_after = stop2;\n"
-        "        stop_before = stop1;\n"
-        "    } else if((stop_len < stop3) && (n_stop >= 4)){\n"
-        "        stop_color_before = stop_color2;\n"
-        "        stop_color_after = stop_color3;\n"
-        "        stop_after = stop3;\n"
-        "        stop_before = stop2;\n"
-        "    } else if((stop_len < stop4) && (n_stop >= 5)){\n"
-        "        stop_color_before = stop_color3;\n"
-        "        stop_color_after = stop_color4;\n"
-        "        stop_after = stop4;\n"
-        "        stop_before = stop3;\n"
-        "    } else if((stop_len < stop5) && (n_stop >= 6)){\n"
-        "        stop_color_before = stop_color4;\n"
-        "        stop_color_after = stop_color5;\n"
-        "        stop_after = stop5;\n"
-        "        stop_before = stop4;\n"
-        "    } else if((stop_len < stop6) && (n_stop >= 7)){\n"
-        "        stop_color_before = stop_color5;\n"
-        "        stop_color_after = stop_color6;\n"
-        "        stop_after = stop6;\n"
-        "        stop_before = stop5;\n"
-        "    } else if((stop_len < stop7) && (n_stop >= 8)){\n"
-        "        stop_color_before = stop_color6;\n"
-        "        stop_color_after = stop_color7;\n"
-        "        stop_after = stop7;\n"
-        "        stop_before = stop6;\n"
-        "    } else {\n"
-        "        stop_color_before = stop_color7;\n"
-        "        stop_color_after = stop_color7;\n"
-        "        stop_after = stop7;\n"
-        "        stop_before = stop7;\n"
-        "    }\n"
-        "    if(stop_after - stop_before > 2.0)\n"
-        "        percentage = 0.0;\n" //For comply with pixman, walker->stepper overflow.
-        "    else if(stop_after - stop_before < 0.000001)\n"
-        "        percentage = 0.0;\n"
-        "    else \n"
-        "        percentage = (stop_len - stop_before)/(stop_after - stop_before);\n"
-        "    new_alpha = percentage * stop_color_after.a + \n"
-        "                       (1.0-percentage) * stop_color_before.a; \n"
-        "    gradient_color = vec4((percentage * stop_color_after.rgb \n"
-        "                          + (1.0-percentage) * stop_color_before.rgb)*new_alpha, \n"
-        "                          new_alpha);\n"
-        "    \n"
-        "    return gradient_color;\n"
+        "    if(repeat_type == %d &&\n"
+        "       (stop_len < 0.0 || stop_len > 1.0))\n"
+        "        return vec4(0.0, 0.0, 0.0, 0.0);\n"
+        "    return gradient_ramp_color(stop_len);\n"
         "}\n";
 
-    if (use_array) {
-        XNFasprintf(&gradient_fs,
-                    gradient_fs_getcolor, stops_count, stops_count);
-        return gradient_fs;
-    }
-    else {
-        return XNFstrdup(gradient_fs_getcolor_no_array);
-    }
+    XNFasprintf(&gradient_fs, gradient_fs_getcolor, PIXMAN_REPEAT_NONE);
+    return gradient_fs;
 }
 
 static void
-_glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
-                                       int dyn_gen)
+_glamor_create_radial_gradient_program(ScreenPtr screen)
 {
     glamor_screen_private *glamor_priv;
-    int index;
 
     GLint gradient_prog = 0;
     char *gradient_fs = NULL;
@@ -313,29 +201,13 @@ _glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
 	    "}\n"\
 	    "\n"\
             "%s\n" /* fs_getcolor_source */
-    const char *fs_getcolor_source;
+    char *fs_getcolor_source;
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    if ((glamor_priv->radial_max_nstops >= stops_count) && (dyn_gen)) {
-        /* Very Good, not to generate again. */
-        return;
-    }
-
     glamor_make_current(glamor_priv);
 
-    if (dyn_gen && glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2]) {
-        glDeleteProgram(glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2]);
-        glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2] = 0;
-    }
-
-    gradient_prog = glCreateProgram();
-
-    vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, gradient_vs);
-
-    fs_getcolor_source =
-        _glamor_create_getcolor_fs_source(screen, stops_count,
-                                          (stops_count > 0));
+    fs_getcolor_source = _glamor_create_getcolor_fs_source(screen);
 
     XNFasprintf(&gradient_fs,
                 gradient_radial_fs_template,
@@ -343,41 +215,37 @@ _glamor_create_radial_gradient_program(ScreenPtr screen, int stops_count,
                 PIXMAN_REPEAT_REFLECT,
                 fs_getcolor_source);
 
-    fs_prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, gradient_fs);
+    gradient_prog = glamor_program_cache_load(screen, gradient_vs, gradient_fs);
+    if (!gradient_prog) {
+        gradient_prog = glCreateProgram();
 
-    free(gradient_fs);
-
-    glAttachShader(gradient_prog, vs_prog);
-    glAttachShader(gradient_prog, fs_prog);
-    glDeleteShader(vs_prog);
-    glDeleteShader(fs_prog);
+        vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, gradient_vs);
+        fs_prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, gradient_fs);
 
-    glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_POS, "v_position");
-    glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_SOURCE, "v_texcoord");
+        glAttachShader(gradient_prog, vs_prog);
+        glAttachShader(gradient_prog, fs_prog);
+        glDeleteShader(vs_prog);
+        glDeleteShader(fs_prog);
 
-    glamor_link_glsl_prog(screen, gradient_prog, "radial gradient");
+        glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_POS, "v_position");
+        glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_SOURCE, "v_texcoord");
 
-    if (dyn_gen) {
-        index = 2;
-        glamor_priv->radial_max_nstops = stops_count;
-    }
-    else if (stops_count) {
-        index = 1;
-    }
-    else {
-        index = 0;
+        glamor_link_glsl_prog(screen, gradient_prog, "radial gradient");
+        glamor_program_cache_store(screen, gradient_prog,
+                                   gradient_vs, gradient_fs);
     }
 
-    glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][index] = gradient_prog;
+    free(gradient_fs);
+    free(fs_getcolor_source);
+
+    glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL] = gradient_prog;
 }
 
 static void
-_glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count,
-                                       int dyn_gen)
+_glamor_create_linear_gradient_program(ScreenPtr screen)
 {
     glamor_screen_private *glamor_priv;
 
-    int index = 0;
     GLint gradient_prog = 0;
     char *gradient_fs = NULL;
     GLint fs_prog, vs_prog;
@@ -506,80 +374,57 @@ _glamor_create_linear_gradient_program(ScreenPtr screen, int stops_count,
 	    "}\n"\
 	    "\n"\
             "%s" /* fs_getcolor_source */
-    const char *fs_getcolor_source;
+    char *fs_getcolor_source;
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    if ((glamor_priv->linear_max_nstops >= stops_count) && (dyn_gen)) {
-        /* Very Good, not to generate again. */
-        return;
-    }
-
     glamor_make_current(glamor_priv);
-    if (dyn_gen && glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2]) {
-        glDeleteProgram(glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2]);
-        glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2] = 0;
-    }
-
-    gradient_prog = glCreateProgram();
-
-    vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, gradient_vs);
 
-    fs_getcolor_source =
-        _glamor_create_getcolor_fs_source(screen, stops_count, stops_count > 0);
+    fs_getcolor_source = _glamor_create_getcolor_fs_source(screen);
 
     XNFasprintf(&gradient_fs,
                 gradient_fs_template,
                 PIXMAN_REPEAT_NORMAL, PIXMAN_REPEAT_REFLECT,
                 fs_getcolor_source);
 
-    fs_prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, gradient_fs);
-    free(gradient_fs);
+    gradient_prog = glamor_program_cache_load(screen, gradient_vs, gradient_fs);
+    if (!gradient_prog) {
+        gradient_prog = glCreateProgram();
 
-    glAttachShader(gradient_prog, vs_prog);
-    glAttachShader(gradient_prog, fs_prog);
-    glDeleteShader(vs_prog);
-    glDeleteShader(fs_prog);
+        vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, gradient_vs);
+        fs_prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, gradient_fs);
 
-    glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_POS, "v_position");
-    glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_SOURCE, "v_texcoord");
+        glAttachShader(gradient_prog, vs_prog);
+        glAttachShader(gradient_prog, fs_prog);
+        glDeleteShader(vs_prog);
+        glDeleteShader(fs_prog);
 
-    glamor_link_glsl_prog(screen, gradient_prog, "linear gradient");
+        glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_POS, "v_position");
+        glBindAttribLocation(gradient_prog, GLAMOR_VERTEX_SOURCE, "v_texcoord");
 
-    if (dyn_gen) {
-        index = 2;
-        glamor_priv->linear_max_nstops = stops_count;
-    }
-    else if (stops_count) {
-        index = 1;
-    }
-    else {
-        index = 0;
+        glamor_link_glsl_prog(screen, gradient_prog, "linear gradient");
+        glamor_program_cache_store(screen, gradient_prog,
+                                   gradient_vs, gradient_fs);
     }
 
-    glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][index] = gradient_prog;
+    free(gradient_fs);
+    free(fs_getcolor_source);
+
+    glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR] = gradient_prog;
 }
 
 void
 glamor_init_gradient_shader(ScreenPtr screen)
 {
     glamor_screen_private *glamor_priv;
-    int i;
 
     glamor_priv = glamor_get_screen_private(screen);
 
-    for (i = 0; i < 3; i++) {
-        glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][i] = 0;
-        glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][i] = 0;
-    }
-    glamor_priv->linear_max_nstops = 0;
-    glamor_priv->radial_max_nstops = 0;
-
-    _glamor_create_linear_gradient_program(screen, 0, 0);
-    _glamor_create_linear_gradient_program(screen, LINEAR_LARGE_STOPS, 0);
+    xorg_list_init(&glamor_priv->gradient_ramps);
+    glamor_priv->gradient_ramp_count = 0;
 
-    _glamor_create_radial_gradient_program(screen, 0, 0);
-    _glamor_create_radial_gradient_program(screen, RADIAL_LARGE_STOPS, 0);
+    _glamor_create_linear_gradient_program(screen);
+    _glamor_create_radial_gradient_program(screen);
 }
 
 static void
@@ -803,6 +648,355 @@ _glamor_gradient_set_stops(PicturePtr src_picture, PictGradient *pgradient,
     return count;
 }
 
+typedef struct glamor_gradient_ramp {
+    struct xorg_list    link;   /* screen gradient_ramps, most recent first */
+    uint32_t            hash;
+    int                 repeat;
+    int                 nstops;
+    PictGradientStop    *stops;
+    GLuint              texture;
+} glamor_gradient_ramp;
+
+static uint32_t
+_glamor_gradient_hash(int repeat, int nstops, const PictGradientStop *stops)
+{
+    const uint8_t *p = (const uint8_t *) stops;
+    size_t len = nstops * sizeof (PictGradientStop);
+    uint32_t hash = 2166136261u;
+
+    hash = (hash ^ repeat) * 16777619u;
+    while (len--)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static void
+_glamor_gradient_ramp_destroy(glamor_screen_private *glamor_priv,
+                              glamor_gradient_ramp *ramp)
+{
+    xorg_list_del(&ramp->link);
+    glamor_priv->gradient_ramp_count--;
+    glDeleteTextures(1, &ramp->texture);
+    free(ramp->stops);
+    free(ramp);
+}
+
+/*
+ * Evaluate the stops at t the same way the per-stop shaders used to,
+ * premultiplied.
+ */
+static void
+_glamor_gradient_eval(double t, int count, const GLfloat *stop_colors,
+                      const GLfloat *n_stops, uint8_t *texel)
+{
+    double span, percentage, alpha;
+    const GLfloat *before, *after;
+    int k, c;
+
+    k = 1;
+    while (k < count - 1 && t >= n_stops[k])
+        k++;
+
+    span = n_stops[k] - n_stops[k - 1];
+    /* For comply with pixman, walker->stepper overflow. */
+    if (span > 2.0 || span < 0.000001)
+        percentage = 0.0;
+    else
+        percentage = (t - n_stops[k - 1]) / span;
+
+    before = &stop_colors[(k - 1) * 4];
+    after = &stop_colors[k * 4];
+    alpha = percentage * after[3] + (1.0 - percentage) * before[3];
+    for (c = 0; c < 3; c++)
+        texel[c] = (percentage * after[c] +
+                    (1.0 - percentage) * before[c]) * alpha * 255.0 + 0.5;
+    texel[3] = alpha * 255.0 + 0.5;
+}
+
+/*
+ * Fill the four rows of the ramp described at GLAMOR_GRADIENT_FS_RAMP:
+ * the colors at each texel center, then for the intervals holding a
+ * hard stop the colors on either side of it and its position.  When
+ * several hard stops share an interval, the first one's position and
+ * left color and the last one's right color are kept.
+ */
+static Bool
+_glamor_gradient_fill_ramp(PicturePtr src_picture, uint8_t *bits)
+{
+    PictGradient *gradient = &src_picture->pSourcePict->gradient;
+    int stops_count = gradient->nstops + 2;
+    const int w = GLAMOR_GRADIENT_RAMP_WIDTH;
+    uint8_t *left = bits + w * 4;
+    uint8_t *right = bits + w * 8;
+    uint8_t *edge = bits + w * 12;
+    GLfloat *stop_colors, *n_stops;
+    int count, i, k;
+
+    stop_colors = xallocarray(stops_count, 4 * sizeof(GLfloat));
+    n_stops = xallocarray(stops_count, sizeof(GLfloat));
+    if (!stop_colors || !n_stops) {
+        free(stop_colors);
+        free(n_stops);
+        return FALSE;
+    }
+
+    count = _glamor_gradient_set_stops(src_picture, gradient,
+                                       stop_colors, n_stops);
+
+    for (i = 0; i < w; i++)
+        _glamor_gradient_eval((double) i / (w - 1), count,
+                              stop_colors, n_stops, &bits[i * 4]);
+
+    for (k = 1; k < count - 2; k++) {
+        double s = n_stops[k], u, d;
+
+        if (n_stops[k + 1] - s >= 0.000001 || s < 0.0 || s > 1.0)
+            continue;
+
+        /* A stop on a texel center belongs to the interval before
+         * it, so that interval still ends on the left color.
+         */
+        u = s * (w - 1);
+        i = max((int) ceil(u) - 1, 0);
+        d = min(u - i, 254.0 / 255.0);
+
+        if (!edge[i * 4 + 1]) {
+            _glamor_gradient_eval(s - 0.000001, count,
+                                  stop_colors, n_stops, &left[i * 4]);
+            edge[i * 4] = d * 255.0 + 0.5;
+            edge[i * 4 + 1] = 0xff;
+        }
+        _glamor_gradient_eval(s, count, stop_colors, n_stops, &right[i * 4]);
+    }
+
+    free(stop_colors);
+    free(n_stops);
+    return TRUE;
+}
+
+/*
+ * Find or build the color ramp texture for a gradient picture.
+ */
+GLuint
+glamor_gradient_get_ramp(ScreenPtr screen, PicturePtr src_picture)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PictGradient *gradient = &src_picture->pSourcePict->gradient;
+    int repeat = src_picture->repeatType;
+    size_t stops_size = gradient->nstops * sizeof (PictGradientStop);
+    glamor_gradient_ramp *ramp;
+    uint32_t hash;
+    uint8_t *bits;
+
+    hash = _glamor_gradient_hash(repeat, gradient->nstops, gradient->stops);
+
+    xorg_list_for_each_entry(ramp, &glamor_priv->gradient_ramps, link) {
+        if (ramp->hash == hash && ramp->repeat == repeat &&
+            ramp->nstops == gradient->nstops &&
+            memcmp(ramp->stops, gradient->stops, stops_size) == 0) {
+            xorg_list_del(&ramp->link);
+            xorg_list_add(&ramp->link, &glamor_priv->gradient_ramps);
+            return ramp->texture;
+        }
+    }
+
+    ramp = calloc(1, sizeof (glamor_gradient_ramp));
+    bits = calloc(GLAMOR_GRADIENT_RAMP_WIDTH * 4, 4);
+    if (ramp)
+        ramp->stops = malloc(stops_size ? stops_size : 1);
+    if (!ramp || !ramp->stops || !bits ||
+        !_glamor_gradient_fill_ramp(src_picture, bits)) {
+        if (ramp)
+            free(ramp->stops);
+        free(ramp);
+        free(bits);
+        return 0;
+    }
+
+    ramp->hash = hash;
+    ramp->repeat = repeat;
+    ramp->nstops = gradient->nstops;
+    memcpy(ramp->stops, gradient->stops, stops_size);
+
+    glamor_make_current(glamor_priv);
+    glGenTextures(1, &ramp->texture);
+    glBindTexture(GL_TEXTURE_2D, ramp->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GLAMOR_GRADIENT_RAMP_WIDTH, 4, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, bits);
+    free(bits);
+
+    xorg_list_add(&ramp->link, &glamor_priv->gradient_ramps);
+    if (++glamor_priv->gradient_ramp_count > GLAMOR_GRADIENT_RAMP_CACHE_SIZE)
+        _glamor_gradient_ramp_destroy(glamor_priv,
+                                      xorg_list_last_entry(&glamor_priv->gradient_ramps,
+                                                           glamor_gradient_ramp,
+                                                           link));
+    return ramp->texture;
+}
+
+/*
+ * Look up the uniforms of GLAMOR_GRADIENT_FS_LINEAR or
+ * GLAMOR_GRADIENT_FS_RADIAL, once the program is linked.
+ */
+void
+glamor_gradient_get_uniforms(GLuint prog, glamor_gradient_uniforms *uniforms)
+{
+    uniforms->ramp = glGetUniformLocation(prog, "gradient_ramp");
+    uniforms->ramp_width = glGetUniformLocation(prog, "gradient_ramp_width");
+    uniforms->transform = glGetUniformLocation(prog, "gradient_transform");
+    uniforms->repeat = glGetUniformLocation(prog, "gradient_repeat");
+    uniforms->p0 = glGetUniformLocation(prog, "gradient_p0");
+    uniforms->p1 = glGetUniformLocation(prog, "gradient_p1");
+}
+
+/*
+ * Load the gradient uniforms in the current program, and bind the
+ * ramp to texture unit 0.  Positions handed to gradient_color() are
+ * in source picture space, the picture transform is applied in the
+ * shader.
+ */
+Bool
+glamor_gradient_use(ScreenPtr screen, PicturePtr picture,
+                    const glamor_gradient_uniforms *uniforms)
+{
+    SourcePictPtr sp = picture->pSourcePict;
+    GLfloat p0[4] = { 0 }, p1[4] = { 0 };
+    GLfloat transform[9];
+    GLuint ramp;
+    int i, j;
+
+    ramp = glamor_gradient_get_ramp(screen, picture);
+    if (!ramp)
+        return FALSE;
+
+    if (sp->type == SourcePictTypeLinear) {
+        double x1 = pixman_fixed_to_double(sp->linear.p1.x);
+        double y1 = pixman_fixed_to_double(sp->linear.p1.y);
+        double dx = pixman_fixed_to_double(sp->linear.p2.x) - x1;
+        double dy = pixman_fixed_to_double(sp->linear.p2.y) - y1;
+        double l = dx * dx + dy * dy;
+
+        /* t = (p - p1) . (p2 - p1) / |p2 - p1|^2, and 0 everywhere
+         * for a degenerate gradient, as pixman does.
+         */
+        if (l != 0) {
+            p0[0] = dx / l;
+            p0[1] = dy / l;
+            p0[2] = -(x1 * dx + y1 * dy) / l;
+        }
+    } else {
+        double c1x = pixman_fixed_to_double(sp->radial.c1.x);
+        double c1y = pixman_fixed_to_double(sp->radial.c1.y);
+        double r1 = pixman_fixed_to_double(sp->radial.c1.radius);
+        double cdx = pixman_fixed_to_double(sp->radial.c2.x) - c1x;
+        double cdy = pixman_fixed_to_double(sp->radial.c2.y) - c1y;
+        double dr = pixman_fixed_to_double(sp->radial.c2.radius) - r1;
+
+        p0[0] = c1x;
+        p0[1] = c1y;
+        p0[2] = r1;
+        p0[3] = dr;
+        p1[0] = cdx;
+        p1[1] = cdy;
+        p1[2] = cdx * cdx + cdy * cdy - dr * dr;
+    }
+
+    /* GL wants the matrix column major */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            if (picture->transform)
+                transform[j * 3 + i] =
+                    pixman_fixed_to_double(picture->transform->matrix[i][j]);
+            else
+                transform[j * 3 + i] = i == j;
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ramp);
+    glUniform1i(uniforms->ramp, 0);
+    glUniform1f(uniforms->ramp_width, GLAMOR_GRADIENT_RAMP_WIDTH);
+    glUniformMatrix3fv(uniforms->transform, 1, GL_FALSE, transform);
+    glUniform1i(uniforms->repeat, picture->repeatType);
+    glUniform4fv(uniforms->p0, 1, p0);
+    glUniform4fv(uniforms->p1, 1, p1);
+
+    return TRUE;
+}
+
+void
+glamor_fini_gradient_shader(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_gradient_ramp *ramp, *tmp;
+
+    glamor_make_current(glamor_priv);
+    xorg_list_for_each_entry_safe(ramp, tmp, &glamor_priv->gradient_ramps,
+                                  link)
+        _glamor_gradient_ramp_destroy(glamor_priv, ramp);
+}
+
+/*
+ * Create the picture a gradient is rendered into, and bind its ramp.
+ */
+static PicturePtr
+_glamor_gradient_prepare(ScreenPtr screen, PicturePtr src_picture,
+                         int width, int height, PictFormatShort format,
+                         GLint gradient_prog)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PicturePtr dst_picture;
+    PixmapPtr pixmap;
+    GLuint ramp;
+    int error;
+
+    if (!gradient_prog)
+        return NULL;
+
+    ramp = glamor_gradient_get_ramp(screen, src_picture);
+    if (!ramp)
+        return NULL;
+
+    /* Create a pixmap with VBO. */
+    pixmap = glamor_create_pixmap(screen,
+                                  width, height,
+                                  PIXMAN_FORMAT_DEPTH(format), 0);
+    if (!pixmap)
+        return NULL;
+
+    dst_picture = CreatePicture(0, &pixmap->drawable,
+                                PictureMatchFormat(screen,
+                                                   PIXMAN_FORMAT_DEPTH(format),
+                                                   format), 0, 0, serverClient,
+                                &error);
+
+    /* Release the reference, picture will hold the last one. */
+    glamor_destroy_pixmap(pixmap);
+
+    if (!dst_picture)
+        return NULL;
+
+    ValidatePicture(dst_picture);
+
+    glamor_make_current(glamor_priv);
+    glUseProgram(gradient_prog);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, ramp);
+    glUniform1i(glGetUniformLocation(gradient_prog, "gradient_ramp"), 0);
+    glUniform1f(glGetUniformLocation(gradient_prog, "gradient_ramp_width"),
+                GLAMOR_GRADIENT_RAMP_WIDTH);
+    glUniform1i(glGetUniformLocation(gradient_prog, "repeat_type"),
+                src_picture->repeatType);
+
+    return dst_picture;
+}
+
 PicturePtr
 glamor_generate_radial_gradient_picture(ScreenPtr screen,
                                         PicturePtr src_picture,
@@ -812,46 +1006,18 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
 {
     glamor_screen_private *glamor_priv;
     PicturePtr dst_picture = NULL;
-    PixmapPtr pixmap = NULL;
     GLint gradient_prog = 0;
-    int error;
-    int stops_count = 0;
-    int count = 0;
-    GLfloat *stop_colors = NULL;
-    GLfloat *n_stops = NULL;
     GLfloat xscale, yscale;
     float transform_mat[3][3];
     static const float identity_mat[3][3] = { {1.0, 0.0, 0.0},
     {0.0, 1.0, 0.0},
     {0.0, 0.0, 1.0}
     };
-    GLfloat stop_colors_st[RADIAL_SMALL_STOPS * 4];
-    GLfloat n_stops_st[RADIAL_SMALL_STOPS];
     GLfloat A_value;
     GLfloat cxy[4];
     float c1x, c1y, c2x, c2y, r1, r2;
 
     GLint transform_mat_uniform_location = 0;
-    GLint repeat_type_uniform_location = 0;
-    GLint n_stop_uniform_location = 0;
-    GLint stops_uniform_location = 0;
-    GLint stop_colors_uniform_location = 0;
-    GLint stop0_uniform_location = 0;
-    GLint stop1_uniform_location = 0;
-    GLint stop2_uniform_location = 0;
-    GLint stop3_uniform_location = 0;
-    GLint stop4_uniform_location = 0;
-    GLint stop5_uniform_location = 0;
-    GLint stop6_uniform_location = 0;
-    GLint stop7_uniform_location = 0;
-    GLint stop_color0_uniform_location = 0;
-    GLint stop_color1_uniform_location = 0;
-    GLint stop_color2_uniform_location = 0;
-    GLint stop_color3_uniform_location = 0;
-    GLint stop_color4_uniform_location = 0;
-    GLint stop_color5_uniform_location = 0;
-    GLint stop_color6_uniform_location = 0;
-    GLint stop_color7_uniform_location = 0;
     GLint A_value_uniform_location = 0;
     GLint c1_uniform_location = 0;
     GLint r1_uniform_location = 0;
@@ -859,104 +1025,23 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
     GLint r2_uniform_location = 0;
 
     glamor_priv = glamor_get_screen_private(screen);
-    glamor_make_current(glamor_priv);
-
-    /* Create a pixmap with VBO. */
-    pixmap = glamor_create_pixmap(screen,
-                                  width, height,
-                                  PIXMAN_FORMAT_DEPTH(format), 0);
-    if (!pixmap)
-        goto GRADIENT_FAIL;
-
-    dst_picture = CreatePicture(0, &pixmap->drawable,
-                                PictureMatchFormat(screen,
-                                                   PIXMAN_FORMAT_DEPTH(format),
-                                                   format), 0, 0, serverClient,
-                                &error);
-
-    /* Release the reference, picture will hold the last one. */
-    glamor_destroy_pixmap(pixmap);
+    gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL];
 
+    dst_picture = _glamor_gradient_prepare(screen, src_picture,
+                                           width, height, format,
+                                           gradient_prog);
     if (!dst_picture)
         goto GRADIENT_FAIL;
 
-    ValidatePicture(dst_picture);
-
-    stops_count = src_picture->pSourcePict->radial.nstops + 2;
-
-    /* Because the max value of nstops is unknown, so create a program
-       when nstops > LINEAR_LARGE_STOPS. */
-    if (stops_count <= RADIAL_SMALL_STOPS) {
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][0];
-    }
-    else if (stops_count <= RADIAL_LARGE_STOPS) {
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][1];
-    }
-    else {
-        _glamor_create_radial_gradient_program(screen,
-                                               src_picture->pSourcePict->linear.
-                                               nstops + 2, 1);
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_RADIAL][2];
-    }
-
     /* Bind all the uniform vars . */
     transform_mat_uniform_location = glGetUniformLocation(gradient_prog,
                                                           "transform_mat");
-    repeat_type_uniform_location = glGetUniformLocation(gradient_prog,
-                                                        "repeat_type");
-    n_stop_uniform_location = glGetUniformLocation(gradient_prog, "n_stop");
     A_value_uniform_location = glGetUniformLocation(gradient_prog, "A_value");
     c1_uniform_location = glGetUniformLocation(gradient_prog, "c1");
     r1_uniform_location = glGetUniformLocation(gradient_prog, "r1");
     c2_uniform_location = glGetUniformLocation(gradient_prog, "c2");
     r2_uniform_location = glGetUniformLocation(gradient_prog, "r2");
 
-    if (src_picture->pSourcePict->radial.nstops + 2 <= RADIAL_SMALL_STOPS) {
-        stop0_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop0");
-        stop1_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop1");
-        stop2_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop2");
-        stop3_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop3");
-        stop4_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop4");
-        stop5_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop5");
-        stop6_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop6");
-        stop7_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop7");
-
-        stop_color0_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color0");
-        stop_color1_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color1");
-        stop_color2_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color2");
-        stop_color3_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color3");
-        stop_color4_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color4");
-        stop_color5_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color5");
-        stop_color6_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color6");
-        stop_color7_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color7");
-    }
-    else {
-        stops_uniform_location =
-            glGetUniformLocation(gradient_prog, "stops");
-        stop_colors_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_colors");
-    }
-
-    glUseProgram(gradient_prog);
-
-    glUniform1i(repeat_type_uniform_location, src_picture->repeatType);
-
     if (src_picture->transform) {
         _glamor_gradient_convert_trans_matrix(src_picture->transform,
                                               transform_mat, width, height, 0);
@@ -975,82 +1060,6 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
 
     glamor_set_alu(screen, GXcopy);
 
-    /* Set all the stops and colors to shader. */
-    if (stops_count > RADIAL_SMALL_STOPS) {
-        stop_colors = xallocarray(stops_count, 4 * sizeof(float));
-        if (stop_colors == NULL) {
-            ErrorF("Failed to allocate stop_colors memory.\n");
-            goto GRADIENT_FAIL;
-        }
-
-        n_stops = xallocarray(stops_count, sizeof(float));
-        if (n_stops == NULL) {
-            ErrorF("Failed to allocate n_stops memory.\n");
-            goto GRADIENT_FAIL;
-        }
-    }
-    else {
-        stop_colors = stop_colors_st;
-        n_stops = n_stops_st;
-    }
-
-    count =
-        _glamor_gradient_set_stops(src_picture,
-                                   &src_picture->pSourcePict->gradient,
-                                   stop_colors, n_stops);
-
-    if (src_picture->pSourcePict->linear.nstops + 2 <= RADIAL_SMALL_STOPS) {
-        int j = 0;
-
-        glUniform4f(stop_color0_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color1_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color2_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color3_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color4_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color5_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color6_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color7_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-
-        j = 0;
-        glUniform1f(stop0_uniform_location, n_stops[j++]);
-        glUniform1f(stop1_uniform_location, n_stops[j++]);
-        glUniform1f(stop2_uniform_location, n_stops[j++]);
-        glUniform1f(stop3_uniform_location, n_stops[j++]);
-        glUniform1f(stop4_uniform_location, n_stops[j++]);
-        glUniform1f(stop5_uniform_location, n_stops[j++]);
-        glUniform1f(stop6_uniform_location, n_stops[j++]);
-        glUniform1f(stop7_uniform_location, n_stops[j++]);
-        glUniform1i(n_stop_uniform_location, count);
-    }
-    else {
-        glUniform4fv(stop_colors_uniform_location, count, stop_colors);
-        glUniform1fv(stops_uniform_location, count, n_stops);
-        glUniform1i(n_stop_uniform_location, count);
-    }
-
     c1x = (float) pixman_fixed_to_double(src_picture->pSourcePict->radial.c1.x);
     c1y = (float) pixman_fixed_to_double(src_picture->pSourcePict->radial.c1.y);
     c2x = (float) pixman_fixed_to_double(src_picture->pSourcePict->radial.c2.x);
@@ -1081,12 +1090,6 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
     /* Now rendering. */
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-    /* Do the clear logic. */
-    if (stops_count > RADIAL_SMALL_STOPS) {
-        free(n_stops);
-        free(stop_colors);
-    }
-
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
     glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
 
@@ -1097,13 +1100,6 @@ glamor_generate_radial_gradient_picture(ScreenPtr screen,
         FreePicture(dst_picture, 0);
     }
 
-    if (stops_count > RADIAL_SMALL_STOPS) {
-        if (n_stops)
-            free(n_stops);
-        if (stop_colors)
-            free(stop_colors);
-    }
-
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
     glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
     return NULL;
@@ -1118,16 +1114,10 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
 {
     glamor_screen_private *glamor_priv;
     PicturePtr dst_picture = NULL;
-    PixmapPtr pixmap = NULL;
     GLint gradient_prog = 0;
-    int error;
     float pt_distance;
     float p1_distance;
     GLfloat cos_val;
-    int stops_count = 0;
-    GLfloat *stop_colors = NULL;
-    GLfloat *n_stops = NULL;
-    int count = 0;
     float slope;
     GLfloat xscale, yscale;
     GLfloat pt1[2], pt2[2];
@@ -1136,85 +1126,26 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
     {0.0, 1.0, 0.0},
     {0.0, 0.0, 1.0}
     };
-    GLfloat stop_colors_st[LINEAR_SMALL_STOPS * 4];
-    GLfloat n_stops_st[LINEAR_SMALL_STOPS];
 
     GLint transform_mat_uniform_location = 0;
-    GLint n_stop_uniform_location = 0;
-    GLint stops_uniform_location = 0;
-    GLint stop0_uniform_location = 0;
-    GLint stop1_uniform_location = 0;
-    GLint stop2_uniform_location = 0;
-    GLint stop3_uniform_location = 0;
-    GLint stop4_uniform_location = 0;
-    GLint stop5_uniform_location = 0;
-    GLint stop6_uniform_location = 0;
-    GLint stop7_uniform_location = 0;
-    GLint stop_colors_uniform_location = 0;
-    GLint stop_color0_uniform_location = 0;
-    GLint stop_color1_uniform_location = 0;
-    GLint stop_color2_uniform_location = 0;
-    GLint stop_color3_uniform_location = 0;
-    GLint stop_color4_uniform_location = 0;
-    GLint stop_color5_uniform_location = 0;
-    GLint stop_color6_uniform_location = 0;
-    GLint stop_color7_uniform_location = 0;
     GLint pt_slope_uniform_location = 0;
-    GLint repeat_type_uniform_location = 0;
     GLint hor_ver_uniform_location = 0;
     GLint cos_val_uniform_location = 0;
     GLint p1_distance_uniform_location = 0;
     GLint pt_distance_uniform_location = 0;
 
     glamor_priv = glamor_get_screen_private(screen);
-    glamor_make_current(glamor_priv);
-
-    /* Create a pixmap with VBO. */
-    pixmap = glamor_create_pixmap(screen,
-                                  width, height,
-                                  PIXMAN_FORMAT_DEPTH(format), 0);
-
-    if (!pixmap)
-        goto GRADIENT_FAIL;
-
-    dst_picture = CreatePicture(0, &pixmap->drawable,
-                                PictureMatchFormat(screen,
-                                                   PIXMAN_FORMAT_DEPTH(format),
-                                                   format), 0, 0, serverClient,
-                                &error);
-
-    /* Release the reference, picture will hold the last one. */
-    glamor_destroy_pixmap(pixmap);
+    gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR];
 
+    dst_picture = _glamor_gradient_prepare(screen, src_picture,
+                                           width, height, format,
+                                           gradient_prog);
     if (!dst_picture)
         goto GRADIENT_FAIL;
 
-    ValidatePicture(dst_picture);
-
-    stops_count = src_picture->pSourcePict->linear.nstops + 2;
-
-    /* Because the max value of nstops is unknown, so create a program
-       when nstops > LINEAR_LARGE_STOPS. */
-    if (stops_count <= LINEAR_SMALL_STOPS) {
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][0];
-    }
-    else if (stops_count <= LINEAR_LARGE_STOPS) {
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][1];
-    }
-    else {
-        _glamor_create_linear_gradient_program(screen,
-                                               src_picture->pSourcePict->linear.
-                                               nstops + 2, 1);
-        gradient_prog = glamor_priv->gradient_prog[SHADER_GRADIENT_LINEAR][2];
-    }
-
     /* Bind all the uniform vars . */
-    n_stop_uniform_location =
-        glGetUniformLocation(gradient_prog, "n_stop");
     pt_slope_uniform_location =
         glGetUniformLocation(gradient_prog, "pt_slope");
-    repeat_type_uniform_location =
-        glGetUniformLocation(gradient_prog, "repeat_type");
     hor_ver_uniform_location =
         glGetUniformLocation(gradient_prog, "hor_ver");
     transform_mat_uniform_location =
@@ -1226,52 +1157,6 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
     pt_distance_uniform_location =
         glGetUniformLocation(gradient_prog, "pt_distance");
 
-    if (src_picture->pSourcePict->linear.nstops + 2 <= LINEAR_SMALL_STOPS) {
-        stop0_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop0");
-        stop1_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop1");
-        stop2_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop2");
-        stop3_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop3");
-        stop4_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop4");
-        stop5_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop5");
-        stop6_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop6");
-        stop7_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop7");
-
-        stop_color0_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color0");
-        stop_color1_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color1");
-        stop_color2_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color2");
-        stop_color3_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color3");
-        stop_color4_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color4");
-        stop_color5_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color5");
-        stop_color6_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color6");
-        stop_color7_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_color7");
-    }
-    else {
-        stops_uniform_location =
-            glGetUniformLocation(gradient_prog, "stops");
-        stop_colors_uniform_location =
-            glGetUniformLocation(gradient_prog, "stop_colors");
-    }
-
-    glUseProgram(gradient_prog);
-
-    glUniform1i(repeat_type_uniform_location, src_picture->repeatType);
-
     /* set the transform matrix. */
     if (src_picture->transform) {
         _glamor_gradient_convert_trans_matrix(src_picture->transform,
@@ -1314,83 +1199,6 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
            pixman_fixed_to_double(src_picture->pSourcePict->linear.p2.y),
            pt2[0], pt2[1]);
 
-    /* Set all the stops and colors to shader. */
-    if (stops_count > LINEAR_SMALL_STOPS) {
-        stop_colors = xallocarray(stops_count, 4 * sizeof(float));
-        if (stop_colors == NULL) {
-            ErrorF("Failed to allocate stop_colors memory.\n");
-            goto GRADIENT_FAIL;
-        }
-
-        n_stops = xallocarray(stops_count, sizeof(float));
-        if (n_stops == NULL) {
-            ErrorF("Failed to allocate n_stops memory.\n");
-            goto GRADIENT_FAIL;
-        }
-    }
-    else {
-        stop_colors = stop_colors_st;
-        n_stops = n_stops_st;
-    }
-
-    count =
-        _glamor_gradient_set_stops(src_picture,
-                                   &src_picture->pSourcePict->gradient,
-                                   stop_colors, n_stops);
-
-    if (src_picture->pSourcePict->linear.nstops + 2 <= LINEAR_SMALL_STOPS) {
-        int j = 0;
-
-        glUniform4f(stop_color0_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color1_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color2_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color3_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color4_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color5_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color6_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-        j++;
-        glUniform4f(stop_color7_uniform_location,
-                    stop_colors[4 * j + 0], stop_colors[4 * j + 1],
-                    stop_colors[4 * j + 2], stop_colors[4 * j + 3]);
-
-        j = 0;
-        glUniform1f(stop0_uniform_location, n_stops[j++]);
-        glUniform1f(stop1_uniform_location, n_stops[j++]);
-        glUniform1f(stop2_uniform_location, n_stops[j++]);
-        glUniform1f(stop3_uniform_location, n_stops[j++]);
-        glUniform1f(stop4_uniform_location, n_stops[j++]);
-        glUniform1f(stop5_uniform_location, n_stops[j++]);
-        glUniform1f(stop6_uniform_location, n_stops[j++]);
-        glUniform1f(stop7_uniform_location, n_stops[j++]);
-
-        glUniform1i(n_stop_uniform_location, count);
-    }
-    else {
-        glUniform4fv(stop_colors_uniform_location, count, stop_colors);
-        glUniform1fv(stops_uniform_location, count, n_stops);
-        glUniform1i(n_stop_uniform_location, count);
-    }
-
     if (src_picture->pSourcePict->linear.p2.y == src_picture->pSourcePict->linear.p1.y) {       // The horizontal case.
         glUniform1i(hor_ver_uniform_location, 1);
         DEBUGF("p1.y: %f, p2.y: %f, enter the horizontal case\n",
@@ -1424,12 +1232,6 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
     /* Now rendering. */
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-    /* Do the clear logic. */
-    if (stops_count > LINEAR_SMALL_STOPS) {
-        free(n_stops);
-        free(stop_colors);
-    }
-
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
     glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
 
@@ -1440,13 +1242,6 @@ glamor_generate_linear_gradient_picture(ScreenPtr screen,
         FreePicture(dst_picture, 0);
     }
 
-    if (stops_count > LINEAR_SMALL_STOPS) {
-        if (n_stops)
-            free(n_stops);
-        if (stop_colors)
-            free(stop_colors);
-    }
-
     glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
     glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
     return NULL;
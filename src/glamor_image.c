@@ -108,8 +108,7 @@ glamor_get_image_gl(DrawablePtr drawable, int x, int y, int w, int h,
 {
     PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
     glamor_pixmap_private *pixmap_priv;
-    uint32_t    byte_stride = PixmapBytePad(w, drawable->depth);
-    BoxRec      box;
+    glamor_readback read;
     int         off_x, off_y;
 
     pixmap_priv = glamor_get_pixmap_private(pixmap);
@@ -120,14 +119,13 @@ glamor_get_image_gl(DrawablePtr drawable, int x, int y, int w, int h,
         goto bail;
 
     glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
-    box.x1 = x;
-    box.x2 = x + w;
-    box.y1 = y;
-    box.y2 = y + h;
-    glamor_download_boxes(pixmap, &box, 1,
-                          drawable->x + off_x, drawable->y + off_y,
-                          -x, -y,
-                          (uint8_t *) d, byte_stride);
+    read.box.x1 = drawable->x + off_x + x;
+    read.box.x2 = read.box.x1 + w;
+    read.box.y1 = drawable->y + off_y + y;
+    read.box.y2 = read.box.y1 + h;
+    read.bits = (uint8_t *) d;
+    read.byte_stride = PixmapBytePad(w, drawable->depth);
+    glamor_readback(pixmap, &read, 1);
     return TRUE;
 bail:
     return FALSE;
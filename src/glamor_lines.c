@@ -128,8 +128,12 @@ static Bool
 glamor_poly_lines_gl(DrawablePtr drawable, GCPtr gc,
                      int mode, int n, DDXPointPtr points)
 {
-    if (gc->lineWidth != 0)
+    if (gc->lineWidth != 0) {
+        if (gc->lineStyle == LineSolid ||
+            (gc->lineStyle == LineDoubleDash && gc->fillStyle == FillTiled))
+            return glamor_poly_lines_wide_gl(drawable, gc, mode, n, points);
         return FALSE;
+    }
 
     switch (gc->lineStyle) {
     case LineSolid:
@@ -26,9 +26,8 @@
 /**
  * @file glamor_picture.c
  *
- * Implements temporary uploads of GL_MEMORY Pixmaps to a texture that
- * is swizzled appropriately for a given Render picture format.
- * laid *
+ * Implements uploads of GL_MEMORY Pixmaps to a texture that is
+ * swizzled appropriately for a given Render picture format.
  *
  * This is important because GTK likes to use SHM Pixmaps for Render
  * blending operations, and we don't want a blend operation to fall
@@ -39,8 +38,12 @@
 #include <stdlib.h>
 
 #include "glamor_priv.h"
+#include "glamor_transfer.h"
 #include "mipict.h"
 
+/* Texture memory that memory pixmap shadows may hold, in bytes */
+#define GLAMOR_SHADOW_CACHE_SIZE        (16 * 1024 * 1024)
+
 static void byte_swap_swizzle(GLenum *swizzle)
 {
     GLenum temp;
@@ -270,8 +273,8 @@ glamor_get_converted_image(PictFormatShort dst_format,
  * Uploads a picture based on a GLAMOR_MEMORY pixmap to a texture in a
  * temporary FBO.
  */
-Bool
-glamor_upload_picture_to_texture(PicturePtr picture)
+static Bool
+glamor_upload_picture_full(PicturePtr picture)
 {
     PixmapPtr pixmap = glamor_get_drawable_pixmap(picture->pDrawable);
     ScreenPtr screen = pixmap->drawable.pScreen;
@@ -373,3 +376,298 @@ fail:
 
     return ret;
 }
+
+/*
+ * Pixmaps the same picture keeps getting composited from (icons,
+ * client-side glyphs, shaped window contents) hold on to their texture
+ * between requests.  Damage on the pixmap records what CPU rendering
+ * has happened since, and only those boxes are uploaded again.
+ */
+
+void
+glamor_shadow_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    xorg_list_init(&glamor_priv->shadows);
+    glamor_priv->shadow_size = 0;
+}
+
+static void
+glamor_shadow_free(glamor_screen_private *glamor_priv, glamor_shadow *shadow)
+{
+    glamor_pixmap_private *pixmap_priv;
+
+    if (shadow->damage) {
+        /* Comes back here through glamor_shadow_damage_destroy() */
+        DamageUnregister(shadow->damage);
+        DamageDestroy(shadow->damage);
+        return;
+    }
+
+    pixmap_priv = glamor_get_pixmap_private(shadow->pixmap);
+    if (pixmap_priv->fbo == shadow->fbo)
+        glamor_pixmap_detach_fbo(pixmap_priv);
+    pixmap_priv->shadow = NULL;
+
+    xorg_list_del(&shadow->link);
+    glamor_priv->shadow_size -= shadow->size;
+    glamor_destroy_fbo(glamor_priv, shadow->fbo);
+    free(shadow);
+}
+
+static void
+glamor_shadow_damage_destroy(DamagePtr damage, void *closure)
+{
+    glamor_shadow *shadow = closure;
+    ScreenPtr screen = shadow->pixmap->drawable.pScreen;
+
+    shadow->damage = NULL;
+    glamor_shadow_free(glamor_get_screen_private(screen), shadow);
+}
+
+/*
+ * Drop least recently used shadows until the cache is back under its
+ * limit.  Shadows bound for the composite being set up are kept.
+ */
+static void
+glamor_shadow_trim(glamor_screen_private *glamor_priv)
+{
+    struct xorg_list *link = glamor_priv->shadows.prev;
+
+    while (glamor_priv->shadow_size > GLAMOR_SHADOW_CACHE_SIZE &&
+           link != &glamor_priv->shadows) {
+        glamor_shadow *shadow = xorg_list_entry(link, glamor_shadow, link);
+
+        link = link->prev;
+        if (glamor_get_pixmap_private(shadow->pixmap)->fbo != shadow->fbo)
+            glamor_shadow_free(glamor_priv, shadow);
+    }
+}
+
+/*
+ * Damage only sees rendering to bits that fb allocated along with the
+ * pixmap.  SHM pixmaps and other client memory can change behind the
+ * server's back, so those are uploaded for every use.
+ */
+static Bool
+glamor_shadow_trackable(PixmapPtr pixmap)
+{
+    char *base = (char *) pixmap + pixmap->drawable.pScreen->totalPixmapSize;
+    char *bits = pixmap->devPrivate.ptr;
+
+    /* fbCreatePixmap() aligns the bits to 8 bytes after the privates */
+    return bits >= base && bits < base + 8;
+}
+
+/*
+ * Copy the damaged boxes of the pixmap into its shadow, converted the
+ * same way glamor_upload_picture_full() did.
+ */
+static Bool
+glamor_shadow_upload_region(glamor_shadow *shadow, RegionPtr region)
+{
+    PixmapPtr pixmap = shadow->pixmap;
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PictFormatShort converted_format;
+    GLenum format, type;
+    GLenum swizzle[4];
+    uint8_t *bits = pixmap->devPrivate.ptr;
+    int stride = pixmap->devKind;
+    int bytes_per_pixel = pixmap->drawable.bitsPerPixel >> 3;
+    BoxPtr box = RegionRects(region);
+    int nbox = RegionNumRects(region);
+
+    if (!glamor_get_tex_format_type_from_pictformat(screen, shadow->format,
+                                                    &converted_format,
+                                                    &format, &type, swizzle))
+        return FALSE;
+
+    glamor_make_current(glamor_priv);
+    glBindTexture(GL_TEXTURE_2D, shadow->fbo->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (converted_format != shadow->format) {
+        /* Convert whole rows so sub-byte formats stay aligned */
+        BoxPtr extents = RegionExtents(region);
+        int h = extents->y2 - extents->y1;
+        pixman_image_t *converted_image;
+
+        converted_image =
+            glamor_get_converted_image(converted_format, shadow->format,
+                                       bits + extents->y1 * stride, stride,
+                                       pixmap->drawable.width, h);
+        if (!converted_image)
+            return FALSE;
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, extents->y1,
+                        pixmap->drawable.width, h, format, type,
+                        pixman_image_get_data(converted_image));
+        pixman_image_unref(converted_image);
+        return TRUE;
+    }
+
+    if (glamor_priv->has_unpack_subimage)
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bytes_per_pixel);
+
+    for (; nbox--; box++) {
+        uint8_t *src = bits + box->y1 * stride + box->x1 * bytes_per_pixel;
+        int w = box->x2 - box->x1;
+        int h = box->y2 - box->y1;
+
+        if (glamor_priv->has_unpack_subimage)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, box->x1, box->y1, w, h,
+                            format, type, src);
+        else
+            glamor_write_rect(glamor_priv, box->x1, box->y1, w, h,
+                              format, type, bytes_per_pixel, src, stride);
+    }
+
+    if (glamor_priv->has_unpack_subimage)
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    return TRUE;
+}
+
+/*
+ * Keep the texture just uploaded for the picture's pixmap, and start
+ * tracking changes to the pixmap.
+ */
+static void
+glamor_shadow_create(glamor_screen_private *glamor_priv, PicturePtr picture,
+                     PixmapPtr pixmap)
+{
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_shadow *shadow;
+    size_t size;
+
+    if (!glamor_shadow_trackable(pixmap))
+        return;
+
+    /* Conversions may widen the bits, so assume four bytes a texel */
+    size = (size_t) pixmap->drawable.width * pixmap->drawable.height * 4;
+    if (size > GLAMOR_SHADOW_CACHE_SIZE / 4)
+        return;
+
+    shadow = calloc(1, sizeof (glamor_shadow));
+    if (!shadow)
+        return;
+
+    shadow->damage = DamageCreate(NULL, glamor_shadow_damage_destroy,
+                                  DamageReportNone, TRUE,
+                                  pixmap->drawable.pScreen, shadow);
+    if (!shadow->damage) {
+        free(shadow);
+        return;
+    }
+    DamageRegister(&pixmap->drawable, shadow->damage);
+
+    shadow->pixmap = pixmap;
+    shadow->fbo = pixmap_priv->fbo;
+    shadow->bits = pixmap->devPrivate.ptr;
+    shadow->format = picture->format;
+    shadow->size = size;
+    pixmap_priv->shadow = shadow;
+
+    xorg_list_add(&shadow->link, &glamor_priv->shadows);
+    glamor_priv->shadow_size += size;
+    glamor_shadow_trim(glamor_priv);
+}
+
+/**
+ * Uploads a picture based on a GLAMOR_MEMORY pixmap to a texture,
+ * attached to the pixmap until glamor_release_picture_texture().
+ */
+Bool
+glamor_upload_picture_to_texture(PicturePtr picture)
+{
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(picture->pDrawable);
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_shadow *shadow = pixmap_priv->shadow;
+
+    if (shadow && (shadow->format != picture->format ||
+                   shadow->bits != pixmap->devPrivate.ptr)) {
+        glamor_shadow_free(glamor_priv, shadow);
+        shadow = NULL;
+    }
+
+    if (shadow) {
+        RegionPtr damaged = DamageRegion(shadow->damage);
+
+        if (!RegionNotEmpty(damaged)) {
+            glamor_priv->shadow_hits++;
+        } else if (glamor_shadow_upload_region(shadow, damaged)) {
+            DamageEmpty(shadow->damage);
+            glamor_priv->shadow_partial_uploads++;
+        } else {
+            glamor_shadow_free(glamor_priv, shadow);
+            shadow = NULL;
+        }
+    }
+
+    if (shadow) {
+        xorg_list_del(&shadow->link);
+        xorg_list_add(&shadow->link, &glamor_priv->shadows);
+        glamor_pixmap_attach_fbo(pixmap, shadow->fbo);
+        return TRUE;
+    }
+
+    if (!glamor_upload_picture_full(picture))
+        return FALSE;
+
+    /* A pixmap used once is usually a temporary; only keep the
+     * texture once the same pixmap comes back.
+     */
+    if (pixmap_priv->uploaded) {
+        glamor_shadow_create(glamor_priv, picture, pixmap);
+        glamor_priv->shadow_full_uploads++;
+    }
+    pixmap_priv->uploaded = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * Called once rendering from a picture uploaded with
+ * glamor_upload_picture_to_texture() is done.
+ */
+void
+glamor_release_picture_texture(PixmapPtr pixmap)
+{
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+
+    if (pixmap_priv->shadow && pixmap_priv->fbo == pixmap_priv->shadow->fbo)
+        glamor_pixmap_detach_fbo(pixmap_priv);
+    else
+        glamor_pixmap_destroy_fbo(pixmap);
+}
+
+void
+glamor_shadow_destroy_pixmap(PixmapPtr pixmap)
+{
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+
+    if (pixmap_priv->shadow)
+        glamor_shadow_free(glamor_get_screen_private(pixmap->drawable.pScreen),
+                           pixmap_priv->shadow);
+}
+
+void
+glamor_shadow_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_shadow *shadow, *tmp;
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: memory pixmap textures %lu hits, "
+                   "%lu partial uploads, %lu full uploads\n",
+                   screen->myNum, glamor_priv->shadow_hits,
+                   glamor_priv->shadow_partial_uploads,
+                   glamor_priv->shadow_full_uploads);
+
+    xorg_list_for_each_entry_safe(shadow, tmp, &glamor_priv->shadows, link)
+        glamor_shadow_free(glamor_priv, shadow);
+}
@@ -54,12 +54,13 @@ glamor_get_drawable_deltas(DrawablePtr drawable, PixmapPtr pixmap,
 void
 glamor_pixmap_init(ScreenPtr screen)
 {
-
+    glamor_init_pixmap_fbo(screen);
 }
 
 void
 glamor_pixmap_fini(ScreenPtr screen)
 {
+    glamor_fini_pixmap_fbo(screen);
 }
 
 void
@@ -0,0 +1,368 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Filled polygons.
+ *
+ * Convex polygons are drawn as a triangle fan.  Everything else is
+ * cut into horizontal bands at each vertex and at each edge crossing;
+ * within a band the edges are sorted and paired up according to the
+ * fill rule, and each pair becomes a trapezoid.  Either way every
+ * pixel is covered once, so all raster ops work.
+ */
+
+#include <stdlib.h>
+
+#include "glamor_priv.h"
+#include "glamor_program.h"
+#include "glamor_transform.h"
+
+/* Vertices are pulled left and up a bit so that pixel centers exactly
+ * on a left or top edge are inside the polygon, and those on a right
+ * or bottom edge are not.
+ */
+#define GLAMOR_POLYGON_BIAS_X   (1.0 / 64.0)
+#define GLAMOR_POLYGON_BIAS_Y   (1.0 / 256.0)
+
+static const glamor_facet glamor_facet_polygon = {
+    .name = "polygon",
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = ("       vec2 pos = vec2(0.0,0.0);\n"
+                GLAMOR_POS(gl_Position, primitive.xy)),
+};
+
+typedef struct {
+    double      x1, y1;         /* top */
+    double      x2, y2;         /* bottom */
+    int         dir;
+    double      xa, xb;         /* x at the top and bottom of the band */
+} glamor_poly_edge;
+
+typedef struct {
+    GLfloat     *verts;
+    int         nvert;
+    int         size;
+} glamor_poly_geom;
+
+static double
+glamor_poly_edge_x(glamor_poly_edge *e, double y)
+{
+    return e->x1 + (y - e->y1) * (e->x2 - e->x1) / (e->y2 - e->y1);
+}
+
+static int
+glamor_poly_edge_cmp(const void *a, const void *b)
+{
+    const glamor_poly_edge *ea = *(glamor_poly_edge * const *) a;
+    const glamor_poly_edge *eb = *(glamor_poly_edge * const *) b;
+
+    if (ea->xa != eb->xa)
+        return ea->xa < eb->xa ? -1 : 1;
+    if (ea->xb != eb->xb)
+        return ea->xb < eb->xb ? -1 : 1;
+    return 0;
+}
+
+static int
+glamor_poly_y_cmp(const void *a, const void *b)
+{
+    double ya = *(const double *) a;
+    double yb = *(const double *) b;
+
+    return ya < yb ? -1 : ya > yb ? 1 : 0;
+}
+
+static Bool
+glamor_poly_vert(glamor_poly_geom *g, double x, double y)
+{
+    if (g->nvert == g->size) {
+        int size = g->size ? g->size * 2 : 96;
+        GLfloat *verts = reallocarray(g->verts, size, 2 * sizeof (GLfloat));
+
+        if (!verts)
+            return FALSE;
+        g->verts = verts;
+        g->size = size;
+    }
+    g->verts[g->nvert * 2] = x - GLAMOR_POLYGON_BIAS_X;
+    g->verts[g->nvert * 2 + 1] = y - GLAMOR_POLYGON_BIAS_Y;
+    g->nvert++;
+    return TRUE;
+}
+
+static Bool
+glamor_poly_trap(glamor_poly_geom *g, double ya, double yb,
+                 glamor_poly_edge *l, glamor_poly_edge *r)
+{
+    if (l->xa == r->xa && l->xb == r->xb)
+        return TRUE;
+
+    return (glamor_poly_vert(g, l->xa, ya) &&
+            glamor_poly_vert(g, r->xa, ya) &&
+            glamor_poly_vert(g, l->xb, yb) &&
+            glamor_poly_vert(g, r->xa, ya) &&
+            glamor_poly_vert(g, l->xb, yb) &&
+            glamor_poly_vert(g, r->xb, yb));
+}
+
+/*
+ * Emit the trapezoids for the band between ya and yb, in which no
+ * two active edges cross.
+ */
+static Bool
+glamor_poly_band(glamor_poly_geom *g, int fill_rule, double ya, double yb,
+                 glamor_poly_edge **active, int nactive)
+{
+    int winding = 0;
+    int i, left = 0;
+
+    for (i = 0; i < nactive; i++) {
+        active[i]->xa = glamor_poly_edge_x(active[i], ya);
+        active[i]->xb = glamor_poly_edge_x(active[i], yb);
+    }
+
+    if (fill_rule == EvenOddRule) {
+        for (i = 0; i + 1 < nactive; i += 2)
+            if (!glamor_poly_trap(g, ya, yb, active[i], active[i + 1]))
+                return FALSE;
+        return TRUE;
+    }
+
+    for (i = 0; i < nactive; i++) {
+        if (winding == 0)
+            left = i;
+        winding += active[i]->dir;
+        if (winding == 0 &&
+            !glamor_poly_trap(g, ya, yb, active[left], active[i]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static Bool
+glamor_poly_tessellate(glamor_poly_geom *g, int fill_rule,
+                       int npt, DDXPointPtr pts)
+{
+    glamor_poly_edge *edges, **active;
+    double *ys;
+    int nedge = 0, ny = 0;
+    int i, j, b;
+    Bool ret = FALSE;
+
+    edges = xallocarray(npt, sizeof (glamor_poly_edge));
+    active = xallocarray(npt, sizeof (glamor_poly_edge *));
+    ys = xallocarray(npt, sizeof (double));
+    if (!edges || !active || !ys)
+        goto out;
+
+    for (i = 0; i < npt; i++) {
+        DDXPointPtr p = &pts[i];
+        DDXPointPtr q = &pts[(i + 1) % npt];
+        glamor_poly_edge *e;
+
+        ys[i] = p->y;
+
+        /* Horizontal edges never bound a band */
+        if (p->y == q->y)
+            continue;
+
+        e = &edges[nedge++];
+        if (p->y < q->y) {
+            e->x1 = p->x; e->y1 = p->y;
+            e->x2 = q->x; e->y2 = q->y;
+            e->dir = 1;
+        } else {
+            e->x1 = q->x; e->y1 = q->y;
+            e->x2 = p->x; e->y2 = p->y;
+            e->dir = -1;
+        }
+    }
+
+    qsort(ys, npt, sizeof (double), glamor_poly_y_cmp);
+    for (i = 0; i < npt; i++)
+        if (ny == 0 || ys[i] != ys[ny - 1])
+            ys[ny++] = ys[i];
+
+    for (b = 0; b + 1 < ny; b++) {
+        double ya = ys[b], yb = ys[b + 1];
+        int nactive = 0;
+
+        for (i = 0; i < nedge; i++)
+            if (edges[i].y1 <= ya && edges[i].y2 >= yb)
+                active[nactive++] = &edges[i];
+
+        /* Split the band wherever neighbouring edges cross; the first
+         * crossing is always between edges that are adjacent at the
+         * top of the band.
+         */
+        while (ya < yb) {
+            double ysplit = yb;
+
+            for (i = 0; i < nactive; i++) {
+                active[i]->xa = glamor_poly_edge_x(active[i], ya);
+                active[i]->xb = glamor_poly_edge_x(active[i], yb);
+            }
+            qsort(active, nactive, sizeof (glamor_poly_edge *),
+                  glamor_poly_edge_cmp);
+
+            for (j = 0; j + 1 < nactive; j++) {
+                glamor_poly_edge *l = active[j], *r = active[j + 1];
+
+                if (l->xb > r->xb) {
+                    double t = (r->xa - l->xa) /
+                        ((l->xb - l->xa) - (r->xb - r->xa));
+                    double yc = ya + t * (yb - ya);
+
+                    if (yc > ya && yc < ysplit)
+                        ysplit = yc;
+                }
+            }
+
+            if (!glamor_poly_band(g, fill_rule, ya, ysplit, active, nactive))
+                goto out;
+            ya = ysplit;
+        }
+    }
+    ret = TRUE;
+
+out:
+    free(ys);
+    free(active);
+    free(edges);
+    return ret;
+}
+
+static Bool
+glamor_fill_polygon_gl(DrawablePtr drawable, GCPtr gc,
+                       int shape, int mode, int n, DDXPointPtr points)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_program *prog;
+    glamor_poly_geom g = { 0 };
+    DDXPointPtr pts = points;
+    GLfloat *v;
+    char *vbo_offset;
+    int off_x, off_y;
+    int box_index;
+    int i;
+    Bool ret = FALSE;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (n < 3)
+        return TRUE;
+
+    if (mode == CoordModePrevious) {
+        pts = xallocarray(n, sizeof (DDXPointRec));
+        if (!pts)
+            return FALSE;
+        pts[0] = points[0];
+        for (i = 1; i < n; i++) {
+            pts[i].x = pts[i - 1].x + points[i].x;
+            pts[i].y = pts[i - 1].y + points[i].y;
+        }
+    }
+
+    if (shape == Convex) {
+        for (i = 1; i + 1 < n; i++)
+            if (!glamor_poly_vert(&g, pts[0].x, pts[0].y) ||
+                !glamor_poly_vert(&g, pts[i].x, pts[i].y) ||
+                !glamor_poly_vert(&g, pts[i + 1].x, pts[i + 1].y))
+                goto bail;
+    } else if (!glamor_poly_tessellate(&g, gc->fillRule, n, pts))
+        goto bail;
+
+    if (!g.nvert) {
+        ret = TRUE;
+        goto bail;
+    }
+
+    glamor_make_current(glamor_priv);
+
+    prog = glamor_use_program_fill(pixmap, gc,
+                                   &glamor_priv->fill_polygon_program,
+                                   &glamor_facet_polygon);
+    if (!prog)
+        goto bail;
+
+    v = glamor_get_vbo_space(screen, g.nvert * 2 * sizeof (GLfloat),
+                             &vbo_offset);
+    memcpy(v, g.verts, g.nvert * 2 * sizeof (GLfloat));
+    glamor_put_vbo_space(screen);
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_FLOAT, GL_FALSE,
+                          2 * sizeof (GLfloat), vbo_offset);
+
+    glEnable(GL_SCISSOR_TEST);
+
+    glamor_pixmap_loop(pixmap_priv, box_index) {
+        int nbox = RegionNumRects(gc->pCompositeClip);
+        BoxPtr box = RegionRects(gc->pCompositeClip);
+
+        glamor_set_destination_drawable(drawable, box_index, TRUE, TRUE,
+                                        prog->matrix_uniform,
+                                        &off_x, &off_y);
+
+        while (nbox--) {
+            glScissor(box->x1 + off_x,
+                      box->y1 + off_y,
+                      box->x2 - box->x1,
+                      box->y2 - box->y1);
+            box++;
+            glDrawArrays(GL_TRIANGLES, 0, g.nvert);
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+    ret = TRUE;
+
+bail:
+    free(g.verts);
+    if (pts != points)
+        free(pts);
+    return ret;
+}
+
+static void
+glamor_fill_polygon_bail(DrawablePtr drawable, GCPtr gc,
+                         int shape, int mode, int n, DDXPointPtr points)
+{
+    glamor_fallback("to %p (%c)\n", drawable,
+                    glamor_get_drawable_location(drawable));
+
+    miFillPolygon(drawable, gc, shape, mode, n, points);
+}
+
+void
+glamor_fill_polygon(DrawablePtr drawable, GCPtr gc,
+                    int shape, int mode, int n, DDXPointPtr points)
+{
+    if (glamor_fill_polygon_gl(drawable, gc, shape, mode, n, points))
+        return;
+    glamor_fill_polygon_bail(drawable, gc, shape, mode, n, points);
+}
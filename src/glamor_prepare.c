@@ -24,9 +24,137 @@
 #include "glamor_prepare.h"
 #include "glamor_transfer.h"
 
+/*
+ * Fallbacks are frequent enough that allocating a PBO for each one
+ * shows up, so a few staging buffers live in a screen-level ring and
+ * are handed out to prepared pixmaps.  Requests that don't fit in a
+ * free slot, or that are too large to keep around, get a buffer of
+ * their own which is deleted again when the access finishes.
+ *
+ * On return the buffer is bound to GL_PIXEL_PACK_BUFFER.  Returns the
+ * slot index, or -1 for a private buffer.
+ */
+
+int
+glamor_pbo_get(glamor_screen_private *glamor_priv, size_t size, GLuint *pbo)
+{
+    glamor_pbo_slot *best = NULL;
+    int i;
+
+    /* Prefer the smallest free buffer that fits, else grow the
+     * largest free one.
+     */
+    if (size <= GLAMOR_PBO_RING_MAX_SIZE) {
+        for (i = 0; i < GLAMOR_PBO_RING_SIZE; i++) {
+            glamor_pbo_slot *slot = &glamor_priv->pbo_ring[i];
+
+            if (slot->busy)
+                continue;
+
+            if (!best)
+                best = slot;
+            else if (best->size >= size)
+                best = (slot->size >= size && slot->size < best->size) ?
+                    slot : best;
+            else if (slot->size > best->size)
+                best = slot;
+        }
+    }
+
+    if (!best) {
+        glGenBuffers(1, pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, *pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        return -1;
+    }
+
+    if (best->pbo == 0)
+        glGenBuffers(1, &best->pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, best->pbo);
+
+    if (best->size < size) {
+        /* Grow in 64kB steps so that slightly different sizes reuse it */
+        best->size = (size + 0xffff) & ~(size_t) 0xffff;
+        if (best->size > GLAMOR_PBO_RING_MAX_SIZE)
+            best->size = size;
+        glBufferData(GL_PIXEL_PACK_BUFFER, best->size, NULL, GL_STREAM_READ);
+    }
+
+    best->busy = TRUE;
+    *pbo = best->pbo;
+    return best - glamor_priv->pbo_ring;
+}
+
+void
+glamor_pbo_put(glamor_screen_private *glamor_priv, int slot, GLuint pbo)
+{
+    if (slot < 0)
+        glDeleteBuffers(1, &pbo);
+    else
+        glamor_priv->pbo_ring[slot].busy = FALSE;
+}
+
+/*
+ * Get a staging buffer for the whole pixmap.  Only the prepared boxes
+ * are downloaded into it, but fb may read anywhere in the pixmap (a
+ * repeating source wraps outside the composite box, for instance), so
+ * every row has to be backed.
+ */
+
+static void
+glamor_prep_pbo(glamor_screen_private *glamor_priv, PixmapPtr pixmap,
+                glamor_pixmap_private *priv)
+{
+    priv->pbo_slot = glamor_pbo_get(glamor_priv,
+                                    (size_t) pixmap->devKind *
+                                    pixmap->drawable.height,
+                                    &priv->pbo);
+}
+
+static unsigned long
+glamor_region_bytes(PixmapPtr pixmap, RegionPtr region)
+{
+    BoxPtr box = RegionRects(region);
+    int nbox = RegionNumRects(region);
+    unsigned long bytes = 0;
+
+    while (nbox--) {
+        bytes += (unsigned long) (box->x2 - box->x1) * (box->y2 - box->y1);
+        box++;
+    }
+    return bytes * (pixmap->drawable.bitsPerPixel >> 3);
+}
+
+/*
+ * Map the staging buffer bound to GL_PIXEL_PACK_BUFFER.  ES has no
+ * glMapBuffer for reading, so use glMapBufferRange whenever it's
+ * around and only fall back to glMapBuffer on older desktop GL.
+ */
+
+static uint8_t *
+glamor_prep_map(glamor_screen_private *glamor_priv, PixmapPtr pixmap,
+                glamor_pixmap_private *priv)
+{
+    GLbitfield access = GL_MAP_READ_BIT;
+
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP &&
+        !glamor_priv->has_map_buffer_range)
+        return glMapBuffer(GL_PIXEL_PACK_BUFFER,
+                           priv->map_access == GLAMOR_ACCESS_RW ?
+                           GL_READ_WRITE : GL_READ_ONLY);
+
+    if (priv->map_access == GLAMOR_ACCESS_RW)
+        access |= GL_MAP_WRITE_BIT;
+
+    return glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                            (GLsizeiptr) pixmap->devKind *
+                            pixmap->drawable.height,
+                            access);
+}
+
 /*
  * Make a pixmap ready to draw with fb by
- * creating a PBO large enough for the whole object
+ * staging the requested boxes in a PBO
  * and downloading all of the FBOs into it.
  */
 
@@ -36,8 +164,8 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
     ScreenPtr                   screen = pixmap->drawable.pScreen;
     glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
     glamor_pixmap_private       *priv = glamor_get_pixmap_private(pixmap);
-    int                         gl_access, gl_usage;
     RegionRec                   region;
+    CARD64                      start;
 
     if (priv->type == GLAMOR_DRM_ONLY)
         return FALSE;
@@ -47,6 +175,7 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
 
     glamor_make_current(glamor_priv);
 
+    start = GetTimeInMicros();
     RegionInit(&region, box, 1);
 
     /* See if it's already mapped */
@@ -74,6 +203,8 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
         if (access == GLAMOR_ACCESS_RW)
             FatalError("attempt to remap buffer as writable");
 
+        RegionUnion(&priv->prepare_region, &priv->prepare_region, &region);
+
         if (priv->pbo) {
             glBindBuffer(GL_PIXEL_PACK_BUFFER, priv->pbo);
             glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
@@ -83,15 +214,7 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
         RegionInit(&priv->prepare_region, box, 1);
 
         if (glamor_priv->has_rw_pbo) {
-            if (priv->pbo == 0)
-                glGenBuffers(1, &priv->pbo);
-
-            gl_usage = GL_STREAM_READ;
-
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, priv->pbo);
-            glBufferData(GL_PIXEL_PACK_BUFFER,
-                         pixmap->devKind * pixmap->drawable.height, NULL,
-                         gl_usage);
+            glamor_prep_pbo(glamor_priv, pixmap, priv);
         } else {
             pixmap->devPrivate.ptr = xallocarray(pixmap->devKind,
                                                  pixmap->drawable.height);
@@ -99,30 +222,33 @@ glamor_prep_pixmap_box(PixmapPtr pixmap, glamor_access_t access, BoxPtr box)
                 return FALSE;
         }
         priv->map_access = access;
+        glamor_priv->prepare_count++;
     }
 
     glamor_download_boxes(pixmap, RegionRects(&region), RegionNumRects(&region),
-                          0, 0, 0, 0, pixmap->devPrivate.ptr, pixmap->devKind);
+                          0, 0, 0, 0,
+                          pixmap->devPrivate.ptr, pixmap->devKind);
+    glamor_priv->prepare_download_bytes += glamor_region_bytes(pixmap, &region);
 
     RegionUninit(&region);
 
     if (glamor_priv->has_rw_pbo) {
-        if (priv->map_access == GLAMOR_ACCESS_RW)
-            gl_access = GL_READ_WRITE;
-        else
-            gl_access = GL_READ_ONLY;
+        uint8_t *map = glamor_prep_map(glamor_priv, pixmap, priv);
 
-        pixmap->devPrivate.ptr = glMapBuffer(GL_PIXEL_PACK_BUFFER, gl_access);
+        if (map)
+            pixmap->devPrivate.ptr = map;
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
     }
 
+    glamor_priv->prepare_usecs += GetTimeInMicros() - start;
+
     priv->prepared = TRUE;
     return TRUE;
 }
 
 /*
  * When we're done with the drawable, unmap the PBO, reupload
- * if we were writing to it and then unbind it to release the memory
+ * if we were writing to it and then hand the PBO back to the ring
  */
 
 static void
@@ -131,6 +257,7 @@ glamor_fini_pixmap(PixmapPtr pixmap)
     ScreenPtr                   screen = pixmap->drawable.pScreen;
     glamor_screen_private       *glamor_priv = glamor_get_screen_private(screen);
     glamor_pixmap_private       *priv = glamor_get_pixmap_private(pixmap);
+    CARD64                      start;
 
     if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(priv))
         return;
@@ -138,6 +265,8 @@ glamor_fini_pixmap(PixmapPtr pixmap)
     if (!priv->prepared)
         return;
 
+    start = GetTimeInMicros();
+
     if (glamor_priv->has_rw_pbo) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, priv->pbo);
         glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
@@ -148,23 +277,64 @@ glamor_fini_pixmap(PixmapPtr pixmap)
         glamor_upload_boxes(pixmap,
                             RegionRects(&priv->prepare_region),
                             RegionNumRects(&priv->prepare_region),
-                            0, 0, 0, 0, pixmap->devPrivate.ptr, pixmap->devKind);
+                            0, 0, 0, 0,
+                            pixmap->devPrivate.ptr, pixmap->devKind);
+        glamor_priv->prepare_upload_bytes +=
+            glamor_region_bytes(pixmap, &priv->prepare_region);
     }
 
     RegionUninit(&priv->prepare_region);
 
     if (glamor_priv->has_rw_pbo) {
         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-        glDeleteBuffers(1, &priv->pbo);
+        glamor_pbo_put(glamor_priv, priv->pbo_slot, priv->pbo);
         priv->pbo = 0;
     } else {
         free(pixmap->devPrivate.ptr);
         pixmap->devPrivate.ptr = NULL;
     }
 
+    glamor_priv->prepare_usecs += GetTimeInMicros() - start;
+
     priv->prepared = FALSE;
 }
 
+/*
+ * Release the staging ring and report how much data the fallbacks
+ * moved between GL and system memory.
+ */
+
+void
+glamor_prepare_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    unsigned long count = glamor_priv->prepare_count;
+    int i;
+
+    glamor_make_current(glamor_priv);
+    for (i = 0; i < GLAMOR_PBO_RING_SIZE; i++) {
+        if (glamor_priv->pbo_ring[i].pbo)
+            glDeleteBuffers(1, &glamor_priv->pbo_ring[i].pbo);
+        glamor_priv->pbo_ring[i].pbo = 0;
+        glamor_priv->pbo_ring[i].size = 0;
+    }
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: %lu fallbacks, %llu bytes downloaded, "
+                   "%llu bytes uploaded (%llu bytes per fallback)\n",
+                   screen->myNum, count,
+                   glamor_priv->prepare_download_bytes,
+                   glamor_priv->prepare_upload_bytes,
+                   count ? (glamor_priv->prepare_download_bytes +
+                            glamor_priv->prepare_upload_bytes) / count : 0);
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: %llu us in %s fallback transfers "
+                   "(%llu us per fallback)\n",
+                   screen->myNum, glamor_priv->prepare_usecs,
+                   glamor_priv->has_rw_pbo ? "PBO" : "system memory",
+                   count ? glamor_priv->prepare_usecs / count : 0);
+}
+
 Bool
 glamor_prepare_access(DrawablePtr drawable, glamor_access_t access)
 {
@@ -49,4 +49,13 @@ glamor_prepare_access_gc(GCPtr gc);
 void
 glamor_finish_access_gc(GCPtr gc);
 
+void
+glamor_prepare_fini(ScreenPtr screen);
+
+int
+glamor_pbo_get(glamor_screen_private *glamor_priv, size_t size, GLuint *pbo);
+
+void
+glamor_pbo_put(glamor_screen_private *glamor_priv, int slot, GLuint pbo);
+
 #endif /* _GLAMOR_PREPARE_H_ */
@@ -80,6 +80,7 @@ typedef struct glamor_composite_shader {
     GLint mask_wh;
     GLint source_repeat_mode;
     GLint mask_repeat_mode;
+    glamor_gradient_uniforms gradient_uniforms;
     union {
         float source_solid_color[4];
         struct {
@@ -107,6 +108,8 @@ enum shader_source {
     SHADER_SOURCE_SOLID,
     SHADER_SOURCE_TEXTURE,
     SHADER_SOURCE_TEXTURE_ALPHA,
+    SHADER_SOURCE_LINEAR,
+    SHADER_SOURCE_RADIAL,
     SHADER_SOURCE_COUNT,
 };
 
@@ -172,6 +175,26 @@ enum glamor_gl_flavor {
 
 #define GLAMOR_COMPOSITE_VBO_VERT_CNT (64*1024)
 
+/* FBO pool: recycled textures are bucketed by format and size order. */
+#define GLAMOR_FBO_CACHE_FORMAT_COUNT 3
+#define GLAMOR_FBO_CACHE_BUCKET_WCOUNT 4
+#define GLAMOR_FBO_CACHE_BUCKET_HCOUNT 4
+/* Number of block handler runs a pooled fbo survives unused. */
+#define GLAMOR_FBO_CACHE_EXPIRE 100
+/* Upper bound on the texture memory held by the pool, in bytes. */
+#define GLAMOR_FBO_CACHE_MAX_SIZE (32 * 1024 * 1024)
+
+/* Staging PBOs kept around for glamor_prepare_access. */
+#define GLAMOR_PBO_RING_SIZE 4
+/* Larger prepares get a buffer of their own, freed when finished. */
+#define GLAMOR_PBO_RING_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct glamor_pbo_slot {
+    GLuint pbo;
+    size_t size;
+    Bool busy;
+} glamor_pbo_slot;
+
 struct glamor_saved_procs {
     CloseScreenProcPtr close_screen;
     CreateScreenResourcesProcPtr create_screen_resources;
@@ -195,9 +218,29 @@ struct glamor_saved_procs {
     ScreenBlockHandlerProcPtr block_handler;
 };
 
+/* What a batched composite relies on besides its vertices */
+typedef struct {
+    glamor_pixmap_fbo *fbo;
+    PictFormatShort format;
+    Bool solid;
+    CARD32 color;
+    int repeat;
+    int filter;
+    Bool transform;
+    Bool component_alpha;
+} glamor_composite_batch_picture;
+
+typedef struct {
+    CARD8 op;
+    glamor_composite_batch_picture source;
+    glamor_composite_batch_picture mask;
+    glamor_composite_batch_picture dest;
+} glamor_composite_batch;
+
 typedef struct glamor_screen_private {
     enum glamor_gl_flavor gl_flavor;
     int glsl_version;
+    Bool has_glsl_es3;
     Bool has_pack_invert;
     Bool has_fbo_blit;
     Bool has_map_buffer_range;
@@ -207,6 +250,7 @@ typedef struct glamor_screen_private {
     Bool has_pack_subimage;
     Bool has_unpack_subimage;
     Bool has_rw_pbo;
+    Bool has_pack_pbo;
     Bool use_quads;
     Bool has_vertex_array_object;
     Bool has_dual_blend;
@@ -228,11 +272,14 @@ typedef struct glamor_screen_private {
 
     /* glamor glyphblt shaders */
     glamor_program_fill poly_glyph_blt_progs;
+    glamor_program_fill poly_glyph_blt_atlas_progs;
+    struct glamor_glyph_blt_cache *glyph_blt_cache;
 
     /* glamor text shaders */
     glamor_program_fill poly_text_progs;
     glamor_program      te_text_prog;
     glamor_program      image_text_prog;
+    glamor_program      image_glyph_blt_prog;
 
     /* glamor copy shaders */
     glamor_program      copy_area_prog;
@@ -244,10 +291,22 @@ typedef struct glamor_screen_private {
     /* glamor segment shaders */
     glamor_program_fill poly_segment_program;
 
+    /* glamor wide line and segment shaders */
+    glamor_program_fill wide_tris_program;
+    glamor_program_fill wide_segment_program;
+    glamor_program_fill wide_round_program;
+
+    /* glamor arc and polygon shaders */
+    glamor_program_fill arc_program;
+    glamor_program_fill fill_polygon_program;
+
     /*  glamor dash line shader */
     glamor_program_fill on_off_dash_line_progs;
     glamor_program      double_dash_line_prog;
 
+    /* glamor trapezoid, triangle and addtraps shaders */
+    glamor_program_render       shape_program;
+
     /* glamor composite_glyphs shaders */
     glamor_program_render       glyphs_program;
     struct glamor_glyph_atlas   *glyph_atlas_a;
@@ -281,16 +340,20 @@ typedef struct glamor_screen_private {
 
     Bool has_source_coords, has_mask_coords;
     int render_nr_quads;
+    /* composites waiting to be drawn, see glamor_composite_flush() */
+    glamor_composite_batch render_batch;
+    struct shader_key render_batch_key;
+    float *render_batch_vertices;
+    int render_batch_quads;
     glamor_composite_shader composite_shader[SHADER_SOURCE_COUNT]
         [SHADER_MASK_COUNT]
         [glamor_program_alpha_count]
         [SHADER_DEST_SWIZZLE_COUNT];
 
-    /* glamor gradient, 0 for small nstops, 1 for
-       large nstops and 2 for dynamic generate. */
-    GLint gradient_prog[SHADER_GRADIENT_COUNT][3];
-    int linear_max_nstops;
-    int radial_max_nstops;
+    /* glamor gradient programs, and the color ramps they sample */
+    GLint gradient_prog[SHADER_GRADIENT_COUNT];
+    struct xorg_list gradient_ramps;
+    int gradient_ramp_count;
 
     int screen_fbo;
     struct glamor_saved_procs saved_procs;
@@ -303,6 +366,57 @@ typedef struct glamor_screen_private {
     Bool suppress_gl_out_of_memory_logging;
     Bool logged_any_fbo_allocation_failure;
 
+    /* glamor_fbo.c: pool of released fbos, ready for reuse */
+    struct xorg_list fbo_cache[GLAMOR_FBO_CACHE_FORMAT_COUNT]
+        [GLAMOR_FBO_CACHE_BUCKET_WCOUNT]
+        [GLAMOR_FBO_CACHE_BUCKET_HCOUNT];
+    /** All pooled fbos, most recently released first. */
+    struct xorg_list fbo_cache_lru;
+    /** Bytes of texture storage currently held by the pool. */
+    unsigned long fbo_cache_size;
+    /** Incremented once per block handler, drives pool expiry. */
+    unsigned int tick;
+    unsigned long fbo_cache_hits;
+    unsigned long fbo_cache_misses;
+
+    /* Render requests that still went through software */
+    unsigned long trapezoid_fallbacks;
+    unsigned long triangle_fallbacks;
+    unsigned long addtraps_fallbacks;
+
+    /** fbos with rendering that still needs a framebuffer resolve. */
+    struct xorg_list dirty_fbos;
+
+    /* glamor_dash.c: dash pattern textures, most recently used first */
+    struct xorg_list dash_cache;
+    int dash_cache_count;
+
+    /* glamor_picture.c: memory pixmap textures, most recently used first */
+    struct xorg_list shadows;
+    size_t shadow_size;
+    unsigned long shadow_hits;
+    unsigned long shadow_partial_uploads;
+    unsigned long shadow_full_uploads;
+
+    /* glamor_prepare_access staging buffers and transfer statistics */
+    glamor_pbo_slot pbo_ring[GLAMOR_PBO_RING_SIZE];
+    unsigned long prepare_count;
+    unsigned long long prepare_download_bytes;
+    unsigned long long prepare_upload_bytes;
+    unsigned long long prepare_usecs;
+
+    /* on-disk program binaries, see glamor_program_cache.c */
+    char *program_cache_dir;
+    uint64_t program_cache_seed;
+    Bool program_binary_oes;
+    unsigned long program_cache_hits;
+    unsigned long program_cache_misses;
+    unsigned long program_cache_stores;
+
+    /** scratch buffer for packing uploads, see glamor_upload_boxes */
+    uint8_t *upload_staging;
+    size_t upload_staging_size;
+
     /* xv */
     glamor_program xv_prog;
 
@@ -331,6 +445,20 @@ typedef struct glamor_pixmap_fbo {
     int height; /**< height in pixels */
     GLenum format; /**< GL format used to create the texture. */
     GLenum type; /**< GL type used to create the texture. */
+    /**
+     * Set when glamor allocated the texture itself, so it may be
+     * returned to the fbo pool instead of being deleted.
+     */
+    Bool recyclable;
+    struct xorg_list list; /**< entry in its pool bucket */
+    struct xorg_list lru; /**< entry in the screen-wide pool LRU */
+    unsigned int expire; /**< tick at which a pooled fbo is freed */
+    /**
+     * Set while rendering to the fbo may still sit unresolved in the
+     * driver's tile memory; see glamor_fbo_mark_dirty().
+     */
+    Bool dirty;
+    struct xorg_list dirty_link; /**< entry in dirty_fbos */
 } glamor_pixmap_fbo;
 
 typedef struct glamor_pixmap_clipped_regions {
@@ -351,10 +479,18 @@ typedef struct glamor_pixmap_private {
     /** current fbo's coords in the whole pixmap. */
     BoxRec box;
     GLuint pbo;
+    /** pbo_ring slot holding pbo, or -1 for a private buffer */
+    int pbo_slot;
     RegionRec prepare_region;
     Bool prepared;
     EGLImageKHR image;
     EGLClientBuffer buf;
+    /** shared client buffer import backing image and buf, if any */
+    struct glamor_hybris_import *hybris_import;
+    /** texture kept for a GLAMOR_MEMORY pixmap, see glamor_picture.c */
+    struct glamor_shadow *shadow;
+    /** GLAMOR_MEMORY pixmap has been uploaded for rendering before */
+    Bool uploaded;
 
     /** block width of this large pixmap. */
     int block_w;
@@ -499,10 +635,35 @@ glamor_pixmap_hcnt(glamor_pixmap_private *priv)
     for (box_index = 0; box_index < glamor_pixmap_hcnt(priv) *         \
              glamor_pixmap_wcnt(priv); box_index++)                    \
 
-/* GC private structure. Currently holds only any computed dash pixmap */
+/* A dash pattern texture, shared by every GC with the same dash list */
+
+typedef struct glamor_dash {
+    struct xorg_list    link;   /**< entry in the screen dash_cache */
+    int                 refcnt; /**< GCs using this pattern */
+    int                 ndash;
+    unsigned char       *dash;
+    PixmapPtr           pixmap;
+} glamor_dash;
+
+/*
+ * Texture copy of a GLAMOR_MEMORY pixmap used as a Render source or
+ * mask, brought up to date from the CPU bits through Damage.
+ */
+
+typedef struct glamor_shadow {
+    struct xorg_list    link;   /**< entry in the screen shadows list */
+    PixmapPtr           pixmap;
+    DamagePtr           damage; /**< CPU rendering not yet in the fbo */
+    glamor_pixmap_fbo   *fbo;
+    void                *bits;  /**< pixmap storage the fbo was loaded from */
+    PictFormatShort     format; /**< picture format the fbo was loaded as */
+    size_t              size;
+} glamor_shadow;
+
+/* GC private structure. Holds the dash pattern and stipple in use */
 
 typedef struct {
-    PixmapPtr   dash;
+    glamor_dash *dash;
     PixmapPtr   stipple;
     DamagePtr   stipple_damage;
 } glamor_gc_private;
@@ -557,6 +718,15 @@ glamor_pixmap_fbo *glamor_create_fbo(glamor_screen_private *glamor_priv, int w,
 void glamor_destroy_fbo(glamor_screen_private *glamor_priv,
                         glamor_pixmap_fbo *fbo);
 void glamor_pixmap_destroy_fbo(PixmapPtr pixmap);
+void glamor_init_pixmap_fbo(ScreenPtr screen);
+void glamor_fini_pixmap_fbo(ScreenPtr screen);
+void glamor_fbo_expire(glamor_screen_private *glamor_priv);
+void glamor_fbo_mark_dirty(glamor_screen_private *glamor_priv,
+                           glamor_pixmap_fbo *fbo);
+void glamor_fbo_resolve(glamor_screen_private *glamor_priv,
+                        glamor_pixmap_fbo *fbo);
+void glamor_pixmap_resolve(PixmapPtr pixmap);
+void glamor_resolve_dirty_fbos(glamor_screen_private *glamor_priv);
 Bool glamor_pixmap_fbo_fixup(ScreenPtr screen, PixmapPtr pixmap);
 
 /* Return whether 'picture' is alpha-only */
@@ -605,6 +775,15 @@ void glamor_link_glsl_prog(ScreenPtr screen, GLint prog,
 void glamor_get_color_4f_from_pixel(PixmapPtr pixmap,
                                     unsigned long fg_pixel, GLfloat *color);
 
+/* glamor_program_cache.c */
+void glamor_program_cache_init(ScreenPtr screen);
+void glamor_program_cache_fini(ScreenPtr screen);
+void glamor_program_cache_warmup(ScreenPtr screen);
+GLuint glamor_program_cache_load(ScreenPtr screen,
+                                 const char *vs_source, const char *fs_source);
+void glamor_program_cache_store(ScreenPtr screen, GLuint prog,
+                                const char *vs_source, const char *fs_source);
+
 int glamor_set_destination_pixmap(PixmapPtr pixmap);
 int glamor_set_destination_pixmap_priv(glamor_screen_private *glamor_priv, PixmapPtr pixmap, glamor_pixmap_private *pixmap_priv);
 void glamor_set_destination_pixmap_fbo(glamor_screen_private *glamor_priv, glamor_pixmap_fbo *, int, int, int, int);
@@ -622,6 +801,8 @@ void
 glamor_track_stipple(GCPtr gc);
 
 /* glamor_render.c */
+void glamor_composite_warmup(ScreenPtr screen);
+void glamor_composite_flush(glamor_screen_private *glamor_priv);
 Bool glamor_composite_clipped_region(CARD8 op,
                                      PicturePtr source,
                                      PicturePtr mask,
@@ -650,13 +831,162 @@ void glamor_composite_rects(CARD8 op,
                             xRenderColor *color, int nRect, xRectangle *rects);
 
 /* glamor_trapezoid.c */
+
+/**
+ * A trapezoid or triangle for the GPU coverage rasterizer: the pixels
+ * between edge 0 and edge 1 from top to bottom.  Edge x positions are
+ * taken at 'top'; edge 1 changes slope to dx2 at 'split'.
+ */
+typedef struct {
+    double top, bottom;
+    double x0, dx0;
+    double x1, dx1;
+    double split, dx2;
+} glamor_shape;
+
+Bool glamor_add_shapes(PicturePtr dst, int dx, int dy,
+                       int nshape, const glamor_shape *shapes);
+Bool glamor_composite_shapes(CARD8 op, PicturePtr src, PicturePtr dst,
+                             PictFormatPtr mask_format,
+                             INT16 x_src, INT16 y_src,
+                             int x_dst, int y_dst,
+                             int nshape, const glamor_shape *shapes);
+
 void glamor_trapezoids(CARD8 op,
                        PicturePtr src, PicturePtr dst,
                        PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
                        int ntrap, xTrapezoid *traps);
 
 /* glamor_gradient.c */
+
+/*
+ * Ramp lookup shared by all gradient programs, with t in [0, 1].
+ * Row 0 of the ramp holds the colors at the texel centers.  Where a
+ * hard stop falls between two centers, row 3 flags it (g) with its
+ * position in the interval (r), and rows 1 and 2 hold the colors
+ * just before and after it, so the edge stays exact instead of being
+ * smeared over a texel.  The ramp is sampled with GL_NEAREST.
+ */
+#define GLAMOR_GRADIENT_FS_RAMP                                         \
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"                               \
+    "precision highp float;\n"                                          \
+    "#endif\n"                                                          \
+    "uniform sampler2D gradient_ramp;\n"                                \
+    "uniform float gradient_ramp_width;\n"                              \
+    "vec4 gradient_ramp_texel(float i, float row)\n"                    \
+    "{\n"                                                               \
+    "    return texture2D(gradient_ramp,\n"                             \
+    "                     vec2((i + 0.5) / gradient_ramp_width,\n"      \
+    "                          (row + 0.5) / 4.0));\n"                  \
+    "}\n"                                                               \
+    "vec4 gradient_ramp_color(float t)\n"                               \
+    "{\n"                                                               \
+    "    float u = clamp(t, 0.0, 1.0) * (gradient_ramp_width - 1.0);\n" \
+    "    float i = min(floor(u), gradient_ramp_width - 2.0);\n"         \
+    "    float f = u - i;\n"                                            \
+    "    vec4 edge = gradient_ramp_texel(i, 3.0);\n"                    \
+    "    if (edge.g > 0.5) {\n"                                         \
+    "        if (f < edge.r)\n"                                         \
+    "            return mix(gradient_ramp_texel(i, 0.0),\n"             \
+    "                       gradient_ramp_texel(i, 1.0),\n"             \
+    "                       f / edge.r);\n"                             \
+    "        return mix(gradient_ramp_texel(i, 2.0),\n"                 \
+    "                   gradient_ramp_texel(i + 1.0, 0.0),\n"           \
+    "                   (f - edge.r) / (1.0 - edge.r));\n"              \
+    "    }\n"                                                           \
+    "    return mix(gradient_ramp_texel(i, 0.0),\n"                     \
+    "               gradient_ramp_texel(i + 1.0, 0.0), f);\n"           \
+    "}\n"
+
+/*
+ * Fragment shader code evaluating a gradient source, for programs
+ * that sample gradients directly.  Each defines
+ * vec4 gradient_color(vec2 pos), with pos in source picture space;
+ * glamor_gradient_use() loads the uniforms.  Repeat values are the
+ * Render ones: 0 none, 1 normal, 2 pad, 3 reflect.
+ */
+#define GLAMOR_GRADIENT_FS_COMMON                                       \
+    GLAMOR_GRADIENT_FS_RAMP                                             \
+    "uniform mat3 gradient_transform;\n"                                \
+    "uniform int gradient_repeat;\n"                                    \
+    "uniform vec4 gradient_p0;\n"                                       \
+    "uniform vec4 gradient_p1;\n"                                       \
+    "vec2 gradient_pos(vec2 pos)\n"                                     \
+    "{\n"                                                               \
+    "    vec3 p = gradient_transform * vec3(pos, 1.0);\n"               \
+    "    return p.xy / p.z;\n"                                          \
+    "}\n"                                                               \
+    "vec4 gradient_sample(float t)\n"                                   \
+    "{\n"                                                               \
+    "    if (gradient_repeat == 0) {\n"                                 \
+    "        if (t < 0.0 || t > 1.0)\n"                                 \
+    "            return vec4(0.0);\n"                                   \
+    "    } else if (gradient_repeat == 1)\n"                            \
+    "        t = fract(t);\n"                                           \
+    "    else if (gradient_repeat == 3)\n"                              \
+    "        t = 1.0 - abs(mod(t, 2.0) - 1.0);\n"                       \
+    "    return gradient_ramp_color(t);\n"                              \
+    "}\n"
+
+/* gradient_p0 is (dx, dy, -p1.d) / |d|^2 for d = p2 - p1 */
+#define GLAMOR_GRADIENT_FS_LINEAR                                       \
+    GLAMOR_GRADIENT_FS_COMMON                                           \
+    "vec4 gradient_color(vec2 pos)\n"                                   \
+    "{\n"                                                               \
+    "    return gradient_sample(dot(gradient_p0.xyz,\n"                 \
+    "                               vec3(gradient_pos(pos), 1.0)));\n"  \
+    "}\n"
+
+/*
+ * Two point radial gradient, solved the way pixman does it:
+ * gradient_p0 is (c1.x, c1.y, r1, r2 - r1) and gradient_p1 is
+ * (c2.x - c1.x, c2.y - c1.y, a, 0).
+ */
+#define GLAMOR_GRADIENT_FS_RADIAL                                       \
+    GLAMOR_GRADIENT_FS_COMMON                                           \
+    "vec4 gradient_color(vec2 pos)\n"                                   \
+    "{\n"                                                               \
+    "    vec2 pd = gradient_pos(pos) - gradient_p0.xy;\n"               \
+    "    float r1 = gradient_p0.z;\n"                                   \
+    "    float dr = gradient_p0.w;\n"                                   \
+    "    float a = gradient_p1.z;\n"                                    \
+    "    float b = dot(pd, gradient_p1.xy) + r1 * dr;\n"                \
+    "    float c = dot(pd, pd) - r1 * r1;\n"                            \
+    "    float t0, t1;\n"                                               \
+    "    if (a == 0.0) {\n"                                             \
+    "        if (b == 0.0)\n"                                           \
+    "            return vec4(0.0);\n"                                   \
+    "        t0 = 0.5 * c / b;\n"                                       \
+    "        t1 = t0;\n"                                                \
+    "    } else {\n"                                                    \
+    "        float discr = b * b - a * c;\n"                            \
+    "        if (discr < 0.0)\n"                                        \
+    "            return vec4(0.0);\n"                                   \
+    "        discr = sqrt(discr);\n"                                    \
+    "        t0 = (b + discr) / a;\n"                                   \
+    "        t1 = (b - discr) / a;\n"                                   \
+    "    }\n"                                                           \
+    "    if (gradient_repeat == 0) {\n"                                 \
+    "        if (t0 >= 0.0 && t0 <= 1.0)\n"                             \
+    "            return gradient_sample(t0);\n"                         \
+    "        if (t1 >= 0.0 && t1 <= 1.0)\n"                             \
+    "            return gradient_sample(t1);\n"                         \
+    "    } else {\n"                                                    \
+    "        if (r1 + t0 * dr >= 0.0)\n"                                \
+    "            return gradient_sample(t0);\n"                         \
+    "        if (r1 + t1 * dr >= 0.0)\n"                                \
+    "            return gradient_sample(t1);\n"                         \
+    "    }\n"                                                           \
+    "    return vec4(0.0);\n"                                           \
+    "}\n"
+
 void glamor_init_gradient_shader(ScreenPtr screen);
+void glamor_fini_gradient_shader(ScreenPtr screen);
+GLuint glamor_gradient_get_ramp(ScreenPtr screen, PicturePtr picture);
+void glamor_gradient_get_uniforms(GLuint prog,
+                                  glamor_gradient_uniforms *uniforms);
+Bool glamor_gradient_use(ScreenPtr screen, PicturePtr picture,
+                         const glamor_gradient_uniforms *uniforms);
 PicturePtr glamor_generate_linear_gradient_picture(ScreenPtr screen,
                                                    PicturePtr src_picture,
                                                    int x_source, int y_source,
@@ -733,6 +1063,14 @@ Bool glamor_composite_largepixmap_region(CARD8 op,
  **/
 Bool glamor_upload_picture_to_texture(PicturePtr picture);
 
+void glamor_release_picture_texture(PixmapPtr pixmap);
+
+void glamor_shadow_init(ScreenPtr screen);
+
+void glamor_shadow_fini(ScreenPtr screen);
+
+void glamor_shadow_destroy_pixmap(PixmapPtr pixmap);
+
 void glamor_add_traps(PicturePtr pPicture,
                       INT16 x_off, INT16 y_off, int ntrap, xTrap *traps);
 
@@ -768,6 +1106,10 @@ void
 glamor_poly_fill_rect(DrawablePtr drawable,
                       GCPtr gc, int nrect, xRectangle *prect);
 
+void
+glamor_poly_rectangle(DrawablePtr drawable,
+                      GCPtr gc, int nrect, xRectangle *prect);
+
 /* glamor_image.c */
 void
 glamor_put_image(DrawablePtr drawable, GCPtr gc, int depth, int x, int y,
@@ -778,6 +1120,15 @@ glamor_get_image(DrawablePtr pDrawable, int x, int y, int w, int h,
                  unsigned int format, unsigned long planeMask, char *d);
 
 /* glamor_dash.c */
+void
+glamor_dash_init(ScreenPtr screen);
+
+void
+glamor_dash_fini(ScreenPtr screen);
+
+void
+glamor_dash_release(ScreenPtr screen, glamor_dash *dash);
+
 Bool
 glamor_poly_lines_dash_gl(DrawablePtr drawable, GCPtr gc,
                           int mode, int n, DDXPointPtr points);
@@ -786,6 +1137,27 @@ Bool
 glamor_poly_segment_dash_gl(DrawablePtr drawable, GCPtr gc,
                             int nseg, xSegment *segs);
 
+/* glamor_wide_lines.c */
+Bool
+glamor_poly_lines_wide_gl(DrawablePtr drawable, GCPtr gc,
+                          int mode, int n, DDXPointPtr points);
+
+Bool
+glamor_poly_segment_wide_gl(DrawablePtr drawable, GCPtr gc,
+                            int nseg, xSegment *segs);
+
+/* glamor_arcs.c */
+void
+glamor_poly_arc(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs);
+
+void
+glamor_poly_fill_arc(DrawablePtr drawable, GCPtr gc, int narcs, xArc *arcs);
+
+/* glamor_polygon.c */
+void
+glamor_fill_polygon(DrawablePtr drawable, GCPtr gc,
+                    int shape, int mode, int n, DDXPointPtr points);
+
 /* glamor_lines.c */
 void
 glamor_poly_lines(DrawablePtr drawable, GCPtr gc,
@@ -819,6 +1191,9 @@ glamor_copy_plane(DrawablePtr src, DrawablePtr dst, GCPtr gc,
                   int srcx, int srcy, int width, int height, int dstx, int dsty,
                   unsigned long bitplane);
 
+void
+glamor_copy_warmup(ScreenPtr screen);
+
 /* glamor_glyphblt.c */
 void glamor_image_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
                             int x, int y, unsigned int nglyph,
@@ -828,6 +1203,10 @@ void glamor_poly_glyph_blt(DrawablePtr pDrawable, GCPtr pGC,
                            int x, int y, unsigned int nglyph,
                            CharInfoPtr *ppci, void *pglyphBase);
 
+void glamor_glyph_blt_font_gone(ScreenPtr screen, FontPtr font);
+
+void glamor_glyph_blt_fini(ScreenPtr screen);
+
 void glamor_push_pixels(GCPtr pGC, PixmapPtr pBitmap,
                         DrawablePtr pDrawable, int w, int h, int x, int y);
 
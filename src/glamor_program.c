@@ -185,8 +185,31 @@ fs_location_vars(glamor_program_location locations)
     return vars;
 }
 
+/*
+ * Programs are written in desktop GLSL 1.20/1.30. On an ES 3.0
+ * context, 1.30 programs are compiled as GLSL ES 3.00, with the
+ * removed 1.20 spellings mapped onto their replacements and a single
+ * fragment output standing in for gl_FragColor.
+ */
+static const char vs_dialect_es3[] =
+    "#define attribute in\n"
+    "#define varying out\n";
+
+static const char fs_dialect_es3[] =
+    "precision highp float;\n"
+    "precision mediump usampler2D;\n"
+    "#define varying in\n"
+    "#define texture2D texture\n"
+    "out vec4 frag_color;\n"
+    "#define gl_FragColor frag_color\n";
+
+static const char fs_dialect_dual_blend[] =
+    "out vec4 color0;\n"
+    "out vec4 color1;\n";
+
 static const char vs_template[] =
     "%s"                                /* version */
+    "%s"                                /* dialect */
     "%s"                                /* defines */
     "%s"                                /* prim vs_vars */
     "%s"                                /* fill vs_vars */
@@ -200,6 +223,7 @@ static const char vs_template[] =
 static const char fs_template[] =
     "%s"                                /* version */
     GLAMOR_DEFAULT_PRECISION
+    "%s"                                /* dialect */
     "%s"                                /* defines */
     "%s"                                /* prim fs_vars */
     "%s"                                /* fill fs_vars */
@@ -218,6 +242,14 @@ str(const char *s)
     return s;
 }
 
+static const char *
+glamor_program_tier(glamor_screen_private *glamor_priv, int version)
+{
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP)
+        return version >= 130 ? "1.30" : "1.20";
+    return version >= 130 ? "ES 3.00" : "ES 1.00";
+}
+
 static const glamor_facet facet_null_fill = {
     .name = ""
 };
@@ -254,6 +286,8 @@ glamor_build_program(ScreenPtr          screen,
 
     int                         version = prim->version;
     char                        *version_string = NULL;
+    const char                  *vs_dialect = NULL;
+    const char                  *fs_dialect = NULL;
 
     char                        *fs_vars = NULL;
     char                        *vs_vars = NULL;
@@ -281,16 +315,30 @@ glamor_build_program(ScreenPtr          screen,
     if (!fs_vars)
         goto fail;
 
-    if (version) {
+    if (version >= 130 && glamor_priv->has_glsl_es3) {
+        version_string = strdup("#version 300 es\n");
+        if (!version_string)
+            goto fail;
+        vs_dialect = vs_dialect_es3;
+        fs_dialect = fs_dialect_es3;
+    } else if (version) {
         if (asprintf(&version_string, "#version %d\n", version) < 0)
             version_string = NULL;
         if (!version_string)
             goto fail;
     }
 
+    if (prog->alpha == glamor_program_alpha_dual_blend) {
+        /* The ES 3.00 dialect only has the one fragment output */
+        if (fs_dialect == fs_dialect_es3)
+            goto fail;
+        fs_dialect = fs_dialect_dual_blend;
+    }
+
     if (asprintf(&vs_prog_string,
                  vs_template,
                  str(version_string),
+                 str(vs_dialect),
                  str(defines),
                  str(prim->vs_vars),
                  str(fill->vs_vars),
@@ -302,6 +350,7 @@ glamor_build_program(ScreenPtr          screen,
     if (asprintf(&fs_prog_string,
                  fs_template,
                  str(version_string),
+                 str(fs_dialect),
                  str(defines),
                  str(prim->fs_vars),
                  str(fill->fs_vars),
@@ -314,10 +363,9 @@ glamor_build_program(ScreenPtr          screen,
     if (!vs_prog_string || !fs_prog_string)
         goto fail;
 
-    prog->prog = glCreateProgram();
 #if DBG
-    ErrorF("\n\tProgram %d for %s %s\n\tVertex shader:\n\n\t================\n%s\n\n\tFragment Shader:\n\n%s\t================\n",
-           prog->prog, prim->name, fill->name, vs_prog_string, fs_prog_string);
+    ErrorF("\n\tProgram for %s %s\n\tVertex shader:\n\n\t================\n%s\n\n\tFragment Shader:\n\n%s\t================\n",
+           prim->name, fill->name, vs_prog_string, fs_prog_string);
 #endif
 
     prog->flags = flags;
@@ -327,10 +375,19 @@ glamor_build_program(ScreenPtr          screen,
     prog->fill_use = fill->use;
     prog->fill_use_render = fill->use_render;
 
+    prog->prog = glamor_program_cache_load(screen, vs_prog_string, fs_prog_string);
+    if (prog->prog) {
+        free(vs_prog_string);
+        free(fs_prog_string);
+        LogMessageVerb(X_INFO, 3, "glamor%d: loaded %s_%s as GLSL %s\n",
+                       screen->myNum, prim->name, fill->name,
+                       glamor_program_tier(glamor_priv, version));
+        goto uniforms;
+    }
+
+    prog->prog = glCreateProgram();
     vs_prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, vs_prog_string);
     fs_prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, fs_prog_string);
-    free(vs_prog_string);
-    free(fs_prog_string);
     glAttachShader(prog->prog, vs_prog);
     glDeleteShader(vs_prog);
     glAttachShader(prog->prog, fs_prog);
@@ -343,13 +400,22 @@ glamor_build_program(ScreenPtr          screen,
 #endif
         glBindAttribLocation(prog->prog, GLAMOR_VERTEX_SOURCE, prim->source_name);
     }
+    if (prim->mask_name)
+        glBindAttribLocation(prog->prog, GLAMOR_VERTEX_MASK, prim->mask_name);
     if (prog->alpha == glamor_program_alpha_dual_blend) {
         glBindFragDataLocationIndexed(prog->prog, 0, 0, "color0");
         glBindFragDataLocationIndexed(prog->prog, 0, 1, "color1");
     }
 
     glamor_link_glsl_prog(screen, prog->prog, "%s_%s", prim->name, fill->name);
+    glamor_program_cache_store(screen, prog->prog, vs_prog_string, fs_prog_string);
+    free(vs_prog_string);
+    free(fs_prog_string);
+    LogMessageVerb(X_INFO, 3, "glamor%d: built %s_%s as GLSL %s\n",
+                   screen->myNum, prim->name, fill->name,
+                   glamor_program_tier(glamor_priv, version));
 
+uniforms:
     prog->matrix_uniform = glamor_get_uniform(prog, glamor_program_location_none, "v_matrix");
     prog->fg_uniform = glamor_get_uniform(prog, glamor_program_location_fg, "fg");
     prog->bg_uniform = glamor_get_uniform(prog, glamor_program_location_bg, "bg");
@@ -361,6 +427,18 @@ glamor_build_program(ScreenPtr          screen,
     prog->dash_uniform = glamor_get_uniform(prog, glamor_program_location_dash, "dash");
     prog->dash_length_uniform = glamor_get_uniform(prog, glamor_program_location_dash, "dash_length");
     prog->atlas_uniform = glamor_get_uniform(prog, glamor_program_location_atlas, "atlas");
+    prog->source_transform_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_transform");
+    prog->source_box_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_box");
+    prog->source_size_inv_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_size_inv");
+    prog->source_repeat_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_repeat");
+    prog->source_alpha_map_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_alpha_map");
+    prog->source_alpha_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "source_alpha");
+    prog->alpha_box_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "alpha_box");
+    prog->alpha_pixmap_uniform = glamor_get_uniform(prog, glamor_program_location_fillpos, "alpha_pixmap");
+#ifdef GLAMOR_GRADIENT_SHADER
+    if (prog->locations & glamor_program_location_fillpos)
+        glamor_gradient_get_uniforms(prog->prog, &prog->gradient_uniforms);
+#endif
 
     free(version_string);
     free(fs_vars);
@@ -560,10 +638,181 @@ static const glamor_facet glamor_source_1x1_picture = {
     .use_render = use_source_1x1_picture,
 };
 
+static void
+glamor_set_picture_filter(PicturePtr picture)
+{
+    switch (picture->filter) {
+    default:
+    case PictFilterFast:
+    case PictFilterNearest:
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        break;
+    case PictFilterGood:
+    case PictFilterBest:
+    case PictFilterBilinear:
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        break;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static Bool
+use_source_fetch(CARD8 op, PicturePtr src, PicturePtr dst, glamor_program *prog)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(dst->pDrawable->pScreen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(src->pDrawable);
+    GLfloat transform[9];
+    int off_x, off_y;
+    int i, j;
+
+    glamor_set_blend(op, prog->alpha, dst);
+
+    if (!glamor_set_texture_pixmap(pixmap, glamor_picture_red_is_alpha(dst)))
+        return FALSE;
+    glamor_set_picture_filter(src);
+
+    /* GL wants the matrix column major */
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            if (src->transform)
+                transform[j * 3 + i] = xFixedToFloat(src->transform->matrix[i][j]);
+            else
+                transform[j * 3 + i] = i == j;
+        }
+    }
+
+    /* Where the source drawable's origin sits in its pixmap */
+    glamor_get_drawable_deltas(src->pDrawable, pixmap, &off_x, &off_y);
+    off_x += src->pDrawable->x;
+    off_y += src->pDrawable->y;
+
+    glUniform2f(prog->fill_offset_uniform, 0, 0);
+    glUniformMatrix3fv(prog->source_transform_uniform, 1, GL_FALSE, transform);
+    glUniform4f(prog->source_box_uniform,
+                off_x, off_y, src->pDrawable->width, src->pDrawable->height);
+    glUniform2f(prog->source_size_inv_uniform,
+                1.0f / pixmap->drawable.width, 1.0f / pixmap->drawable.height);
+    glUniform1i(prog->source_repeat_uniform, src->repeatType);
+    glUniform1i(prog->source_alpha_map_uniform, src->alphaMap != NULL);
+
+    if (src->alphaMap) {
+        PicturePtr alpha = src->alphaMap;
+        PixmapPtr alpha_pixmap = glamor_get_drawable_pixmap(alpha->pDrawable);
+        glamor_pixmap_private *alpha_priv = glamor_get_pixmap_private(alpha_pixmap);
+
+        glamor_get_drawable_deltas(alpha->pDrawable, alpha_pixmap,
+                                   &off_x, &off_y);
+
+        glamor_bind_texture(glamor_priv, GL_TEXTURE2, alpha_priv->fbo, FALSE);
+        glamor_set_picture_filter(alpha);
+        glUniform1i(prog->source_alpha_uniform, 2);
+        glUniform4f(prog->alpha_box_uniform,
+                    src->alphaOrigin.x, src->alphaOrigin.y,
+                    alpha->pDrawable->width, alpha->pDrawable->height);
+        glUniform4f(prog->alpha_pixmap_uniform,
+                    off_x, off_y,
+                    1.0f / alpha_pixmap->drawable.width,
+                    1.0f / alpha_pixmap->drawable.height);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    return TRUE;
+}
+
+/*
+ * The general picture source: fill_pos is in source picture space,
+ * and the transform, repeat mode and alpha map are applied per
+ * fragment, the way pixman fetches them.  Repeat values are the
+ * Render ones: 0 none, 1 normal, 2 pad, 3 reflect.
+ */
+static const glamor_facet glamor_source_fetch = {
+    .name = "render_fetch",
+    .vs_exec =  "       fill_pos = fill_offset + primitive.xy + pos;\n",
+    .fs_vars = ("#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+                "precision highp float;\n"
+                "#endif\n"
+                "uniform sampler2D source_sampler;\n"
+                "uniform mat3 source_transform;\n"
+                "uniform vec4 source_box;\n"
+                "uniform vec2 source_size_inv;\n"
+                "uniform int source_repeat;\n"
+                "uniform int source_alpha_map;\n"
+                "uniform sampler2D source_alpha;\n"
+                "uniform vec4 alpha_box;\n"
+                "uniform vec4 alpha_pixmap;\n"
+                "vec4 source_fetch(vec2 pos)\n"
+                "{\n"
+                "       vec3 t = source_transform * vec3(pos, 1.0);\n"
+                "       vec2 size = source_box.zw;\n"
+                "       vec2 p = t.xy / t.z;\n"
+                "       vec4 color;\n"
+                "       if (source_repeat == 0) {\n"
+                "               if (any(lessThan(p, vec2(0.0))) ||\n"
+                "                   any(greaterThanEqual(p, size)))\n"
+                "                       return vec4(0.0);\n"
+                "       } else if (source_repeat == 1)\n"
+                "               p = mod(p, size);\n"
+                "       else if (source_repeat == 2)\n"
+                "               p = clamp(p, vec2(0.5), size - vec2(0.5));\n"
+                "       else\n"
+                "               p = size - abs(mod(p, 2.0 * size) - size);\n"
+                "       color = texture2D(source_sampler, (source_box.xy + p) * source_size_inv);\n"
+                "       if (source_alpha_map != 0) {\n"
+                "               vec2 a = p - alpha_box.xy;\n"
+                "               if (any(lessThan(a, vec2(0.0))) ||\n"
+                "                   any(greaterThanEqual(a, alpha_box.zw)))\n"
+                "                       color.a = 0.0;\n"
+                "               else\n"
+                "                       color.a = texture2D(source_alpha, (alpha_pixmap.xy + a) * alpha_pixmap.zw).a;\n"
+                "       }\n"
+                "       return color;\n"
+                "}\n"),
+    .fs_exec =  "       vec4 source = source_fetch(fill_pos);\n",
+    .locations = glamor_program_location_fillpos,
+    .use_render = use_source_fetch,
+};
+
+#ifdef GLAMOR_GRADIENT_SHADER
+static Bool
+use_source_gradient(CARD8 op, PicturePtr src, PicturePtr dst, glamor_program *prog)
+{
+    glamor_set_blend(op, prog->alpha, dst);
+
+    glUniform2f(prog->fill_offset_uniform, 0, 0);
+    return glamor_gradient_use(dst->pDrawable->pScreen, src,
+                               &prog->gradient_uniforms);
+}
+
+static const glamor_facet glamor_source_linear = {
+    .name = "render_linear",
+    .vs_exec =  "       fill_pos = fill_offset + primitive.xy + pos;\n",
+    .fs_vars = GLAMOR_GRADIENT_FS_LINEAR,
+    .fs_exec =  "       vec4 source = gradient_color(fill_pos);\n",
+    .locations = glamor_program_location_fillpos,
+    .use_render = use_source_gradient,
+};
+
+static const glamor_facet glamor_source_radial = {
+    .name = "render_radial",
+    .vs_exec =  "       fill_pos = fill_offset + primitive.xy + pos;\n",
+    .fs_vars = GLAMOR_GRADIENT_FS_RADIAL,
+    .fs_exec =  "       vec4 source = gradient_color(fill_pos);\n",
+    .locations = glamor_program_location_fillpos,
+    .use_render = use_source_gradient,
+};
+#endif
+
 static const glamor_facet *glamor_facet_source[glamor_program_source_count] = {
     [glamor_program_source_solid] = &glamor_source_solid,
     [glamor_program_source_picture] = &glamor_source_picture,
     [glamor_program_source_1x1_picture] = &glamor_source_1x1_picture,
+    [glamor_program_source_fetch] = &glamor_source_fetch,
+#ifdef GLAMOR_GRADIENT_SHADER
+    [glamor_program_source_linear] = &glamor_source_linear,
+    [glamor_program_source_radial] = &glamor_source_radial,
+#endif
 };
 
 static const char *glamor_combine[] = {
@@ -614,7 +863,7 @@ glamor_setup_program_render(CARD8                 op,
     glamor_program_source       source_type;
     glamor_program              *prog;
 
-    if (op > ARRAY_SIZE(composite_op_info))
+    if (op >= ARRAY_SIZE(composite_op_info))
         return NULL;
 
     if (glamor_is_component_alpha(mask)) {
@@ -632,14 +881,32 @@ glamor_setup_program_render(CARD8                 op,
 
     if (src->pDrawable) {
 
-        /* Can't do transforms, alphamaps or sourcing from non-pixmaps yet */
-        if (src->transform || src->alphaMap || src->pDrawable->type != DRAWABLE_PIXMAP)
+        if (src->filter >= PictFilterConvolution)
             return NULL;
 
-        if (src->pDrawable->width == 1 && src->pDrawable->height == 1 && src->repeat)
+        if (src->alphaMap) {
+            PicturePtr alpha_map = src->alphaMap;
+            glamor_pixmap_private *alpha_priv;
+
+            /* The alpha map replaces the alpha channel, which a GL_RED
+             * destination doesn't sample from.
+             */
+            if (!alpha_map->pDrawable || glamor_picture_red_is_alpha(dst))
+                return NULL;
+            alpha_priv = glamor_get_pixmap_private(glamor_get_drawable_pixmap(alpha_map->pDrawable));
+            if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(alpha_priv) ||
+                glamor_pixmap_priv_is_large(alpha_priv))
+                return NULL;
+        }
+
+        if (src->pDrawable->width == 1 && src->pDrawable->height == 1 && src->repeat &&
+            !src->transform && !src->alphaMap &&
+            src->pDrawable->type == DRAWABLE_PIXMAP)
             source_type = glamor_program_source_1x1_picture;
-        else
+        else if (glamor_picture_is_plain(src))
             source_type = glamor_program_source_picture;
+        else
+            source_type = glamor_program_source_fetch;
     } else {
         SourcePictPtr   sp = src->pSourcePict;
         if (!sp)
@@ -648,6 +915,16 @@ glamor_setup_program_render(CARD8                 op,
         case SourcePictTypeSolidFill:
             source_type = glamor_program_source_solid;
             break;
+        case SourcePictTypeLinear:
+            if (src->alphaMap)
+                return NULL;
+            source_type = glamor_program_source_linear;
+            break;
+        case SourcePictTypeRadial:
+            if (src->alphaMap)
+                return NULL;
+            source_type = glamor_program_source_radial;
+            break;
         default:
             return NULL;
         }
@@ -65,10 +65,21 @@ typedef struct {
     const glamor_program_location       locations;
     const glamor_program_flag           flags;
     const char                          *source_name;
+    const char                          *mask_name;
     glamor_use                          use;
     glamor_use_render                   use_render;
 } glamor_facet;
 
+/* Uniforms of the gradient shader code, see glamor_gradient_use() */
+typedef struct {
+    GLint                       ramp;
+    GLint                       ramp_width;
+    GLint                       transform;
+    GLint                       repeat;
+    GLint                       p0;
+    GLint                       p1;
+} glamor_gradient_uniforms;
+
 struct _glamor_program {
     GLint                       prog;
     GLint                       failed;
@@ -83,6 +94,15 @@ struct _glamor_program {
     GLint                       dash_uniform;
     GLint                       dash_length_uniform;
     GLint                       atlas_uniform;
+    GLint                       source_transform_uniform;
+    GLint                       source_box_uniform;
+    GLint                       source_size_inv_uniform;
+    GLint                       source_repeat_uniform;
+    GLint                       source_alpha_map_uniform;
+    GLint                       source_alpha_uniform;
+    GLint                       alpha_box_uniform;
+    GLint                       alpha_pixmap_uniform;
+    glamor_gradient_uniforms    gradient_uniforms;
     glamor_program_location     locations;
     glamor_program_flag         flags;
     glamor_use                  prim_use;
@@ -122,6 +142,9 @@ typedef enum {
     glamor_program_source_solid,
     glamor_program_source_picture,
     glamor_program_source_1x1_picture,
+    glamor_program_source_fetch,
+    glamor_program_source_linear,
+    glamor_program_source_radial,
     glamor_program_source_count,
 } glamor_program_source;
 
@@ -129,6 +152,19 @@ typedef struct {
     glamor_program      progs[glamor_program_source_count][glamor_program_alpha_count];
 } glamor_program_render;
 
+/*
+ * Pixmap sources the plain picture facet samples directly.  Other
+ * sources with a drawable go through glamor_program_source_fetch,
+ * which applies the transform, repeat and alpha map in the shader.
+ */
+static inline Bool
+glamor_picture_is_plain(PicturePtr picture)
+{
+    return !picture->transform && !picture->alphaMap &&
+        picture->repeatType == RepeatNone &&
+        picture->pDrawable->type == DRAWABLE_PIXMAP;
+}
+
 static inline Bool
 glamor_is_component_alpha(PicturePtr mask) {
     if (mask && mask->componentAlpha && PICT_FORMAT_RGB(mask->format))
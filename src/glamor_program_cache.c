@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Linked program binaries are kept on disk so that a server restart
+ * doesn't have to run the shader compiler again.  Each entry is keyed
+ * by the GL vendor, renderer and version strings together with the
+ * vertex and fragment source, so a driver update or a change to the
+ * generated GLSL simply misses and writes a new entry.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "glamor_priv.h"
+
+#define GLAMOR_PROGRAM_CACHE_MAGIC      0x676c7063      /* 'glpc' */
+#define GLAMOR_PROGRAM_CACHE_VERSION    1
+
+typedef struct {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    key;
+    uint32_t    vs_len;
+    uint32_t    fs_len;
+    uint32_t    format;
+    uint32_t    length;
+} glamor_program_cache_header;
+
+static uint64_t
+glamor_program_cache_hash(uint64_t hash, const char *s, size_t len)
+{
+    /* FNV-1a */
+    while (len--) {
+        hash ^= (uint8_t) *s++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t
+glamor_program_cache_hash_str(uint64_t hash, const char *s)
+{
+    if (!s)
+        s = "";
+    /* Include the terminator so "ab" "c" and "a" "bc" differ */
+    return glamor_program_cache_hash(hash, s, strlen(s) + 1);
+}
+
+static char *
+glamor_program_cache_path(glamor_screen_private *glamor_priv,
+                          uint64_t key, const char *suffix)
+{
+    char *path;
+
+    if (asprintf(&path, "%s/%016llx%s", glamor_priv->program_cache_dir,
+                 (unsigned long long) key, suffix) < 0)
+        return NULL;
+    return path;
+}
+
+static char *
+glamor_program_cache_find_dir(void)
+{
+    const char *env;
+    char *dir = NULL;
+
+    /* Don't let the environment pick where a privileged server
+     * writes files.
+     */
+    if (PrivsElevated())
+        return NULL;
+
+    if (getenv("GLAMOR_NO_PROGRAM_CACHE"))
+        return NULL;
+
+    if ((env = getenv("GLAMOR_PROGRAM_CACHE_DIR")) && *env)
+        dir = strdup(env);
+    else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+        if (asprintf(&dir, "%s/glamor", env) < 0)
+            dir = NULL;
+    } else if ((env = getenv("HOME")) && *env) {
+        char *cache;
+
+        if (asprintf(&cache, "%s/.cache", env) < 0)
+            return NULL;
+        mkdir(cache, 0700);
+        if (asprintf(&dir, "%s/glamor", cache) < 0)
+            dir = NULL;
+        free(cache);
+    }
+
+    if (!dir)
+        return NULL;
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+void
+glamor_program_cache_init(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    int gl_version = epoxy_gl_version();
+    GLint formats = 0;
+    uint64_t seed;
+
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP) {
+        if (gl_version < 41 &&
+            !epoxy_has_gl_extension("GL_ARB_get_program_binary"))
+            return;
+    } else if (gl_version < 30) {
+        if (!epoxy_has_gl_extension("GL_OES_get_program_binary"))
+            return;
+        glamor_priv->program_binary_oes = TRUE;
+    }
+
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+        return;
+
+    glamor_priv->program_cache_dir = glamor_program_cache_find_dir();
+    if (!glamor_priv->program_cache_dir)
+        return;
+
+    seed = 0xcbf29ce484222325ULL;
+    seed = glamor_program_cache_hash_str(seed,
+                                         (const char *) glGetString(GL_VENDOR));
+    seed = glamor_program_cache_hash_str(seed,
+                                         (const char *) glGetString(GL_RENDERER));
+    seed = glamor_program_cache_hash_str(seed,
+                                         (const char *) glGetString(GL_VERSION));
+    glamor_priv->program_cache_seed = seed;
+
+    LogMessageVerb(X_INFO, 3, "glamor%d: program cache in %s\n",
+                   screen->myNum, glamor_priv->program_cache_dir);
+}
+
+static uint64_t
+glamor_program_cache_key(glamor_screen_private *glamor_priv,
+                         const char *vs_source, const char *fs_source)
+{
+    uint64_t key = glamor_priv->program_cache_seed;
+
+    key = glamor_program_cache_hash_str(key, vs_source);
+    key = glamor_program_cache_hash_str(key, fs_source);
+    return key;
+}
+
+/*
+ * Look for a binary built from this source.  Returns a linked program,
+ * or 0 if the caller needs to compile it.
+ */
+GLuint
+glamor_program_cache_load(ScreenPtr screen,
+                          const char *vs_source, const char *fs_source)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_program_cache_header header;
+    uint64_t key;
+    char *path;
+    void *binary = NULL;
+    GLuint prog = 0;
+    GLint ok = 0;
+    int fd;
+
+    if (!glamor_priv->program_cache_dir)
+        return 0;
+
+    key = glamor_program_cache_key(glamor_priv, vs_source, fs_source);
+    path = glamor_program_cache_path(glamor_priv, key, ".bin");
+    if (!path)
+        return 0;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        goto miss;
+
+    if (read(fd, &header, sizeof (header)) != sizeof (header) ||
+        header.magic != GLAMOR_PROGRAM_CACHE_MAGIC ||
+        header.version != GLAMOR_PROGRAM_CACHE_VERSION ||
+        header.key != key ||
+        header.vs_len != strlen(vs_source) ||
+        header.fs_len != strlen(fs_source) ||
+        header.length == 0)
+        goto miss;
+
+    binary = malloc(header.length);
+    if (!binary ||
+        read(fd, binary, header.length) != (ssize_t) header.length)
+        goto miss;
+
+    prog = glCreateProgram();
+    if (glamor_priv->program_binary_oes)
+        glProgramBinaryOES(prog, header.format, binary, header.length);
+    else
+        glProgramBinary(prog, header.format, binary, header.length);
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        /* Usually a driver update that kept its version string */
+        glDeleteProgram(prog);
+        prog = 0;
+        goto miss;
+    }
+
+    close(fd);
+    free(binary);
+    glamor_priv->program_cache_hits++;
+    return prog;
+
+miss:
+    if (fd >= 0)
+        close(fd);
+    free(binary);
+    glamor_priv->program_cache_misses++;
+    return 0;
+}
+
+/*
+ * Save the binary of a freshly linked program.  The entry is written
+ * to a temporary file and renamed into place so a concurrent server
+ * never sees a partial binary.
+ */
+void
+glamor_program_cache_store(ScreenPtr screen, GLuint prog,
+                           const char *vs_source, const char *fs_source)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_program_cache_header header;
+    char *path = NULL, *tmp = NULL;
+    void *binary = NULL;
+    GLint length = 0;
+    GLenum format;
+    int fd;
+
+    if (!glamor_priv->program_cache_dir)
+        return;
+
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    binary = malloc(length);
+    if (!binary)
+        return;
+
+    if (glamor_priv->program_binary_oes)
+        glGetProgramBinaryOES(prog, length, &length, &format, binary);
+    else
+        glGetProgramBinary(prog, length, &length, &format, binary);
+    if (length <= 0)
+        goto out;
+
+    header.magic = GLAMOR_PROGRAM_CACHE_MAGIC;
+    header.version = GLAMOR_PROGRAM_CACHE_VERSION;
+    header.key = glamor_program_cache_key(glamor_priv, vs_source, fs_source);
+    header.vs_len = strlen(vs_source);
+    header.fs_len = strlen(fs_source);
+    header.format = format;
+    header.length = length;
+
+    path = glamor_program_cache_path(glamor_priv, header.key, ".bin");
+    if (!path)
+        goto out;
+    if (asprintf(&tmp, "%s.%d", path, (int) getpid()) < 0) {
+        tmp = NULL;
+        goto out;
+    }
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        goto out;
+
+    if (write(fd, &header, sizeof (header)) != sizeof (header) ||
+        write(fd, binary, length) != length) {
+        close(fd);
+        unlink(tmp);
+        goto out;
+    }
+    if (close(fd) < 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        goto out;
+    }
+    glamor_priv->program_cache_stores++;
+
+out:
+    free(tmp);
+    free(path);
+    free(binary);
+}
+
+/*
+ * Build the programs nearly every session ends up using, so that
+ * their compile (or cache load) happens at startup rather than in the
+ * middle of the first frames.
+ */
+void
+glamor_program_cache_warmup(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    CARD64 start = GetTimeInMicros();
+
+    glamor_make_current(glamor_priv);
+    glamor_copy_warmup(screen);
+    glamor_composite_warmup(screen);
+
+    LogMessageVerb(X_INFO, 3, "glamor%d: program warm-up took %llu us\n",
+                   screen->myNum,
+                   (unsigned long long) (GetTimeInMicros() - start));
+}
+
+void
+glamor_program_cache_fini(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+
+    if (!glamor_priv->program_cache_dir)
+        return;
+
+    LogMessageVerb(X_INFO, 3,
+                   "glamor%d: program cache %lu hits, %lu misses, %lu stored\n",
+                   screen->myNum, glamor_priv->program_cache_hits,
+                   glamor_priv->program_cache_misses,
+                   glamor_priv->program_cache_stores);
+    free(glamor_priv->program_cache_dir);
+    glamor_priv->program_cache_dir = NULL;
+}
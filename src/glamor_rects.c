@@ -164,3 +164,91 @@ glamor_poly_fill_rect(DrawablePtr drawable,
         return;
     glamor_poly_fill_rect_bail(drawable, gc, nrect, prect);
 }
+
+/*
+ * Solid rectangle outlines with miter joins are just boxes; turn all
+ * of them into one PolyFillRect.  The boxes for each rectangle don't
+ * overlap, so any raster op works.
+ */
+static Bool
+glamor_poly_rectangle_gl(DrawablePtr drawable,
+                         GCPtr gc, int nrect, xRectangle *prect)
+{
+    xRectangle *boxes, *b;
+    int lw = gc->lineWidth;
+    int a = lw >> 1;
+    int n;
+    Bool ret;
+
+    if (gc->lineStyle != LineSolid)
+        return FALSE;
+    if (lw != 0 && gc->joinStyle != JoinMiter)
+        return FALSE;
+
+    if (nrect < 1)
+        return TRUE;
+
+    boxes = xallocarray(nrect, 4 * sizeof (xRectangle));
+    if (!boxes)
+        return FALSE;
+
+    b = boxes;
+    for (n = 0; n < nrect; n++) {
+        int x = prect[n].x;
+        int y = prect[n].y;
+        int w = prect[n].width;
+        int h = prect[n].height;
+
+        /* The outline boxes are wider than the rectangle; leave the
+         * ones that don't fit an xRectangle to mi.
+         */
+        if (w + MAX(lw, 1) > 65535 || h + MAX(lw, 1) > 65535) {
+            free(boxes);
+            return FALSE;
+        }
+
+        if (lw == 0) {
+            /* Thin outlines cover the pixels on the path */
+            *b++ = (xRectangle) { x, y, w + 1, 1 };
+            if (h == 0)
+                continue;
+            *b++ = (xRectangle) { x, y + h, w + 1, 1 };
+            if (h == 1)
+                continue;
+            *b++ = (xRectangle) { x, y + 1, 1, h - 1 };
+            if (w != 0)
+                *b++ = (xRectangle) { x + w, y + 1, 1, h - 1 };
+        } else if (w <= lw || h <= lw) {
+            /* No hole in the middle */
+            *b++ = (xRectangle) { x - a, y - a, w + lw, h + lw };
+        } else {
+            *b++ = (xRectangle) { x - a, y - a, w + lw, lw };
+            *b++ = (xRectangle) { x - a, y + h - a, w + lw, lw };
+            *b++ = (xRectangle) { x - a, y - a + lw, lw, h - lw };
+            *b++ = (xRectangle) { x + w - a, y - a + lw, lw, h - lw };
+        }
+    }
+
+    ret = glamor_poly_fill_rect_gl(drawable, gc, b - boxes, boxes);
+    free(boxes);
+    return ret;
+}
+
+static void
+glamor_poly_rectangle_bail(DrawablePtr drawable,
+                           GCPtr gc, int nrect, xRectangle *prect)
+{
+    glamor_fallback("to %p (%c)\n", drawable,
+                    glamor_get_drawable_location(drawable));
+
+    miPolyRectangle(drawable, gc, nrect, prect);
+}
+
+void
+glamor_poly_rectangle(DrawablePtr drawable,
+                      GCPtr gc, int nrect, xRectangle *prect)
+{
+    if (glamor_poly_rectangle_gl(drawable, gc, nrect, prect))
+        return;
+    glamor_poly_rectangle_bail(drawable, gc, nrect, prect);
+}
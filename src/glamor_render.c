@@ -59,8 +59,31 @@ static struct blendinfo composite_op_info[] = {
     [PictOpAdd] = {0, 0, GL_ONE, GL_ONE},
 };
 
+/*
+ * Linear and radial gradient sources are evaluated by the composite
+ * shader itself; the ramp and the other uniforms they need are set
+ * up by glamor_gradient_use().
+ */
+static inline Bool
+glamor_shader_source_is_gradient(enum shader_source source)
+{
+    return source == SHADER_SOURCE_LINEAR || source == SHADER_SOURCE_RADIAL;
+}
+
+static Bool
+glamor_picture_is_shader_gradient(PicturePtr picture)
+{
+#ifdef GLAMOR_GRADIENT_SHADER
+    return picture && !picture->pDrawable &&
+        (picture->pSourcePict->type == SourcePictTypeLinear ||
+         picture->pSourcePict->type == SourcePictTypeRadial);
+#else
+    return FALSE;
+#endif
+}
+
 #define RepeatFix			10
-static GLuint
+static char *
 glamor_create_composite_fs(struct shader_key *key)
 {
     const char *repeat_define =
@@ -150,6 +173,20 @@ glamor_create_composite_fs(struct shader_key *key)
         "		return rel_sampler(source_sampler, source_texture,\n"
         "				   source_wh, source_repeat_mode, 1);\n"
         "}\n";
+    const char *source_linear_fetch =
+        GLAMOR_GRADIENT_FS_LINEAR
+        "varying vec2 source_texture;\n"
+        "vec4 get_source()\n"
+        "{\n"
+        "	return gradient_color(source_texture);\n"
+        "}\n";
+    const char *source_radial_fetch =
+        GLAMOR_GRADIENT_FS_RADIAL
+        "varying vec2 source_texture;\n"
+        "vec4 get_source()\n"
+        "{\n"
+        "	return gradient_color(source_texture);\n"
+        "}\n";
     const char *mask_none =
         "vec4 get_mask()\n"
         "{\n"
@@ -231,7 +268,6 @@ glamor_create_composite_fs(struct shader_key *key)
     const char *header;
     const char *header_norm = "";
     const char *dest_swizzle;
-    GLuint prog;
 
     switch (key->source) {
     case SHADER_SOURCE_SOLID:
@@ -243,6 +279,12 @@ glamor_create_composite_fs(struct shader_key *key)
     case SHADER_SOURCE_TEXTURE:
         source_fetch = source_pixmap_fetch;
         break;
+    case SHADER_SOURCE_LINEAR:
+        source_fetch = source_linear_fetch;
+        break;
+    case SHADER_SOURCE_RADIAL:
+        source_fetch = source_radial_fetch;
+        break;
     default:
         FatalError("Bad composite shader source");
     }
@@ -304,13 +346,10 @@ glamor_create_composite_fs(struct shader_key *key)
                 "%s%s%s%s%s%s%s", header, repeat_define, relocate_texture,
                 rel_sampler, source_fetch, mask_fetch, dest_swizzle, in);
 
-    prog = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, source);
-    free(source);
-
-    return prog;
+    return source;
 }
 
-static GLuint
+static char *
 glamor_create_composite_vs(struct shader_key *key)
 {
     const char *main_opening =
@@ -328,7 +367,6 @@ glamor_create_composite_vs(struct shader_key *key)
     const char *source_coords_setup = "";
     const char *mask_coords_setup = "";
     char *source;
-    GLuint prog;
 
     if (key->source != SHADER_SOURCE_SOLID)
         source_coords_setup = source_coords;
@@ -341,10 +379,7 @@ glamor_create_composite_vs(struct shader_key *key)
                 main_opening,
                 source_coords_setup, mask_coords_setup, main_closing);
 
-    prog = glamor_compile_glsl_prog(GL_VERTEX_SHADER, source);
-    free(source);
-
-    return prog;
+    return source;
 }
 
 static void
@@ -352,30 +387,38 @@ glamor_create_composite_shader(ScreenPtr screen, struct shader_key *key,
                                glamor_composite_shader *shader)
 {
     GLuint vs, fs, prog;
+    char *vs_source, *fs_source;
     GLint source_sampler_uniform_location, mask_sampler_uniform_location;
     glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
 
     glamor_make_current(glamor_priv);
-    vs = glamor_create_composite_vs(key);
-    if (vs == 0)
-        return;
-    fs = glamor_create_composite_fs(key);
-    if (fs == 0)
-        return;
-
-    prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-
-    glBindAttribLocation(prog, GLAMOR_VERTEX_POS, "v_position");
-    glBindAttribLocation(prog, GLAMOR_VERTEX_SOURCE, "v_texcoord0");
-    glBindAttribLocation(prog, GLAMOR_VERTEX_MASK, "v_texcoord1");
-
-    if (key->in == glamor_program_alpha_dual_blend) {
-        glBindFragDataLocationIndexed(prog, 0, 0, "color0");
-        glBindFragDataLocationIndexed(prog, 0, 1, "color1");
+    vs_source = glamor_create_composite_vs(key);
+    fs_source = glamor_create_composite_fs(key);
+
+    prog = glamor_program_cache_load(screen, vs_source, fs_source);
+    if (!prog) {
+        vs = glamor_compile_glsl_prog(GL_VERTEX_SHADER, vs_source);
+        fs = glamor_compile_glsl_prog(GL_FRAGMENT_SHADER, fs_source);
+
+        prog = glCreateProgram();
+        glAttachShader(prog, vs);
+        glAttachShader(prog, fs);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+
+        glBindAttribLocation(prog, GLAMOR_VERTEX_POS, "v_position");
+        glBindAttribLocation(prog, GLAMOR_VERTEX_SOURCE, "v_texcoord0");
+        glBindAttribLocation(prog, GLAMOR_VERTEX_MASK, "v_texcoord1");
+
+        if (key->in == glamor_program_alpha_dual_blend) {
+            glBindFragDataLocationIndexed(prog, 0, 0, "color0");
+            glBindFragDataLocationIndexed(prog, 0, 1, "color1");
+        }
+        glamor_link_glsl_prog(screen, prog, "composite");
+        glamor_program_cache_store(screen, prog, vs_source, fs_source);
     }
-    glamor_link_glsl_prog(screen, prog, "composite");
+    free(vs_source);
+    free(fs_source);
 
     shader->prog = prog;
 
@@ -384,6 +427,10 @@ glamor_create_composite_shader(ScreenPtr screen, struct shader_key *key,
     if (key->source == SHADER_SOURCE_SOLID) {
         shader->source_uniform_location = glGetUniformLocation(prog, "source");
     }
+    else if (glamor_shader_source_is_gradient(key->source)) {
+        /* Uniforms are loaded by glamor_gradient_use() */
+        glamor_gradient_get_uniforms(prog, &shader->gradient_uniforms);
+    }
     else {
         source_sampler_uniform_location =
             glGetUniformLocation(prog, "source_sampler");
@@ -423,6 +470,42 @@ glamor_lookup_composite_shader(ScreenPtr screen, struct
     return shader;
 }
 
+/*
+ * The composite shaders that show up in almost every session: plain
+ * blits and fills, with and without an a8 mask, and component alpha
+ * text.
+ */
+static const struct shader_key glamor_composite_warmup_keys[] = {
+    { SHADER_SOURCE_SOLID, SHADER_MASK_NONE, glamor_program_alpha_normal },
+    { SHADER_SOURCE_TEXTURE, SHADER_MASK_NONE, glamor_program_alpha_normal },
+    { SHADER_SOURCE_TEXTURE_ALPHA, SHADER_MASK_NONE, glamor_program_alpha_normal },
+    { SHADER_SOURCE_SOLID, SHADER_MASK_TEXTURE_ALPHA, glamor_program_alpha_normal },
+    { SHADER_SOURCE_TEXTURE_ALPHA, SHADER_MASK_TEXTURE_ALPHA, glamor_program_alpha_normal },
+    { SHADER_SOURCE_TEXTURE_ALPHA, SHADER_MASK_SOLID, glamor_program_alpha_normal },
+    { SHADER_SOURCE_SOLID, SHADER_MASK_TEXTURE_ALPHA, glamor_program_alpha_ca_first },
+    { SHADER_SOURCE_SOLID, SHADER_MASK_TEXTURE_ALPHA, glamor_program_alpha_ca_second },
+};
+
+void
+glamor_composite_warmup(ScreenPtr screen)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(glamor_composite_warmup_keys); i++) {
+        struct shader_key key = glamor_composite_warmup_keys[i];
+
+        if (key.in == glamor_program_alpha_ca_first &&
+            glamor_priv->has_dual_blend)
+            key.in = glamor_program_alpha_dual_blend;
+        else if (key.in == glamor_program_alpha_ca_second &&
+                 glamor_priv->has_dual_blend)
+            continue;
+
+        glamor_lookup_composite_shader(screen, &key);
+    }
+}
+
 static GLenum
 glamor_translate_blend_alpha_to_red(GLenum blend)
 {
@@ -616,6 +699,16 @@ glamor_get_picture_location(PicturePtr picture)
     return glamor_get_drawable_location(picture->pDrawable);
 }
 
+static void
+glamor_set_composite_vb_stride(glamor_screen_private *glamor_priv)
+{
+    glamor_priv->vb_stride = 2 * sizeof(float);
+    if (glamor_priv->has_source_coords)
+        glamor_priv->vb_stride += 2 * sizeof(float);
+    if (glamor_priv->has_mask_coords)
+        glamor_priv->vb_stride += 2 * sizeof(float);
+}
+
 static void *
 glamor_setup_composite_vbo(ScreenPtr screen, int n_verts)
 {
@@ -625,11 +718,7 @@ glamor_setup_composite_vbo(ScreenPtr screen, int n_verts)
     float *vb;
 
     glamor_priv->render_nr_quads = 0;
-    glamor_priv->vb_stride = 2 * sizeof(float);
-    if (glamor_priv->has_source_coords)
-        glamor_priv->vb_stride += 2 * sizeof(float);
-    if (glamor_priv->has_mask_coords)
-        glamor_priv->vb_stride += 2 * sizeof(float);
+    glamor_set_composite_vb_stride(glamor_priv);
 
     vert_size = n_verts * glamor_priv->vb_stride;
 
@@ -672,6 +761,100 @@ glamor_flush_composite_rects(ScreenPtr screen)
     glamor_glDrawArrays_GL_QUADS(glamor_priv, glamor_priv->render_nr_quads);
 }
 
+/*
+ * Runs of composites with the same op, pictures and destination, as
+ * toolkits send for icons, borders and list rows, are batched across
+ * requests: the first one sets up the GL state, later ones only add
+ * their rectangles, and they are drawn together by
+ * glamor_composite_flush().  Anything else using GL goes through
+ * glamor_make_current(), which flushes first, so the state is still in
+ * place when the batch is drawn.  That covers reads of the
+ * destination, other rendering and the block handler.
+ */
+#define GLAMOR_COMPOSITE_BATCH_QUADS    1024
+
+static Bool
+glamor_composite_batch_picture_state(PicturePtr picture, PixmapPtr pixmap,
+                                     glamor_composite_batch_picture *state)
+{
+    glamor_pixmap_private *pixmap_priv;
+
+    if (!picture)
+        return TRUE;
+
+    if (!picture->pDrawable) {
+        /* Gradients set their uniforms from the picture */
+        if (picture->pSourcePict->type != SourcePictTypeSolidFill)
+            return FALSE;
+        state->solid = TRUE;
+        state->color = picture->pSourcePict->solidFill.color;
+        return TRUE;
+    }
+
+    /* Memory pixmaps only have a texture for the one composite, and
+     * large pixmaps switch fbos between blocks.
+     */
+    pixmap_priv = glamor_get_pixmap_private(pixmap);
+    if (glamor_pixmap_is_memory(pixmap) ||
+        glamor_pixmap_priv_is_large(pixmap_priv) || !pixmap_priv->fbo)
+        return FALSE;
+
+    state->fbo = pixmap_priv->fbo;
+    state->format = picture->format;
+    state->repeat = picture->repeatType;
+    state->filter = picture->filter;
+    state->transform = picture->transform != NULL;
+    state->component_alpha = picture->componentAlpha;
+    return TRUE;
+}
+
+static Bool
+glamor_composite_batch_state(CARD8 op,
+                             PicturePtr source,
+                             PicturePtr mask,
+                             PicturePtr dest,
+                             PixmapPtr source_pixmap,
+                             PixmapPtr mask_pixmap,
+                             PixmapPtr dest_pixmap,
+                             glamor_composite_batch *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->op = op;
+
+    return (glamor_composite_batch_picture_state(source, source_pixmap,
+                                                 &state->source) &&
+            glamor_composite_batch_picture_state(mask, mask_pixmap,
+                                                 &state->mask) &&
+            glamor_composite_batch_picture_state(dest, dest_pixmap,
+                                                 &state->dest));
+}
+
+void
+glamor_composite_flush(glamor_screen_private *glamor_priv)
+{
+    ScreenPtr screen = glamor_priv->screen;
+    int nquads = glamor_priv->render_batch_quads;
+    float *vb;
+
+    if (!nquads)
+        return;
+
+    /* Cleared first, as the calls below make the context current */
+    glamor_priv->render_batch_quads = 0;
+
+    vb = glamor_setup_composite_vbo(screen, nquads * 4);
+    memcpy(vb, glamor_priv->render_batch_vertices,
+           nquads * 4 * glamor_priv->vb_stride);
+    glamor_put_vbo_space(screen);
+    glamor_priv->render_nr_quads = nquads;
+    glamor_flush_composite_rects(screen);
+
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
+    glDisable(GL_BLEND);
+}
+
 static const int pict_format_combine_tab[][3] = {
     {PICT_TYPE_ARGB, PICT_TYPE_A, PICT_TYPE_ARGB},
     {PICT_TYPE_ABGR, PICT_TYPE_A, PICT_TYPE_ABGR},
@@ -844,6 +1027,12 @@ glamor_composite_choose_shader(CARD8 op,
                                        &source_solid_color[2],
                                        &source_solid_color[3], PICT_a8r8g8b8);
         }
+#ifdef GLAMOR_GRADIENT_SHADER
+        else if (source->pSourcePict->type == SourcePictTypeLinear)
+            key.source = SHADER_SOURCE_LINEAR;
+        else if (source->pSourcePict->type == SourcePictTypeRadial)
+            key.source = SHADER_SOURCE_RADIAL;
+#endif
         else
             goto fail;
     }
@@ -1041,6 +1230,15 @@ glamor_composite_choose_shader(CARD8 op,
         goto fail;
     }
 
+#ifdef GLAMOR_GRADIENT_SHADER
+    /* Build the ramp now, so running out of memory can still fall back */
+    if (glamor_shader_source_is_gradient(key.source) &&
+        !glamor_gradient_get_ramp(screen, source)) {
+        glamor_fallback("no gradient ramp\n");
+        goto fail;
+    }
+#endif
+
     if (key.source == SHADER_SOURCE_SOLID)
         memcpy(&(*shader)->source_solid_color[0],
                source_solid_color, 4 * sizeof(float));
@@ -1083,6 +1281,12 @@ glamor_composite_set_shader_blend(glamor_screen_private *glamor_priv,
         glamor_set_composite_solid(shader->source_solid_color,
                                    shader->source_uniform_location);
     }
+#ifdef GLAMOR_GRADIENT_SHADER
+    else if (glamor_shader_source_is_gradient(key->source)) {
+        glamor_gradient_use(glamor_priv->screen, shader->source,
+                            &shader->gradient_uniforms);
+    }
+#endif
     else {
         glamor_set_composite_texture(glamor_priv, 0,
                                      shader->source,
@@ -1146,6 +1350,29 @@ glamor_composite_with_shader(CARD8 op,
     Bool ret = FALSE;
     glamor_composite_shader *shader = NULL, *shader_ca = NULL;
     struct blendinfo op_info, op_info_ca;
+    glamor_composite_batch batch_state;
+    Bool batch = FALSE;
+
+    if (ca_state == CA_NONE && nrect <= GLAMOR_COMPOSITE_BATCH_QUADS &&
+        glamor_composite_batch_state(op, source, mask, dest,
+                                     source_pixmap, mask_pixmap, dest_pixmap,
+                                     &batch_state)) {
+        if (!glamor_priv->render_batch_vertices)
+            glamor_priv->render_batch_vertices =
+                malloc(GLAMOR_COMPOSITE_BATCH_QUADS * 4 * 6 * sizeof(float));
+        batch = glamor_priv->render_batch_vertices != NULL;
+    }
+
+    if (batch && glamor_priv->render_batch_quads &&
+        glamor_priv->render_batch_quads + nrect <= GLAMOR_COMPOSITE_BATCH_QUADS &&
+        memcmp(&batch_state, &glamor_priv->render_batch,
+               sizeof(batch_state)) == 0) {
+        /* Same state as the pending batch, just add the rectangles */
+        key = glamor_priv->render_batch_key;
+        goto setup_done;
+    }
+
+    glamor_composite_flush(glamor_priv);
 
     if (!glamor_composite_choose_shader(op, source, mask, dest,
                                         source_pixmap, mask_pixmap, dest_pixmap,
@@ -1178,13 +1405,24 @@ glamor_composite_with_shader(CARD8 op,
     glamor_priv->has_mask_coords = (key.mask != SHADER_MASK_NONE &&
                                     key.mask != SHADER_MASK_SOLID);
 
+    if (batch) {
+        glamor_priv->render_batch = batch_state;
+        glamor_priv->render_batch_key = key;
+        glamor_set_composite_vb_stride(glamor_priv);
+    }
+
+setup_done:
     dest_pixmap = glamor_get_drawable_pixmap(dest->pDrawable);
     dest_pixmap_priv = glamor_get_pixmap_private(dest_pixmap);
     glamor_get_drawable_deltas(dest->pDrawable, dest_pixmap,
                                &dest_x_off, &dest_y_off);
     pixmap_priv_get_dest_scale(dest_pixmap, dest_pixmap_priv, &dst_xscale, &dst_yscale);
 
-    if (glamor_priv->has_source_coords) {
+    if (glamor_shader_source_is_gradient(key.source)) {
+        source_x_off = 0;
+        source_y_off = 0;
+    }
+    else if (glamor_priv->has_source_coords) {
         glamor_get_drawable_deltas(source->pDrawable,
                                    source_pixmap, &source_x_off, &source_y_off);
         pixmap_priv_get_scale(source_pixmap_priv, &src_xscale, &src_yscale);
@@ -1212,7 +1450,12 @@ glamor_composite_with_shader(CARD8 op,
         float *vertices;
 
         mrect = nrect > nrect_max ? nrect_max : nrect;
-        vertices = glamor_setup_composite_vbo(screen, mrect * 4);
+        if (batch)
+            vertices = glamor_priv->render_batch_vertices +
+                glamor_priv->render_batch_quads * 4 *
+                (glamor_priv->vb_stride / sizeof(float));
+        else
+            vertices = glamor_setup_composite_vbo(screen, mrect * 4);
         rect_processed = mrect;
         vb_stride = glamor_priv->vb_stride / sizeof(float);
         while (mrect--) {
@@ -1245,7 +1488,17 @@ glamor_composite_with_shader(CARD8 op,
                                              vertices,
                                              vb_stride);
             vertices += 2;
-            if (key.source != SHADER_SOURCE_SOLID) {
+            if (glamor_shader_source_is_gradient(key.source)) {
+                /* Gradients take untransformed source picture
+                 * coordinates, the shader applies the transform.
+                 */
+                _glamor_set_normalize_tcoords(1.0f, 1.0f, x_source, y_source,
+                                              x_source + width,
+                                              y_source + height,
+                                              vertices, vb_stride);
+                vertices += 2;
+            }
+            else if (key.source != SHADER_SOURCE_SOLID) {
                 glamor_set_normalize_tcoords_generic(source_pixmap,
                                                      source_pixmap_priv,
                                                      source->repeatType,
@@ -1268,15 +1521,21 @@ glamor_composite_with_shader(CARD8 op,
                                                      vertices, vb_stride);
                 vertices += 2;
             }
-            glamor_priv->render_nr_quads++;
+            if (batch)
+                glamor_priv->render_batch_quads++;
+            else
+                glamor_priv->render_nr_quads++;
             rects++;
 
             /* We've incremented by one of our 4 verts, now do the other 3. */
             vertices += 3 * vb_stride;
         }
+        nrect -= rect_processed;
+        if (batch)
+            continue;
+
         glamor_put_vbo_space(screen);
         glamor_flush_composite_rects(screen);
-        nrect -= rect_processed;
         if (ca_state == CA_TWO_PASS) {
             glamor_composite_set_shader_blend(glamor_priv, dest_pixmap_priv,
                                               &key_ca, shader_ca, &op_info_ca);
@@ -1287,10 +1546,12 @@ glamor_composite_with_shader(CARD8 op,
         }
     }
 
-    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
-    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
-    glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
-    glDisable(GL_BLEND);
+    if (!batch) {
+        glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+        glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+        glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
+        glDisable(GL_BLEND);
+    }
     DEBUGF("finish rendering.\n");
     if (saved_source_format)
         source->format = saved_source_format;
@@ -1299,9 +1560,9 @@ glamor_composite_with_shader(CARD8 op,
 
 fail:
     if (mask_pixmap && glamor_pixmap_is_memory(mask_pixmap))
-        glamor_pixmap_destroy_fbo(mask_pixmap);
+        glamor_release_picture_texture(mask_pixmap);
     if (source_pixmap && glamor_pixmap_is_memory(source_pixmap))
-        glamor_pixmap_destroy_fbo(source_pixmap);
+        glamor_release_picture_texture(source_pixmap);
 
     return ret;
 }
@@ -1368,6 +1629,78 @@ glamor_convert_gradient_picture(ScreenPtr screen,
     return dst;
 }
 
+/*
+ * When a composite reads from the pixmap it draws to, copy the part of
+ * the source the composite reads into a scratch pixmap first, as
+ * glamor_copy_fbo_fbo_temp() does for CopyArea.  (x, y, width, height)
+ * is the area read, in picture coordinates; on success (x_off, y_off)
+ * is where the staged picture starts in the original one.
+ */
+static PicturePtr
+glamor_stage_self_picture(ScreenPtr screen, PicturePtr picture,
+                          int x, int y, int width, int height,
+                          int *x_off, int *y_off)
+{
+    DrawablePtr drawable = picture->pDrawable;
+    PixmapPtr pixmap;
+    PicturePtr staged;
+    BoxRec bounds, box;
+    XID component_alpha = picture->componentAlpha;
+    int error;
+
+    if (picture->transform || picture->alphaMap)
+        return NULL;
+
+    bounds.x1 = max(x, 0);
+    bounds.y1 = max(y, 0);
+    bounds.x2 = min(x + width, drawable->width);
+    bounds.y2 = min(y + height, drawable->height);
+    if (bounds.x1 >= bounds.x2 || bounds.y1 >= bounds.y2)
+        return NULL;
+
+    /* Outside the drawable, RepeatNone samples are transparent just as
+     * they are outside the staged copy.  Other repeats would need the
+     * whole drawable.
+     */
+    if (picture->repeatType != RepeatNone &&
+        (bounds.x1 != x || bounds.y1 != y ||
+         bounds.x2 != x + width || bounds.y2 != y + height))
+        return NULL;
+
+    pixmap = glamor_create_pixmap(screen,
+                                  bounds.x2 - bounds.x1,
+                                  bounds.y2 - bounds.y1,
+                                  drawable->depth, 0);
+    if (!pixmap)
+        return NULL;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(pixmap))) {
+        glamor_destroy_pixmap(pixmap);
+        return NULL;
+    }
+
+    staged = CreatePicture(0, &pixmap->drawable, picture->pFormat,
+                           CPComponentAlpha, &component_alpha,
+                           serverClient, &error);
+    glamor_destroy_pixmap(pixmap);
+    if (!staged)
+        return NULL;
+
+    ValidatePicture(staged);
+
+    box.x1 = 0;
+    box.y1 = 0;
+    box.x2 = bounds.x2 - bounds.x1;
+    box.y2 = bounds.y2 - bounds.y1;
+    glamor_copy(drawable, &pixmap->drawable, NULL, &box, 1,
+                bounds.x1 + drawable->x, bounds.y1 + drawable->y,
+                FALSE, FALSE, 0, NULL);
+
+    *x_off = bounds.x1;
+    *y_off = bounds.y1;
+    return staged;
+}
+
 Bool
 glamor_composite_clipped_region(CARD8 op,
                                 PicturePtr source,
@@ -1451,7 +1784,7 @@ glamor_composite_clipped_region(CARD8 op,
     }
 
     /* XXX is it possible source mask have non-zero drawable.x/y? */
-    if (source
+    if (source && !glamor_picture_is_shader_gradient(source)
         && ((!source->pDrawable
              && (source->pSourcePict->type != SourcePictTypeSolidFill))
             || (source->pDrawable
@@ -1513,12 +1846,38 @@ glamor_composite_clipped_region(CARD8 op,
     }
 
     if (temp_src_pixmap == dest_pixmap) {
-        glamor_fallback("source and dest pixmaps are the same\n");
-        goto out;
+        int x_off, y_off;
+
+        temp_src = glamor_stage_self_picture(screen, source,
+                                             extent->x1 + x_source - x_dest - dest->pDrawable->x,
+                                             extent->y1 + y_source - y_dest - dest->pDrawable->y,
+                                             width, height, &x_off, &y_off);
+        if (!temp_src) {
+            temp_src = source;
+            glamor_fallback("source and dest pixmaps are the same\n");
+            goto out;
+        }
+        temp_src_pixmap = (PixmapPtr) (temp_src->pDrawable);
+        temp_src_priv = glamor_get_pixmap_private(temp_src_pixmap);
+        x_temp_src -= x_off;
+        y_temp_src -= y_off;
     }
     if (temp_mask_pixmap == dest_pixmap) {
-        glamor_fallback("mask and dest pixmaps are the same\n");
-        goto out;
+        int x_off, y_off;
+
+        temp_mask = glamor_stage_self_picture(screen, mask,
+                                              extent->x1 + x_mask - x_dest - dest->pDrawable->x,
+                                              extent->y1 + y_mask - y_dest - dest->pDrawable->y,
+                                              width, height, &x_off, &y_off);
+        if (!temp_mask) {
+            temp_mask = mask;
+            glamor_fallback("mask and dest pixmaps are the same\n");
+            goto out;
+        }
+        temp_mask_pixmap = (PixmapPtr) (temp_mask->pDrawable);
+        temp_mask_priv = glamor_get_pixmap_private(temp_mask_pixmap);
+        x_temp_mask -= x_off;
+        y_temp_mask -= y_off;
     }
 
     x_dest += dest->pDrawable->x;
@@ -1675,7 +2034,7 @@ glamor_composite(CARD8 op,
             || (mask_pixmap &&
                 (glamor_pixmap_is_memory(mask_pixmap) ||
                  mask->repeatType == RepeatPad))
-            || (!source_pixmap &&
+            || (!source_pixmap && !glamor_picture_is_shader_gradient(source) &&
                 (source->pSourcePict->type != SourcePictTypeSolidFill))
             || (!mask_pixmap && mask &&
                 mask->pSourcePict->type != SourcePictTypeSolidFill)))
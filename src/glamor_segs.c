@@ -121,8 +121,12 @@ static Bool
 glamor_poly_segment_gl(DrawablePtr drawable, GCPtr gc,
                        int nseg, xSegment *segs)
 {
-    if (gc->lineWidth != 0)
+    if (gc->lineWidth != 0) {
+        if (gc->lineStyle == LineSolid ||
+            (gc->lineStyle == LineDoubleDash && gc->fillStyle == FillTiled))
+            return glamor_poly_segment_wide_gl(drawable, gc, nseg, segs);
         return FALSE;
+    }
 
     switch (gc->lineStyle) {
     case LineSolid:
@@ -177,64 +177,38 @@ static Bool
 glamor_get_spans_gl(DrawablePtr drawable, int wmax,
                     DDXPointPtr points, int *widths, int count, char *dst)
 {
-    ScreenPtr screen = drawable->pScreen;
-    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
     PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
     glamor_pixmap_private *pixmap_priv;
-    int box_index;
+    glamor_readback *reads;
     int n;
     char *d;
-    GLenum type;
-    GLenum format;
     int off_x, off_y;
 
     pixmap_priv = glamor_get_pixmap_private(pixmap);
     if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
         goto bail;
 
-    glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
-
-    glamor_format_for_pixmap(pixmap, &format, &type);
-
-    glamor_make_current(glamor_priv);
-
-    glamor_pixmap_loop(pixmap_priv, box_index) {
-        BoxPtr                  box = glamor_pixmap_box_at(pixmap_priv, box_index);
-        glamor_pixmap_fbo       *fbo = glamor_pixmap_fbo_at(pixmap_priv, box_index);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
-        glPixelStorei(GL_PACK_ALIGNMENT, 4);
-
-        d = dst;
-        for (n = 0; n < count; n++) {
-            int x1 = points[n].x + off_x;
-            int y = points[n].y + off_y;
-            int w = widths[n];
-            int x2 = x1 + w;
-            char *l;
-
-            l = d;
-            d += PixmapBytePad(w, drawable->depth);
-
-            /* clip */
-            if (x1 < box->x1) {
-                l += (box->x1 - x1) * (drawable->bitsPerPixel >> 3);
-                x1 = box->x1;
-            }
-            if (x2 > box->x2)
-                x2 = box->x2;
+    reads = xallocarray(count, sizeof (glamor_readback));
+    if (!reads)
+        goto bail;
 
-            if (x1 >= x2)
-                continue;
-            if (y < box->y1)
-                continue;
-            if (y >= box->y2)
-                continue;
+    glamor_get_drawable_deltas(drawable, pixmap, &off_x, &off_y);
 
-            glReadPixels(x1 - box->x1, y - box->y1, x2 - x1, 1, format, type, l);
-        }
+    /* Read every span in one go, so that we only wait for the GPU once */
+    d = dst;
+    for (n = 0; n < count; n++) {
+        reads[n].box.x1 = points[n].x + off_x;
+        reads[n].box.x2 = reads[n].box.x1 + widths[n];
+        reads[n].box.y1 = points[n].y + off_y;
+        reads[n].box.y2 = reads[n].box.y1 + 1;
+        reads[n].bits = (uint8_t *) d;
+        reads[n].byte_stride = PixmapBytePad(widths[n], drawable->depth);
+        d += reads[n].byte_stride;
     }
 
+    glamor_readback(pixmap, reads, count);
+    free(reads);
+
     return TRUE;
 bail:
     return FALSE;
@@ -84,7 +84,73 @@ glamor_get_glyphs(FontPtr font, glamor_font_t *glamor_font,
 }
 
 /*
- * Construct quads for the provided list of characters and draw them
+ * Locate a glyph in the font textures: the page holding it and its
+ * index within that page
+ */
+
+static void
+glamor_text_glyph_pos(FontPtr font, glamor_font_t *glamor_font,
+                      CharInfoPtr ci, unsigned char *chars, Bool sixteen,
+                      int *page, int *index)
+{
+    int row = 0, col;
+
+    /* The default char lives in its own row whatever the string width,
+     * so that it never takes the slot of a real glyph of row 0.
+     */
+    if (ci == glamor_font->default_char) {
+        row = glamor_font->default_row;
+        col = glamor_font->default_col;
+    } else if (sixteen) {
+        row = chars[0];
+        col = chars[1];
+    } else
+        col = chars[0];
+
+    if (sixteen || ci == glamor_font->default_char) {
+        if (FONTLASTROW(font) != 0)
+            row -= font->info.firstRow;
+        else {
+            col += row << 8;
+            row = 0;
+        }
+    }
+
+    *page = row;
+    *index = col - font->info.firstCol;
+}
+
+/*
+ * Upload any glyphs of the string which aren't in the font textures
+ * yet. This has to happen before the text program is bound.
+ */
+
+static Bool
+glamor_text_load_glyphs(ScreenPtr screen, FontPtr font,
+                        glamor_font_t *glamor_font,
+                        int count, char *s_chars, CharInfoPtr *charinfo,
+                        Bool sixteen)
+{
+    unsigned char *chars = (unsigned char *) s_chars;
+    int page, index;
+    int c;
+
+    for (c = 0; c < count; c++) {
+        if (charinfo[c]) {
+            glamor_text_glyph_pos(font, glamor_font, charinfo[c], chars,
+                                  sixteen, &page, &index);
+            if (!glamor_font_load_glyph(screen, glamor_font, page, index,
+                                        charinfo[c]))
+                return FALSE;
+        }
+        chars += 1 + sixteen;
+    }
+    return TRUE;
+}
+
+/*
+ * Construct quads for the provided list of characters and draw them.
+ * Consecutive glyphs from the same texture page are drawn together.
  */
 
 static int
@@ -103,18 +169,19 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
     GLshort *v;
     char *vbo_offset;
     CharInfoPtr ci;
-    int firstRow = font->info.firstRow;
-    int firstCol = font->info.firstCol;
-    int glyph_spacing_x = glamor_font->glyph_width_bytes * 8;
-    int glyph_spacing_y = glamor_font->glyph_height;
+    struct {
+        GLuint  texture_id;
+        int     first;
+        int     count;
+    } runs[255];        /* encoding only has 1 byte for count */
+    int nrun = 0;
+    int r;
     int box_index;
     PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
     glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
 
-    /* Set the font as texture 1 */
+    /* The font pages go in texture 1 */
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, glamor_font->texture_id);
     glUniform1i(prog->font_uniform, 1);
 
     /* Set up the vertex buffers for the font and destination */
@@ -123,13 +190,9 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
 
     glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
     glVertexAttribDivisor(GLAMOR_VERTEX_POS, 1);
-    glVertexAttribPointer(GLAMOR_VERTEX_POS, 4, GL_SHORT, GL_FALSE,
-                          6 * sizeof (GLshort), vbo_offset);
 
     glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
     glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 1);
-    glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 2, GL_SHORT, GL_FALSE,
-                          6 * sizeof (GLshort), vbo_offset + 4 * sizeof (GLshort));
 
     /* Set the vertex coordinates */
     nglyph = 0;
@@ -140,42 +203,29 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
             int     y1 = y - ci->metrics.ascent;
             int     width = GLYPHWIDTHPIXELS(ci);
             int     height = GLYPHHEIGHTPIXELS(ci);
-            int     tx, ty = 0;
-            int     row = 0, col;
-            int     second_row = 0;
+            int     page, index;
+            GLuint  texture_id;
+
             x += ci->metrics.characterWidth;
 
-            if (sixteen) {
-                if (ci == glamor_font->default_char) {
-                    row = glamor_font->default_row;
-                    col = glamor_font->default_col;
-                } else {
-                    row = chars[0];
-                    col = chars[1];
-                }
-                if (FONTLASTROW(font) != 0) {
-                    ty = ((row - firstRow) / 2) * glyph_spacing_y;
-                    second_row = (row - firstRow) & 1;
-                }
-                else
-                    col += row << 8;
-            } else {
-                if (ci == glamor_font->default_char)
-                    col = glamor_font->default_col;
-                else
-                    col = chars[0];
-            }
+            glamor_text_glyph_pos(font, glamor_font, ci, chars, sixteen,
+                                  &page, &index);
+            texture_id = glamor_font->pages[page]->texture_id;
 
-            tx = (col - firstCol) * glyph_spacing_x;
-            /* adjust for second row layout */
-            tx += second_row * glamor_font->row_width * 8;
+            if (!nrun || runs[nrun - 1].texture_id != texture_id) {
+                runs[nrun].texture_id = texture_id;
+                runs[nrun].first = nglyph;
+                runs[nrun].count = 0;
+                nrun++;
+            }
+            runs[nrun - 1].count++;
 
             v[ 0] = x1;
             v[ 1] = y1;
             v[ 2] = width;
             v[ 3] = height;
-            v[ 4] = tx;
-            v[ 5] = ty;
+            v[ 4] = GLAMOR_FONT_GLYPH_X(glamor_font, index);
+            v[ 5] = GLAMOR_FONT_GLYPH_Y(glamor_font, index);
 
             v += 6;
             nglyph++;
@@ -187,26 +237,37 @@ glamor_text(DrawablePtr drawable, GCPtr gc,
     if (nglyph != 0) {
 
         glEnable(GL_SCISSOR_TEST);
+        glActiveTexture(GL_TEXTURE1);
 
         glamor_pixmap_loop(pixmap_priv, box_index) {
-            BoxPtr box = RegionRects(gc->pCompositeClip);
-            int nbox = RegionNumRects(gc->pCompositeClip);
-
             glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
                                             prog->matrix_uniform,
                                             &off_x, &off_y);
 
-            /* Run over the clip list, drawing the glyphs
-             * in each box
-             */
-
-            while (nbox--) {
-                glScissor(box->x1 + off_x,
-                          box->y1 + off_y,
-                          box->x2 - box->x1,
-                          box->y2 - box->y1);
-                box++;
-                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, nglyph);
+            for (r = 0; r < nrun; r++) {
+                BoxPtr box = RegionRects(gc->pCompositeClip);
+                int nbox = RegionNumRects(gc->pCompositeClip);
+                char *run_offset = vbo_offset + runs[r].first * (6 * sizeof (GLshort));
+
+                glBindTexture(GL_TEXTURE_2D, runs[r].texture_id);
+                glVertexAttribPointer(GLAMOR_VERTEX_POS, 4, GL_SHORT, GL_FALSE,
+                                      6 * sizeof (GLshort), run_offset);
+                glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 2, GL_SHORT, GL_FALSE,
+                                      6 * sizeof (GLshort),
+                                      run_offset + 4 * sizeof (GLshort));
+
+                /* Run over the clip list, drawing the glyphs
+                 * in each box
+                 */
+
+                while (nbox--) {
+                    glScissor(box->x1 + off_x,
+                              box->y1 + off_y,
+                              box->x2 - box->x1,
+                              box->y2 - box->y1);
+                    box++;
+                    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, runs[r].count);
+                }
             }
         }
         glDisable(GL_SCISSOR_TEST);
@@ -288,6 +349,10 @@ glamor_poly_text(DrawablePtr drawable, GCPtr gc,
 
     glamor_make_current(glamor_priv);
 
+    if (!glamor_text_load_glyphs(screen, gc->font, glamor_font,
+                                 count, chars, charinfo, sixteen))
+        goto bail;
+
     prog = glamor_use_program_fill(pixmap, gc, &glamor_priv->poly_text_progs, &glamor_facet_poly_text);
 
     if (!prog)
@@ -406,6 +471,10 @@ glamor_image_text(DrawablePtr drawable, GCPtr gc,
 
     glamor_make_current(glamor_priv);
 
+    if (!glamor_text_load_glyphs(screen, gc->font, glamor_font,
+                                 count, chars, charinfo, sixteen))
+        return FALSE;
+
     if (TERMINALFONT(gc->font))
         prog = &glamor_priv->te_text_prog;
     else
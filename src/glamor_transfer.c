@@ -51,6 +51,61 @@ glamor_format_for_pixmap(PixmapPtr pixmap, GLenum *format, GLenum *type)
     }
 }
 
+/* Row stride GL uses for packed rows with an alignment of 4 */
+static inline uint32_t
+glamor_pack_stride(int w, int bytes_per_pixel)
+{
+    return (w * bytes_per_pixel + 3) & ~3;
+}
+
+/*
+ * Scratch memory for packing uploads, kept on the screen so that
+ * steady streams of PutImage don't hit malloc for every request.
+ */
+static uint8_t *
+glamor_upload_staging(glamor_screen_private *glamor_priv, size_t size)
+{
+    if (glamor_priv->upload_staging_size < size) {
+        uint8_t *staging;
+
+        size = (size + 0xfff) & ~(size_t) 0xfff;
+        staging = realloc(glamor_priv->upload_staging, size);
+        if (!staging)
+            return NULL;
+        glamor_priv->upload_staging = staging;
+        glamor_priv->upload_staging_size = size;
+    }
+    return glamor_priv->upload_staging;
+}
+
+/*
+ * Without an unpack row length, pack the rectangle's rows together
+ * and upload it with a single glTexSubImage2D rather than one call per
+ * row; the per-call overhead dominates small rows on GLES2 drivers.
+ * The destination texture must already be bound.
+ */
+void
+glamor_write_rect(glamor_screen_private *glamor_priv,
+                  int x, int y, int w, int h, GLenum format, GLenum type,
+                  int bytes_per_pixel, const uint8_t *bits, uint32_t byte_stride)
+{
+    uint32_t pack_stride = glamor_pack_stride(w, bytes_per_pixel);
+    uint8_t *staging, *dst;
+    int n;
+
+    staging = glamor_upload_staging(glamor_priv, (size_t) pack_stride * h);
+    if (!staging) {
+        for (; h--; y++, bits += byte_stride)
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, 1, format, type, bits);
+        return;
+    }
+
+    for (n = 0, dst = staging; n < h; n++, dst += pack_stride, bits += byte_stride)
+        memcpy(dst, bits, w * bytes_per_pixel);
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, format, type, staging);
+}
+
 /*
  * Write a region of bits into a pixmap
  */
@@ -109,12 +164,11 @@ glamor_upload_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
                                 format, type,
                                 bits + ofs);
             } else {
-                for (; y1 < y2; y1++, ofs += byte_stride)
-                    glTexSubImage2D(GL_TEXTURE_2D, 0,
-                                    x1 - box->x1, y1 - box->y1,
-                                    x2 - x1, 1,
-                                    format, type,
-                                    bits + ofs);
+                glamor_write_rect(glamor_priv,
+                                  x1 - box->x1, y1 - box->y1,
+                                  x2 - x1, y2 - y1,
+                                  format, type, bytes_per_pixel,
+                                  bits + ofs, byte_stride);
             }
         }
     }
@@ -154,6 +208,32 @@ glamor_upload_pixmap(PixmapPtr pixmap)
                         pixmap->devPrivate.ptr, pixmap->devKind);
 }
 
+
+/*
+ * Without a pack row length, read the whole rectangle into a packed
+ * temporary and copy it out rather than reading one row per call;
+ * every glReadPixels is a full pipeline stall.
+ */
+static void
+glamor_read_rect(int x, int y, int w, int h, GLenum format, GLenum type,
+                 int bytes_per_pixel, uint8_t *bits, uint32_t byte_stride)
+{
+    uint32_t pack_stride = glamor_pack_stride(w, bytes_per_pixel);
+    uint8_t *tmp, *src;
+
+    tmp = xallocarray(h, pack_stride);
+    if (!tmp) {
+        for (; h--; y++, bits += byte_stride)
+            glReadPixels(x, y, w, 1, format, type, bits);
+        return;
+    }
+
+    glReadPixels(x, y, w, h, format, type, tmp);
+    for (src = tmp; h--; src += pack_stride, bits += byte_stride)
+        memcpy(bits, src, w * bytes_per_pixel);
+    free(tmp);
+}
+
 /*
  * Read stuff from the pixmap FBOs and write to memory
  */
@@ -208,8 +288,9 @@ glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
                 x2 - x1 == byte_stride / bytes_per_pixel) {
                 glReadPixels(x1 - box->x1, y1 - box->y1, x2 - x1, y2 - y1, format, type, bits + ofs);
             } else {
-                for (; y1 < y2; y1++, ofs += byte_stride)
-                    glReadPixels(x1 - box->x1, y1 - box->y1, x2 - x1, 1, format, type, bits + ofs);
+                glamor_read_rect(x1 - box->x1, y1 - box->y1, x2 - x1, y2 - y1,
+                                 format, type, bytes_per_pixel,
+                                 bits + ofs, byte_stride);
             }
         }
     }
@@ -217,6 +298,154 @@ glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
         glPixelStorei(GL_PACK_ROW_LENGTH, 0);
 }
 
+/*
+ * Queue one read per clipped rectangle into a PBO, packed tightly so
+ * that no pack row length is needed, and only map the buffer once
+ * everything has been submitted.  This is still a synchronous
+ * readback, the map waits for the reads, but it waits once for all of
+ * them instead of once per glReadPixels.  Returns FALSE if the PBO
+ * couldn't be mapped; nothing has been written in that case.
+ */
+static Bool
+glamor_readback_pbo(PixmapPtr pixmap, const glamor_readback *reads, int nread)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_pixmap_private *priv = glamor_get_pixmap_private(pixmap);
+    int bytes_per_pixel = pixmap->drawable.bitsPerPixel >> 3;
+    struct glamor_readback_rect {
+        uint8_t *bits;
+        uint32_t byte_stride;
+        int w, h;
+        size_t offset;
+    } *rects;
+    int nrect = 0, n, box_index;
+    size_t size = 0;
+    GLenum type, format;
+    GLuint pbo;
+    uint8_t *map;
+    int slot;
+
+    rects = xallocarray(nread * glamor_pixmap_wcnt(priv) *
+                        glamor_pixmap_hcnt(priv), sizeof (*rects));
+    if (!rects)
+        return FALSE;
+
+    glamor_format_for_pixmap(pixmap, &format, &type);
+
+    glamor_make_current(glamor_priv);
+
+    /* Lay the rectangles out first so that the PBO is sized once */
+    glamor_pixmap_loop(priv, box_index) {
+        BoxPtr box = glamor_pixmap_box_at(priv, box_index);
+
+        for (n = 0; n < nread; n++) {
+            const glamor_readback *read = &reads[n];
+            int x1 = MAX(read->box.x1, box->x1);
+            int x2 = MIN(read->box.x2, box->x2);
+            int y1 = MAX(read->box.y1, box->y1);
+            int y2 = MIN(read->box.y2, box->y2);
+
+            if (x2 <= x1 || y2 <= y1)
+                continue;
+
+            rects[nrect].bits = read->bits +
+                (y1 - read->box.y1) * read->byte_stride +
+                (x1 - read->box.x1) * bytes_per_pixel;
+            rects[nrect].byte_stride = read->byte_stride;
+            rects[nrect].w = x2 - x1;
+            rects[nrect].h = y2 - y1;
+            rects[nrect].offset = size;
+            size += (size_t) glamor_pack_stride(x2 - x1, bytes_per_pixel) *
+                (y2 - y1);
+            nrect++;
+        }
+    }
+
+    if (nrect == 0) {
+        free(rects);
+        return TRUE;
+    }
+
+    slot = glamor_pbo_get(glamor_priv, size, &pbo);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    nrect = 0;
+    glamor_pixmap_loop(priv, box_index) {
+        BoxPtr box = glamor_pixmap_box_at(priv, box_index);
+        glamor_pixmap_fbo *fbo = glamor_pixmap_fbo_at(priv, box_index);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo->fb);
+
+        for (n = 0; n < nread; n++) {
+            const glamor_readback *read = &reads[n];
+            int x1 = MAX(read->box.x1, box->x1);
+            int y1 = MAX(read->box.y1, box->y1);
+
+            if (MIN(read->box.x2, box->x2) <= x1 ||
+                MIN(read->box.y2, box->y2) <= y1)
+                continue;
+
+            glReadPixels(x1 - box->x1, y1 - box->y1,
+                         rects[nrect].w, rects[nrect].h, format, type,
+                         (char *) NULL + rects[nrect].offset);
+            nrect++;
+        }
+    }
+
+    if (glamor_priv->gl_flavor == GLAMOR_GL_DESKTOP &&
+        !glamor_priv->has_map_buffer_range)
+        map = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    else
+        map = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+    if (map) {
+        for (n = 0; n < nrect; n++) {
+            uint32_t pack_stride =
+                glamor_pack_stride(rects[n].w, bytes_per_pixel);
+            uint8_t *src = map + rects[n].offset;
+            uint8_t *dst = rects[n].bits;
+            int h;
+
+            for (h = 0; h < rects[n].h; h++) {
+                memcpy(dst, src, rects[n].w * bytes_per_pixel);
+                src += pack_stride;
+                dst += rects[n].byte_stride;
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glamor_pbo_put(glamor_priv, slot, pbo);
+    free(rects);
+    return map != NULL;
+}
+
+/*
+ * Read a list of pixmap boxes, each to its own destination.  Where
+ * pixel pack buffers are available all of the reads are queued before
+ * the server waits for any of them, otherwise each box is read with a
+ * single glReadPixels.
+ */
+void
+glamor_readback(PixmapPtr pixmap, const glamor_readback *reads, int nread)
+{
+    ScreenPtr screen = pixmap->drawable.pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    int n;
+
+    if (glamor_priv->has_pack_pbo &&
+        glamor_readback_pbo(pixmap, reads, nread))
+        return;
+
+    for (n = 0; n < nread; n++)
+        glamor_download_boxes(pixmap, (BoxPtr) &reads[n].box, 1,
+                              0, 0, -reads[n].box.x1, -reads[n].box.y1,
+                              reads[n].bits, reads[n].byte_stride);
+}
+
 /*
  * Read data from the pixmap FBO
  */
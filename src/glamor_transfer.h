@@ -32,6 +32,11 @@ glamor_upload_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
                     int dx_dst, int dy_dst,
                     uint8_t *bits, uint32_t byte_stride);
 
+void
+glamor_write_rect(glamor_screen_private *glamor_priv,
+                  int x, int y, int w, int h, GLenum format, GLenum type,
+                  int bytes_per_pixel, const uint8_t *bits, uint32_t byte_stride);
+
 void
 glamor_upload_region(PixmapPtr pixmap, RegionPtr region,
                      int region_x, int region_y,
@@ -46,6 +51,16 @@ glamor_download_boxes(PixmapPtr pixmap, BoxPtr in_boxes, int in_nbox,
                       int dx_dst, int dy_dst,
                       uint8_t *bits, uint32_t byte_stride);
 
+/* A box of pixmap pixels to read back, and where to put it */
+typedef struct {
+    BoxRec box;
+    uint8_t *bits;
+    uint32_t byte_stride;
+} glamor_readback;
+
+void
+glamor_readback(PixmapPtr pixmap, const glamor_readback *reads, int nread);
+
 void
 glamor_download_rect(PixmapPtr pixmap, int x, int y, int w, int h, uint8_t *bits);
 
@@ -31,10 +31,535 @@
  */
 
 #include "glamor_priv.h"
+#include "glamor_program.h"
+#include "glamor_transform.h"
 
 #include "mipict.h"
 #include "fbpict.h"
 
+/*
+ * GPU coverage rasterizer shared by Trapezoids, Triangles and AddTraps.
+ *
+ * Each glamor_shape is drawn as a quad covering its pixel bounds.  All
+ * shape data is relative to the quad origin so that the fragment
+ * shader keeps sub-pixel accuracy even at mediump precision:
+ *
+ *  primitive.xy    quad origin in drawable coordinates
+ *  primitive.zw    this corner, relative to the origin
+ *  edges           edge 0 x and dx/dy, edge 1 x and dx/dy, with x
+ *                  measured on the origin row
+ *  span            top, bottom, the y at which edge 1 bends, and
+ *                  edge 1's dx/dy below that point
+ *
+ * The shape covers the pixels between the two edges, so a trapezoid
+ * is its left and right edges and a triangle is its long edge plus
+ * the two short ones joined at the middle vertex.
+ *
+ * Coverage is the exact vertical overlap of each quarter pixel row
+ * with the shape times the horizontal overlap at the middle of that
+ * row, which is what pixman's a8 sampling approximates too.
+ */
+static const glamor_facet glamor_facet_shape = {
+    .name = "shape",
+    .vs_vars = ("attribute vec4 primitive;\n"
+                "attribute vec4 edges;\n"
+                "attribute vec4 span;\n"
+                "varying vec2 shape_pos;\n"
+                "varying vec4 shape_edges;\n"
+                "varying vec4 shape_span;\n"),
+    .vs_exec = ("       vec2 pos = primitive.zw;\n"
+                GLAMOR_POS(gl_Position, (primitive.xy + pos))
+                "       shape_pos = pos;\n"
+                "       shape_edges = edges;\n"
+                "       shape_span = span;\n"),
+    .fs_vars = ("varying vec2 shape_pos;\n"
+                "varying vec4 shape_edges;\n"
+                "varying vec4 shape_span;\n"
+                "float shape_row(float x, float y0, float y1)\n"
+                "{\n"
+                "       float t = max(y0, shape_span.x);\n"
+                "       float b = min(y1, shape_span.y);\n"
+                "       float m = 0.5 * (t + b);\n"
+                "       float e0 = shape_edges.x + m * shape_edges.y;\n"
+                "       float e1 = shape_edges.z + m * shape_edges.w +\n"
+                "                  max(m - shape_span.z, 0.0) * (shape_span.w - shape_edges.w);\n"
+                "       float l = clamp(min(e0, e1) - x, 0.0, 1.0);\n"
+                "       float r = clamp(max(e0, e1) - x, 0.0, 1.0);\n"
+                "       return (r - l) * max(b - t, 0.0);\n"
+                "}\n"),
+    .fs_exec = ("       vec2 p = floor(shape_pos);\n"
+                "       float c = shape_row(p.x, p.y, p.y + 0.25) +\n"
+                "                 shape_row(p.x, p.y + 0.25, p.y + 0.5) +\n"
+                "                 shape_row(p.x, p.y + 0.5, p.y + 0.75) +\n"
+                "                 shape_row(p.x, p.y + 0.75, p.y + 1.0);\n"
+                "       vec4 mask = vec4(c);\n"),
+    .source_name = "edges",
+    .mask_name = "span",
+};
+
+#define GLAMOR_SHAPE_VERTEX_FLOATS      12
+
+/* Shapes per draw call; bounds the VBO and index buffer sizes */
+#define GLAMOR_SHAPE_BATCH              4096
+
+static inline double
+glamor_shape_x1(const glamor_shape *shape, double y)
+{
+    return shape->x1 + (y - shape->top) * shape->dx1 +
+        MAX(y - shape->split, 0) * (shape->dx2 - shape->dx1);
+}
+
+/*
+ * Translate a bounds coordinate and clamp it to what a BoxRec holds;
+ * edges extrapolated far off-screen must not overflow.
+ */
+static short
+glamor_shape_coord(double v, int d)
+{
+    v += d;
+    if (!(v >= MINSHORT))
+        return MINSHORT;
+    if (v > MAXSHORT)
+        return MAXSHORT;
+    return (short) v;
+}
+
+static void
+glamor_shape_bounds(const glamor_shape *shape, int dx, int dy, BoxPtr box)
+{
+    double height = shape->bottom - shape->top;
+    double xmin, xmax, x;
+
+    xmin = xmax = shape->x0;
+    x = shape->x0 + height * shape->dx0;
+    xmin = MIN(xmin, x); xmax = MAX(xmax, x);
+    x = glamor_shape_x1(shape, shape->top);
+    xmin = MIN(xmin, x); xmax = MAX(xmax, x);
+    x = glamor_shape_x1(shape, shape->split);
+    xmin = MIN(xmin, x); xmax = MAX(xmax, x);
+    x = glamor_shape_x1(shape, shape->bottom);
+    xmin = MIN(xmin, x); xmax = MAX(xmax, x);
+
+    box->x1 = glamor_shape_coord(floor(xmin), dx);
+    box->y1 = glamor_shape_coord(floor(shape->top), dy);
+    box->x2 = glamor_shape_coord(ceil(xmax), dx);
+    box->y2 = glamor_shape_coord(ceil(shape->bottom), dy);
+}
+
+static void
+glamor_shapes_bounds(int nshape, const glamor_shape *shapes, BoxPtr bounds)
+{
+    BoxRec box;
+    int n;
+
+    bounds->x1 = bounds->y1 = MAXSHORT;
+    bounds->x2 = bounds->y2 = MINSHORT;
+    for (n = 0; n < nshape; n++) {
+        glamor_shape_bounds(&shapes[n], 0, 0, &box);
+        bounds->x1 = MIN(bounds->x1, box.x1);
+        bounds->y1 = MIN(bounds->y1, box.y1);
+        bounds->x2 = MAX(bounds->x2, box.x2);
+        bounds->y2 = MAX(bounds->y2, box.y2);
+    }
+}
+
+/*
+ * Write the four vertices for one shape translated by (dx, dy),
+ * clipped to 'extents'.  Returns the number of quads emitted.
+ */
+static int
+glamor_shape_emit(GLfloat *v, const glamor_shape *shape, int dx, int dy,
+                  const BoxRec *extents)
+{
+    BoxRec box;
+    double top = shape->top + dy;
+    int i;
+
+    glamor_shape_bounds(shape, dx, dy, &box);
+    box.x1 = MAX(box.x1, extents->x1);
+    box.y1 = MAX(box.y1, extents->y1);
+    box.x2 = MIN(box.x2, extents->x2);
+    box.y2 = MIN(box.y2, extents->y2);
+
+    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+        return 0;
+
+    for (i = 0; i < 4; i++) {
+        v[0] = box.x1;
+        v[1] = box.y1;
+        v[2] = (i == 1 || i == 2) ? box.x2 - box.x1 : 0;
+        v[3] = (i >= 2) ? box.y2 - box.y1 : 0;
+        v[4] = shape->x0 + dx - box.x1 + (box.y1 - top) * shape->dx0;
+        v[5] = shape->dx0;
+        v[6] = shape->x1 + dx - box.x1 + (box.y1 - top) * shape->dx1;
+        v[7] = shape->dx1;
+        v[8] = top - box.y1;
+        v[9] = shape->bottom + dy - box.y1;
+        v[10] = shape->split + dy - box.y1;
+        v[11] = shape->dx2;
+        v += GLAMOR_SHAPE_VERTEX_FLOATS;
+    }
+    return 1;
+}
+
+/*
+ * Composite (src IN coverage) OP dst for each shape, in order.  Shapes
+ * are translated by (dx, dy) and the source is sampled at the
+ * destination position plus (src_dx, src_dy).  Since GL blends
+ * primitives in submission order, overlapping shapes behave exactly as
+ * if they were composited one at a time.
+ */
+static Bool
+glamor_shapes_draw(CARD8 op, PicturePtr src, PicturePtr dst,
+                   int src_dx, int src_dy, int dx, int dy,
+                   int nshape, const glamor_shape *shapes)
+{
+    DrawablePtr drawable = dst->pDrawable;
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    glamor_program *prog;
+    BoxRec extents;
+    GLfloat *v;
+    char *vbo_offset;
+    int stride = GLAMOR_SHAPE_VERTEX_FLOATS * sizeof (GLfloat);
+    int box_index;
+    int off_x, off_y;
+    int n, nquad;
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    if (dst->alphaMap)
+        return FALSE;
+
+    if (src->pDrawable) {
+        PixmapPtr src_pixmap = glamor_get_drawable_pixmap(src->pDrawable);
+        BoxRec bounds;
+
+        if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(glamor_get_pixmap_private(src_pixmap)))
+            return FALSE;
+
+        /* The plain picture source samples without clipping to the
+         * source, so it must cover everything we are going to read.
+         */
+        if (glamor_picture_is_plain(src)) {
+            glamor_shapes_bounds(nshape, shapes, &bounds);
+            if (bounds.x1 + dx + src_dx < 0 ||
+                bounds.y1 + dy + src_dy < 0 ||
+                bounds.x2 + dx + src_dx > src->pDrawable->width ||
+                bounds.y2 + dy + src_dy > src->pDrawable->height)
+                return FALSE;
+        }
+    }
+
+    glamor_make_current(glamor_priv);
+
+    prog = glamor_setup_program_render(op, src, NULL, dst,
+                                       &glamor_priv->shape_program,
+                                       &glamor_facet_shape, NULL);
+    if (!prog)
+        return FALSE;
+
+    if (!glamor_use_program_render(prog, op, src, dst)) {
+        glDisable(GL_BLEND);
+        return FALSE;
+    }
+
+    if (prog->locations & glamor_program_location_fillpos)
+        glUniform2f(prog->fill_offset_uniform, src_dx, src_dy);
+
+    extents = *RegionExtents(dst->pCompositeClip);
+    extents.x1 -= drawable->x;
+    extents.x2 -= drawable->x;
+    extents.y1 -= drawable->y;
+    extents.y2 -= drawable->y;
+
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_MASK);
+    glEnable(GL_SCISSOR_TEST);
+
+    while (nshape) {
+        int batch = MIN(nshape, GLAMOR_SHAPE_BATCH);
+
+        v = glamor_get_vbo_space(screen, batch * 4 * stride, &vbo_offset);
+
+        glVertexAttribPointer(GLAMOR_VERTEX_POS, 4, GL_FLOAT, GL_FALSE,
+                              stride, vbo_offset);
+        glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 4, GL_FLOAT, GL_FALSE,
+                              stride, vbo_offset + 4 * sizeof (GLfloat));
+        glVertexAttribPointer(GLAMOR_VERTEX_MASK, 4, GL_FLOAT, GL_FALSE,
+                              stride, vbo_offset + 8 * sizeof (GLfloat));
+
+        nquad = 0;
+        for (n = 0; n < batch; n++)
+            nquad += glamor_shape_emit(v + nquad * 4 * GLAMOR_SHAPE_VERTEX_FLOATS,
+                                       &shapes[n], dx, dy, &extents);
+
+        glamor_put_vbo_space(screen);
+
+        shapes += batch;
+        nshape -= batch;
+
+        if (nquad == 0)
+            continue;
+
+        glamor_pixmap_loop(pixmap_priv, box_index) {
+            BoxPtr box = RegionRects(dst->pCompositeClip);
+            int nbox = RegionNumRects(dst->pCompositeClip);
+
+            glamor_set_destination_drawable(drawable, box_index, TRUE, FALSE,
+                                            prog->matrix_uniform,
+                                            &off_x, &off_y);
+
+            while (nbox--) {
+                glScissor(box->x1 + off_x,
+                          box->y1 + off_y,
+                          box->x2 - box->x1,
+                          box->y2 - box->y1);
+                box++;
+                glamor_glDrawArrays_GL_QUADS(glamor_priv, nquad);
+            }
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_MASK);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glDisable(GL_BLEND);
+    return TRUE;
+}
+
+/* Does sampling the source depend on where we draw? */
+static inline Bool
+glamor_source_is_uniform(PicturePtr src)
+{
+    if (src->pDrawable)
+        return src->pDrawable->width == 1 && src->pDrawable->height == 1 &&
+            src->repeat;
+    return src->pSourcePict &&
+        src->pSourcePict->type == SourcePictTypeSolidFill;
+}
+
+/**
+ * Add the coverage of each shape, translated by (dx, dy), to 'dst'.
+ * This is AddTraps, and how masks for glamor_composite_shapes() are
+ * accumulated.
+ */
+Bool
+glamor_add_shapes(PicturePtr dst, int dx, int dy,
+                  int nshape, const glamor_shape *shapes)
+{
+    static xRenderColor white = { 0xffff, 0xffff, 0xffff, 0xffff };
+    PicturePtr solid;
+    int error;
+    Bool ret;
+
+    if (nshape == 0)
+        return TRUE;
+
+    solid = CreateSolidPicture(0, &white, &error);
+    if (!solid)
+        return FALSE;
+
+    ret = glamor_shapes_draw(PictOpAdd, solid, dst, 0, 0, dx, dy,
+                             nshape, shapes);
+
+    FreePicture(solid, 0);
+    return ret;
+}
+
+/*
+ * Accumulate coverage for all shapes into a temporary mask and
+ * composite through it once.  GLES2 can't render to single channel
+ * textures, so the mask is a8r8g8b8 with coverage in alpha.
+ */
+static Bool
+glamor_composite_shapes_mask(CARD8 op, PicturePtr src, PicturePtr dst,
+                             int src_dx, int src_dy,
+                             int nshape, const glamor_shape *shapes)
+{
+    ScreenPtr screen = dst->pDrawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PictFormatPtr format;
+    PixmapPtr pixmap;
+    PicturePtr mask;
+    BoxRec bounds;
+    int width, height;
+    int error;
+    Bool ret;
+
+    glamor_shapes_bounds(nshape, shapes, &bounds);
+    if (bounds.y1 >= bounds.y2 || bounds.x1 >= bounds.x2)
+        return TRUE;
+
+    width = bounds.x2 - bounds.x1;
+    height = bounds.y2 - bounds.y1;
+    if (!glamor_check_fbo_size(glamor_priv, width, height))
+        return FALSE;
+
+    format = PictureMatchFormat(screen, 32, PICT_a8r8g8b8);
+    if (!format)
+        return FALSE;
+
+    pixmap = glamor_create_pixmap(screen, width, height, 32, 0);
+    if (!pixmap)
+        return FALSE;
+    if (!glamor_pixmap_has_fbo(pixmap)) {
+        glamor_destroy_pixmap(pixmap);
+        return FALSE;
+    }
+    glamor_solid(pixmap, 0, 0, width, height, 0);
+
+    mask = CreatePicture(0, &pixmap->drawable, format, 0, 0,
+                         serverClient, &error);
+    glamor_destroy_pixmap(pixmap);
+    if (!mask)
+        return FALSE;
+    ValidatePicture(mask);
+
+    ret = glamor_add_shapes(mask, -bounds.x1, -bounds.y1, nshape, shapes);
+    if (ret)
+        CompositePicture(op, src, mask, dst,
+                         bounds.x1 + src_dx,
+                         bounds.y1 + src_dy,
+                         0, 0,
+                         bounds.x1, bounds.y1,
+                         width, height);
+
+    FreePicture(mask, 0);
+    return ret;
+}
+
+/**
+ * Composite shapes with fbShapes semantics: with a mask format all
+ * coverage is summed into one mask, without one each shape is
+ * composited on its own, straight into the destination.  (x_dst,
+ * y_dst) is the point the source origin is relative to for every
+ * shape; fb takes it from the first primitive of the request.
+ *
+ * Nothing is drawn unless all of the shapes can be, so a FALSE return
+ * leaves the destination for the fallback untouched.
+ */
+Bool
+glamor_composite_shapes(CARD8 op, PicturePtr src, PicturePtr dst,
+                        PictFormatPtr mask_format,
+                        INT16 x_src, INT16 y_src,
+                        int x_dst, int y_dst,
+                        int nshape, const glamor_shape *shapes)
+{
+    if (nshape == 0)
+        return TRUE;
+
+    if (mask_format) {
+        if (mask_format->depth == 1)
+            return FALSE;
+        return glamor_composite_shapes_mask(op, src, dst,
+                                            x_src - x_dst, y_src - y_dst,
+                                            nshape, shapes);
+    }
+
+    if (dst->polyEdge == PolyEdgeSharp)
+        return FALSE;
+
+    /* With a common source offset, drawing the shapes in one pass
+     * blends them one after the other just like separate composites,
+     * and all of them are checked before the first is drawn.
+     */
+    if (glamor_source_is_uniform(src))
+        return glamor_shapes_draw(op, src, dst, 0, 0, 0, 0,
+                                  nshape, shapes);
+
+    return glamor_shapes_draw(op, src, dst, x_src - x_dst, y_src - y_dst,
+                              0, 0, nshape, shapes);
+}
+
+static Bool
+glamor_line_slope(const xLineFixed *line, double *dx)
+{
+    if (line->p1.y == line->p2.y)
+        return FALSE;
+
+    *dx = (xFixedToDouble(line->p2.x) - xFixedToDouble(line->p1.x)) /
+        (xFixedToDouble(line->p2.y) - xFixedToDouble(line->p1.y));
+    return TRUE;
+}
+
+static Bool
+glamor_trapezoid_to_shape(const xTrapezoid *trap, glamor_shape *shape)
+{
+    if (trap->bottom <= trap->top)
+        return FALSE;
+
+    if (!glamor_line_slope(&trap->left, &shape->dx0) ||
+        !glamor_line_slope(&trap->right, &shape->dx1))
+        return FALSE;
+
+    shape->top = xFixedToDouble(trap->top);
+    shape->bottom = xFixedToDouble(trap->bottom);
+    shape->x0 = xFixedToDouble(trap->left.p1.x) +
+        (shape->top - xFixedToDouble(trap->left.p1.y)) * shape->dx0;
+    shape->x1 = xFixedToDouble(trap->right.p1.x) +
+        (shape->top - xFixedToDouble(trap->right.p1.y)) * shape->dx1;
+    shape->split = shape->bottom;
+    shape->dx2 = shape->dx1;
+    return TRUE;
+}
+
+/*
+ * Convert trapezoids to shapes, dropping degenerate ones.  Returns
+ * the number of shapes, or -1 on allocation failure.
+ */
+static int
+glamor_trapezoids_to_shapes(int ntrap, const xTrapezoid *traps,
+                            glamor_shape **shapes_ret)
+{
+    glamor_shape *shapes;
+    int n, nshape = 0;
+
+    shapes = xallocarray(ntrap, sizeof (glamor_shape));
+    if (!shapes)
+        return -1;
+
+    for (n = 0; n < ntrap; n++)
+        if (glamor_trapezoid_to_shape(&traps[n], &shapes[nshape]))
+            nshape++;
+
+    *shapes_ret = shapes;
+    return nshape;
+}
+
+static Bool
+glamor_trapezoids_gl(CARD8 op,
+                     PicturePtr src, PicturePtr dst,
+                     PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
+                     int ntrap, xTrapezoid *traps)
+{
+    glamor_shape *shapes;
+    int nshape;
+    Bool ret;
+
+    if (ntrap == 0)
+        return TRUE;
+
+    nshape = glamor_trapezoids_to_shapes(ntrap, traps, &shapes);
+    if (nshape < 0)
+        return FALSE;
+
+    /* As in fbTrapezoids, the source is relative to the first
+     * trapezoid, degenerate or not.
+     */
+    ret = glamor_composite_shapes(op, src, dst, mask_format, x_src, y_src,
+                                  traps[0].left.p1.x >> 16,
+                                  traps[0].left.p1.y >> 16,
+                                  nshape, shapes);
+    free(shapes);
+    return ret;
+}
+
 /**
  * Creates an appropriate picture for temp mask use.
  */
@@ -70,14 +595,14 @@ glamor_create_mask_picture(ScreenPtr screen,
 }
 
 /**
- * glamor_trapezoids will generate trapezoid mask accumulating in
- * system memory.
+ * Rasterize the trapezoids in system memory with pixman and
+ * composite through the resulting mask.
  */
-void
-glamor_trapezoids(CARD8 op,
-                  PicturePtr src, PicturePtr dst,
-                  PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
-                  int ntrap, xTrapezoid *traps)
+static void
+glamor_trapezoids_bail(CARD8 op,
+                       PicturePtr src, PicturePtr dst,
+                       PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
+                       int ntrap, xTrapezoid *traps)
 {
     ScreenPtr screen = dst->pDrawable->pScreen;
     BoxRec bounds;
@@ -96,9 +621,16 @@ glamor_trapezoids(CARD8 op,
             mask_format = PictureMatchFormat(screen, 1, PICT_a1);
         else
             mask_format = PictureMatchFormat(screen, 8, PICT_a8);
+        /* Each call measures the source from its own trapezoid;
+         * shift it so they all agree with the first one, as in fb.
+         */
+        x_dst = traps[0].left.p1.x >> 16;
+        y_dst = traps[0].left.p1.y >> 16;
         for (; ntrap; ntrap--, traps++)
-            glamor_trapezoids(op, src, dst, mask_format, x_src,
-                              y_src, 1, traps);
+            glamor_trapezoids_bail(op, src, dst, mask_format,
+                                   x_src + (traps->left.p1.x >> 16) - x_dst,
+                                   y_src + (traps->left.p1.y >> 16) - y_dst,
+                                   1, traps);
         return;
     }
 
@@ -154,3 +686,23 @@ glamor_trapezoids(CARD8 op,
 
     FreePicture(picture, 0);
 }
+
+void
+glamor_trapezoids(CARD8 op,
+                  PicturePtr src, PicturePtr dst,
+                  PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
+                  int ntrap, xTrapezoid *traps)
+{
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(dst->pDrawable->pScreen);
+
+    if (glamor_trapezoids_gl(op, src, dst, mask_format, x_src, y_src,
+                             ntrap, traps))
+        return;
+
+    glamor_priv->trapezoid_fallbacks++;
+    glamor_fallback("trapezoids to %p (%c)\n", dst->pDrawable,
+                    glamor_get_drawable_location(dst->pDrawable));
+    glamor_trapezoids_bail(op, src, dst, mask_format, x_src, y_src,
+                           ntrap, traps);
+}
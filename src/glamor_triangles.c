@@ -28,6 +28,84 @@
 
 #include "glamor_priv.h"
 
+/*
+ * A triangle is the shape between its long edge, from the top vertex
+ * to the bottom one, and the two short edges joined at the middle
+ * vertex.
+ */
+static Bool
+glamor_triangle_to_shape(const xTriangle *tri, glamor_shape *shape)
+{
+    const xPointFixed *a = &tri->p1, *b = &tri->p2, *c = &tri->p3, *t;
+    double ax, ay, bx, by, cx, cy;
+
+    /* Sort by y, keeping the original order for ties */
+    if (b->y < a->y) {
+        t = a; a = b; b = t;
+    }
+    if (c->y < b->y) {
+        t = b; b = c; c = t;
+        if (b->y < a->y) {
+            t = a; a = b; b = t;
+        }
+    }
+
+    if (a->y == c->y)
+        return FALSE;
+
+    ax = xFixedToDouble(a->x); ay = xFixedToDouble(a->y);
+    bx = xFixedToDouble(b->x); by = xFixedToDouble(b->y);
+    cx = xFixedToDouble(c->x); cy = xFixedToDouble(c->y);
+
+    shape->top = ay;
+    shape->bottom = cy;
+    shape->x0 = ax;
+    shape->dx0 = (cx - ax) / (cy - ay);
+    shape->split = by;
+    shape->dx2 = by < cy ? (cx - bx) / (cy - by) : 0;
+    if (ay < by) {
+        shape->x1 = ax;
+        shape->dx1 = (bx - ax) / (by - ay);
+        if (by == cy)
+            shape->dx2 = shape->dx1;
+    } else {
+        shape->x1 = bx;
+        shape->dx1 = shape->dx2;
+    }
+    return TRUE;
+}
+
+static Bool
+glamor_triangles_gl(CARD8 op,
+                    PicturePtr src, PicturePtr dst,
+                    PictFormatPtr mask_format, INT16 x_src, INT16 y_src,
+                    int ntris, xTriangle *tris)
+{
+    glamor_shape *shapes;
+    int n, nshape = 0;
+    Bool ret;
+
+    if (ntris == 0)
+        return TRUE;
+
+    shapes = xallocarray(ntris, sizeof (glamor_shape));
+    if (!shapes)
+        return FALSE;
+
+    for (n = 0; n < ntris; n++)
+        if (glamor_triangle_to_shape(&tris[n], &shapes[nshape]))
+            nshape++;
+
+    /* As in fbTriangles, the source is relative to the first vertex
+     * of the first triangle, degenerate or not.
+     */
+    ret = glamor_composite_shapes(op, src, dst, mask_format, x_src, y_src,
+                                  tris[0].p1.x >> 16, tris[0].p1.y >> 16,
+                                  nshape, shapes);
+    free(shapes);
+    return ret;
+}
+
 void
 glamor_triangles(CARD8 op,
                  PicturePtr pSrc,
@@ -35,6 +113,16 @@ glamor_triangles(CARD8 op,
                  PictFormatPtr maskFormat,
                  INT16 xSrc, INT16 ySrc, int ntris, xTriangle * tris)
 {
+    glamor_screen_private *glamor_priv =
+        glamor_get_screen_private(pDst->pDrawable->pScreen);
+
+    if (glamor_triangles_gl(op, pSrc, pDst, maskFormat, xSrc, ySrc,
+                            ntris, tris))
+        return;
+
+    glamor_priv->triangle_fallbacks++;
+    glamor_fallback("triangles to %p (%c)\n", pDst->pDrawable,
+                    glamor_get_drawable_location(pDst->pDrawable));
     if (glamor_prepare_access_picture(pDst, GLAMOR_ACCESS_RW) &&
         glamor_prepare_access_picture(pSrc, GLAMOR_ACCESS_RO)) {
         fbTriangles(op, pSrc, pDst, maskFormat, xSrc, ySrc, ntris, tris);
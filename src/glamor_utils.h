@@ -726,6 +726,12 @@ glamor_make_current(glamor_screen_private *glamor_priv)
         lastGLContext = &glamor_priv->ctx;
         glamor_priv->ctx.make_current(&glamor_priv->ctx);
     }
+
+    /* Batched composites rely on the GL state they were set up with,
+     * so draw them before anything else gets to change it.
+     */
+    if (glamor_priv->render_batch_quads)
+        glamor_composite_flush(glamor_priv);
 }
 
 /**
@@ -0,0 +1,604 @@
+/*
+ * Copyright © 2014 Keith Packard
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Solid wide lines and segments.
+ *
+ * A wide line is the union of a rectangle per segment, the caps at
+ * the ends and the joins between segments.  Rectangles and round
+ * caps/joins are drawn from per-segment and per-point data (instanced
+ * with GLSL 1.30, expanded to triangles otherwise), round shapes
+ * discard fragments outside of the circle, and miter and bevel joins
+ * are computed here as triangles.
+ *
+ * Pieces overlap, so pixels can be hit more than once; that's only
+ * correct for raster ops where painting twice is the same as painting
+ * once, everything else is left to mi.
+ */
+
+#include <math.h>
+
+#include "glamor_priv.h"
+#include "glamor_program.h"
+#include "glamor_transform.h"
+
+/* X switches from miter to bevel joins below 11 degrees */
+#define GLAMOR_WIDE_MITER_LIMIT_COS     0.98162718344766395
+
+static const glamor_facet glamor_facet_wide_tris = {
+    .name = "wide_tris",
+    .vs_vars = "attribute vec2 primitive;\n",
+    .vs_exec = ("       vec2 pos = vec2(0.0,0.0);\n"
+                GLAMOR_POS(gl_Position, primitive.xy)),
+};
+
+static const glamor_facet glamor_facet_wide_segment_130 = {
+    .name = "wide_segment",
+    .version = 130,
+    .vs_vars = ("attribute vec4 primitive;\n"
+                "attribute vec3 extent;\n"),
+    .vs_exec = ("       vec2 d = primitive.zw - primitive.xy;\n"
+                "       float len = length(d);\n"
+                "       vec2 dir = len > 0.0 ? d / len : vec2(1.0, 0.0);\n"
+                "       vec2 corner = vec2(gl_VertexID&1, (gl_VertexID&2)>>1);\n"
+                "       vec2 pos = mix(-dir * extent.y, d + dir * extent.z, corner.x);\n"
+                "       pos += vec2(-dir.y, dir.x) * extent.x * (corner.y * 2.0 - 1.0);\n"
+                GLAMOR_POS(gl_Position, (primitive.xy + pos))),
+    .source_name = "extent",
+};
+
+static const char wide_round_fs_vars[] =
+    "varying vec3 round_pos;\n";
+
+static const char wide_round_fs_exec[] =
+    "       if (dot(round_pos.xy, round_pos.xy) > round_pos.z * round_pos.z)\n"
+    "               discard;\n";
+
+static const glamor_facet glamor_facet_wide_round_130 = {
+    .name = "wide_round",
+    .version = 130,
+    .vs_vars = ("attribute vec3 primitive;\n"
+                "varying vec3 round_pos;\n"),
+    .vs_exec = ("       vec2 corner = vec2(gl_VertexID&1, (gl_VertexID&2)>>1);\n"
+                "       vec2 pos = (corner * 2.0 - 1.0) * (primitive.z + 0.5);\n"
+                "       round_pos = vec3(pos, primitive.z);\n"
+                GLAMOR_POS(gl_Position, (primitive.xy + pos))),
+    .fs_vars = wide_round_fs_vars,
+    .fs_exec = wide_round_fs_exec,
+};
+
+static const glamor_facet glamor_facet_wide_round_120 = {
+    .name = "wide_round",
+    .vs_vars = ("attribute vec2 primitive;\n"
+                "attribute vec3 center;\n"
+                "varying vec3 round_pos;\n"),
+    .vs_exec = ("       vec2 pos = vec2(0.0,0.0);\n"
+                "       round_pos = vec3(primitive.xy - center.xy, center.z);\n"
+                GLAMOR_POS(gl_Position, primitive.xy)),
+    .fs_vars = wide_round_fs_vars,
+    .fs_exec = wide_round_fs_exec,
+    .source_name = "center",
+};
+
+/* Per-segment data, also the instance layout of wide_segment_130 */
+typedef struct {
+    GLfloat x1, y1, x2, y2;
+    GLfloat half_width, ext1, ext2;
+} glamor_wide_seg;
+
+typedef struct {
+    Bool                instanced;
+    GLfloat             half_width;
+
+    GLfloat             *tris;          /* x, y per vertex */
+    int                 ntri_verts;
+    glamor_wide_seg     *segs;          /* instanced only */
+    int                 nseg;
+    GLfloat             *rounds;        /* x, y, r per instance, or
+                                         * x, y, cx, cy, r per vertex */
+    int                 nround;
+} glamor_wide_geom;
+
+static inline void
+glamor_wide_vert(glamor_wide_geom *g, GLfloat x, GLfloat y)
+{
+    GLfloat *v = g->tris + g->ntri_verts * 2;
+
+    v[0] = x;
+    v[1] = y;
+    g->ntri_verts++;
+}
+
+static void
+glamor_wide_tri(glamor_wide_geom *g,
+                GLfloat x0, GLfloat y0,
+                GLfloat x1, GLfloat y1,
+                GLfloat x2, GLfloat y2)
+{
+    glamor_wide_vert(g, x0, y0);
+    glamor_wide_vert(g, x1, y1);
+    glamor_wide_vert(g, x2, y2);
+}
+
+static void
+glamor_wide_round(glamor_wide_geom *g, GLfloat x, GLfloat y)
+{
+    GLfloat r = g->half_width;
+
+    if (g->instanced) {
+        GLfloat *v = g->rounds + g->nround * 3;
+
+        v[0] = x;
+        v[1] = y;
+        v[2] = r;
+    } else {
+        static const GLfloat corner[6][2] = {
+            { -1, -1 }, { 1, -1 }, { -1, 1 },
+            { 1, -1 }, { -1, 1 }, { 1, 1 },
+        };
+        GLfloat *v = g->rounds + g->nround * 6 * 5;
+        int i;
+
+        for (i = 0; i < 6; i++) {
+            v[0] = x + corner[i][0] * (r + 0.5f);
+            v[1] = y + corner[i][1] * (r + 0.5f);
+            v[2] = x;
+            v[3] = y;
+            v[4] = r;
+            v += 5;
+        }
+    }
+    g->nround++;
+}
+
+/*
+ * The body of a segment, extended by ext1/ext2 along the segment at
+ * either end for projecting caps.  Zero length segments are treated
+ * as horizontal.
+ */
+static void
+glamor_wide_segment(glamor_wide_geom *g,
+                    GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2,
+                    GLfloat ext1, GLfloat ext2)
+{
+    GLfloat dx, dy, len, nx, ny, ax, ay, bx, by;
+
+    if (g->instanced) {
+        glamor_wide_seg *s = &g->segs[g->nseg++];
+
+        s->x1 = x1;
+        s->y1 = y1;
+        s->x2 = x2;
+        s->y2 = y2;
+        s->half_width = g->half_width;
+        s->ext1 = ext1;
+        s->ext2 = ext2;
+        return;
+    }
+
+    dx = x2 - x1;
+    dy = y2 - y1;
+    len = sqrtf(dx * dx + dy * dy);
+    if (len > 0) {
+        dx /= len;
+        dy /= len;
+    } else {
+        dx = 1;
+        dy = 0;
+    }
+    nx = -dy * g->half_width;
+    ny = dx * g->half_width;
+    ax = x1 - dx * ext1;
+    ay = y1 - dy * ext1;
+    bx = x2 + dx * ext2;
+    by = y2 + dy * ext2;
+
+    glamor_wide_tri(g, ax + nx, ay + ny, bx + nx, by + ny, ax - nx, ay - ny);
+    glamor_wide_tri(g, bx + nx, by + ny, ax - nx, ay - ny, bx - nx, by - ny);
+}
+
+/*
+ * The join at (x1,y1) between the segment arriving from (x0,y0) and
+ * the one leaving towards (x2,y2).  Neither segment may be empty.
+ */
+static void
+glamor_wide_join(glamor_wide_geom *g, int join_style,
+                 GLfloat x0, GLfloat y0,
+                 GLfloat x1, GLfloat y1,
+                 GLfloat x2, GLfloat y2)
+{
+    GLfloat d1x = x1 - x0, d1y = y1 - y0;
+    GLfloat d2x = x2 - x1, d2y = y2 - y1;
+    GLfloat l1 = sqrtf(d1x * d1x + d1y * d1y);
+    GLfloat l2 = sqrtf(d2x * d2x + d2y * d2y);
+    GLfloat cross, dot, side, ax, ay, bx, by;
+
+    if (join_style == JoinRound) {
+        glamor_wide_round(g, x1, y1);
+        return;
+    }
+
+    d1x /= l1;
+    d1y /= l1;
+    d2x /= l2;
+    d2y /= l2;
+
+    cross = d1x * d2y - d1y * d2x;
+    if (cross == 0)
+        return;
+    dot = d1x * d2x + d1y * d2y;
+
+    /* The outside of the turn is to the right of a left turn */
+    side = cross > 0 ? -g->half_width : g->half_width;
+    ax = x1 - d1y * side;
+    ay = y1 + d1x * side;
+    bx = x1 - d2y * side;
+    by = y1 + d2x * side;
+
+    if (join_style == JoinMiter && -dot <= GLAMOR_WIDE_MITER_LIMIT_COS) {
+        GLfloat mx = x1 + (-d1y - d2y) * side / (1 + dot);
+        GLfloat my = y1 + (d1x + d2x) * side / (1 + dot);
+
+        glamor_wide_tri(g, x1, y1, ax, ay, mx, my);
+        glamor_wide_tri(g, x1, y1, mx, my, bx, by);
+    } else
+        glamor_wide_tri(g, x1, y1, ax, ay, bx, by);
+}
+
+/*
+ * A cap for one end of a segment.  Butt caps add nothing and
+ * projecting caps are folded into the segment body.
+ */
+static void
+glamor_wide_cap(glamor_wide_geom *g, int cap_style, GLfloat x, GLfloat y)
+{
+    if (cap_style == CapRound)
+        glamor_wide_round(g, x, y);
+}
+
+static GLfloat
+glamor_wide_cap_ext(glamor_wide_geom *g, int cap_style)
+{
+    return cap_style == CapProjecting ? g->half_width : 0;
+}
+
+/*
+ * Raster ops where painting a pixel twice gives the same result as
+ * painting it once
+ */
+static Bool
+glamor_wide_alu_idempotent(int alu)
+{
+    switch (alu) {
+    case GXclear:
+    case GXand:
+    case GXcopy:
+    case GXnoop:
+    case GXor:
+    case GXandInverted:
+    case GXcopyInverted:
+    case GXorInverted:
+    case GXset:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/*
+ * Reserve VBO space for the worst case amount of geometry
+ */
+static char *
+glamor_wide_geom_init(ScreenPtr screen, glamor_wide_geom *g, GCPtr gc,
+                      int max_tri_verts, int max_seg, int max_round)
+{
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    size_t tri_size, seg_size, round_size;
+    char *vbo_offset;
+    char *v;
+
+    g->instanced = glamor_priv->glsl_version >= 130;
+    g->half_width = gc->lineWidth / 2.0f;
+    g->ntri_verts = g->nseg = g->nround = 0;
+
+    if (!g->instanced) {
+        max_tri_verts += max_seg * 6;
+        max_seg = 0;
+        round_size = max_round * 6 * 5 * sizeof (GLfloat);
+    } else
+        round_size = max_round * 3 * sizeof (GLfloat);
+    tri_size = max_tri_verts * 2 * sizeof (GLfloat);
+    seg_size = max_seg * sizeof (glamor_wide_seg);
+
+    v = glamor_get_vbo_space(screen, tri_size + seg_size + round_size,
+                             &vbo_offset);
+    g->tris = (GLfloat *) v;
+    g->segs = (glamor_wide_seg *) (v + tri_size);
+    g->rounds = (GLfloat *) (v + tri_size + seg_size);
+    return vbo_offset;
+}
+
+static Bool
+glamor_wide_draw(DrawablePtr drawable, GCPtr gc, glamor_wide_geom *g,
+                 char *vbo_offset)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+    /* Each kind of geometry starts at its worst case offset */
+    char *tri_offset = vbo_offset;
+    char *seg_offset = vbo_offset + ((char *) g->segs - (char *) g->tris);
+    char *round_offset = vbo_offset + ((char *) g->rounds - (char *) g->tris);
+    glamor_program *prog;
+    int pass;
+    int off_x, off_y;
+    int box_index;
+    Bool ret = FALSE;
+
+    glamor_put_vbo_space(screen);
+
+    glEnable(GL_SCISSOR_TEST);
+    glEnableVertexAttribArray(GLAMOR_VERTEX_POS);
+
+    for (pass = 0; pass < 3; pass++) {
+        int count;
+
+        switch (pass) {
+        case 0:
+            if (!g->ntri_verts)
+                continue;
+            prog = glamor_use_program_fill(pixmap, gc,
+                                           &glamor_priv->wide_tris_program,
+                                           &glamor_facet_wide_tris);
+            if (!prog)
+                goto bail;
+            glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_FLOAT, GL_FALSE,
+                                  2 * sizeof (GLfloat), tri_offset);
+            count = g->ntri_verts;
+            break;
+        case 1:
+            if (!g->nseg)
+                continue;
+            prog = glamor_use_program_fill(pixmap, gc,
+                                           &glamor_priv->wide_segment_program,
+                                           &glamor_facet_wide_segment_130);
+            if (!prog)
+                goto bail;
+            glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+            glVertexAttribDivisor(GLAMOR_VERTEX_POS, 1);
+            glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 1);
+            glVertexAttribPointer(GLAMOR_VERTEX_POS, 4, GL_FLOAT, GL_FALSE,
+                                  sizeof (glamor_wide_seg), seg_offset);
+            glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 3, GL_FLOAT, GL_FALSE,
+                                  sizeof (glamor_wide_seg),
+                                  seg_offset + 4 * sizeof (GLfloat));
+            count = g->nseg;
+            break;
+        default:
+            if (!g->nround)
+                continue;
+            if (g->instanced) {
+                prog = glamor_use_program_fill(pixmap, gc,
+                                               &glamor_priv->wide_round_program,
+                                               &glamor_facet_wide_round_130);
+                if (!prog)
+                    goto bail;
+                glVertexAttribDivisor(GLAMOR_VERTEX_POS, 1);
+                glVertexAttribPointer(GLAMOR_VERTEX_POS, 3, GL_FLOAT, GL_FALSE,
+                                      3 * sizeof (GLfloat), round_offset);
+                count = g->nround;
+            } else {
+                prog = glamor_use_program_fill(pixmap, gc,
+                                               &glamor_priv->wide_round_program,
+                                               &glamor_facet_wide_round_120);
+                if (!prog)
+                    goto bail;
+                glEnableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+                glVertexAttribPointer(GLAMOR_VERTEX_POS, 2, GL_FLOAT, GL_FALSE,
+                                      5 * sizeof (GLfloat), round_offset);
+                glVertexAttribPointer(GLAMOR_VERTEX_SOURCE, 3, GL_FLOAT, GL_FALSE,
+                                      5 * sizeof (GLfloat),
+                                      round_offset + 2 * sizeof (GLfloat));
+                count = g->nround * 6;
+            }
+            break;
+        }
+
+        glamor_pixmap_loop(pixmap_priv, box_index) {
+            int nbox = RegionNumRects(gc->pCompositeClip);
+            BoxPtr box = RegionRects(gc->pCompositeClip);
+
+            glamor_set_destination_drawable(drawable, box_index, TRUE, TRUE,
+                                            prog->matrix_uniform,
+                                            &off_x, &off_y);
+
+            while (nbox--) {
+                glScissor(box->x1 + off_x,
+                          box->y1 + off_y,
+                          box->x2 - box->x1,
+                          box->y2 - box->y1);
+                box++;
+                if (pass == 0 || (pass == 2 && !g->instanced))
+                    glDrawArrays(GL_TRIANGLES, 0, count);
+                else
+                    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+            }
+        }
+
+        if (g->instanced) {
+            glVertexAttribDivisor(GLAMOR_VERTEX_POS, 0);
+            glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 0);
+        }
+        glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    }
+    ret = TRUE;
+
+bail:
+    if (g->instanced) {
+        glVertexAttribDivisor(GLAMOR_VERTEX_POS, 0);
+        glVertexAttribDivisor(GLAMOR_VERTEX_SOURCE, 0);
+    }
+    glDisableVertexAttribArray(GLAMOR_VERTEX_SOURCE);
+    glDisableVertexAttribArray(GLAMOR_VERTEX_POS);
+    glDisable(GL_SCISSOR_TEST);
+    return ret;
+}
+
+static Bool
+glamor_wide_check(DrawablePtr drawable, GCPtr gc)
+{
+    PixmapPtr pixmap = glamor_get_drawable_pixmap(drawable);
+    glamor_pixmap_private *pixmap_priv = glamor_get_pixmap_private(pixmap);
+
+    if (!GLAMOR_PIXMAP_PRIV_HAS_FBO(pixmap_priv))
+        return FALSE;
+
+    return glamor_wide_alu_idempotent(gc->alu);
+}
+
+Bool
+glamor_poly_lines_wide_gl(DrawablePtr drawable, GCPtr gc,
+                          int mode, int n, DDXPointPtr points)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_wide_geom g;
+    DDXPointPtr pts;
+    char *vbo_offset;
+    int cap_style = gc->capStyle == CapNotLast ? CapButt : gc->capStyle;
+    int npt, i;
+    Bool closed;
+
+    if (!glamor_wide_check(drawable, gc))
+        return FALSE;
+
+    if (n < 1)
+        return TRUE;
+
+    /* Absolute coordinates with repeated points dropped */
+    pts = xallocarray(n, sizeof (DDXPointRec));
+    if (!pts)
+        return FALSE;
+
+    npt = 0;
+    for (i = 0; i < n; i++) {
+        DDXPointRec p = points[i];
+
+        if (mode == CoordModePrevious && i > 0) {
+            p.x += pts[npt - 1].x;
+            p.y += pts[npt - 1].y;
+        }
+        if (npt && p.x == pts[npt - 1].x && p.y == pts[npt - 1].y)
+            continue;
+        pts[npt++] = p;
+    }
+
+    closed = npt > 2 &&
+        pts[0].x == pts[npt - 1].x && pts[0].y == pts[npt - 1].y;
+
+    glamor_make_current(glamor_priv);
+
+    /* npt - 1 segments, a round (or two triangles) per point */
+    vbo_offset = glamor_wide_geom_init(screen, &g, gc,
+                                       npt * 6, MAX(npt - 1, 1), npt + 1);
+
+    if (npt == 1) {
+        /* A single point only shows up with round or projecting caps */
+        if (cap_style == CapRound)
+            glamor_wide_round(&g, pts[0].x, pts[0].y);
+        else if (cap_style == CapProjecting)
+            glamor_wide_segment(&g, pts[0].x, pts[0].y, pts[0].x, pts[0].y,
+                                g.half_width, g.half_width);
+    } else {
+        for (i = 0; i < npt - 1; i++) {
+            GLfloat ext1 = 0, ext2 = 0;
+
+            if (!closed && i == 0)
+                ext1 = glamor_wide_cap_ext(&g, cap_style);
+            if (!closed && i == npt - 2)
+                ext2 = glamor_wide_cap_ext(&g, cap_style);
+            glamor_wide_segment(&g, pts[i].x, pts[i].y,
+                                pts[i + 1].x, pts[i + 1].y, ext1, ext2);
+        }
+
+        for (i = 1; i < npt - 1; i++)
+            glamor_wide_join(&g, gc->joinStyle,
+                             pts[i - 1].x, pts[i - 1].y,
+                             pts[i].x, pts[i].y,
+                             pts[i + 1].x, pts[i + 1].y);
+
+        if (closed) {
+            glamor_wide_join(&g, gc->joinStyle,
+                             pts[npt - 2].x, pts[npt - 2].y,
+                             pts[0].x, pts[0].y,
+                             pts[1].x, pts[1].y);
+        } else {
+            glamor_wide_cap(&g, cap_style, pts[0].x, pts[0].y);
+            glamor_wide_cap(&g, cap_style, pts[npt - 1].x, pts[npt - 1].y);
+        }
+    }
+
+    free(pts);
+
+    return glamor_wide_draw(drawable, gc, &g, vbo_offset);
+}
+
+Bool
+glamor_poly_segment_wide_gl(DrawablePtr drawable, GCPtr gc,
+                            int nseg, xSegment *segs)
+{
+    ScreenPtr screen = drawable->pScreen;
+    glamor_screen_private *glamor_priv = glamor_get_screen_private(screen);
+    glamor_wide_geom g;
+    char *vbo_offset;
+    int cap_style = gc->capStyle == CapNotLast ? CapButt : gc->capStyle;
+    GLfloat ext;
+    int i;
+
+    if (!glamor_wide_check(drawable, gc))
+        return FALSE;
+
+    if (nseg < 1)
+        return TRUE;
+
+    glamor_make_current(glamor_priv);
+
+    vbo_offset = glamor_wide_geom_init(screen, &g, gc, 0, nseg, nseg * 2);
+    ext = glamor_wide_cap_ext(&g, cap_style);
+
+    for (i = 0; i < nseg; i++) {
+        xSegment *s = &segs[i];
+
+        /* Zero length segments with butt caps draw nothing */
+        if (s->x1 == s->x2 && s->y1 == s->y2 && cap_style != CapProjecting) {
+            glamor_wide_cap(&g, cap_style, s->x1, s->y1);
+            continue;
+        }
+
+        glamor_wide_segment(&g, s->x1, s->y1, s->x2, s->y2, ext, ext);
+        glamor_wide_cap(&g, cap_style, s->x1, s->y1);
+        glamor_wide_cap(&g, cap_style, s->x2, s->y2);
+    }
+
+    return glamor_wide_draw(drawable, gc, &g, vbo_offset);
+}